@@ -454,6 +454,174 @@ void ContractBinary(FNdArrayView D, char const *pDecl, FNdArrayView S, FNdArrayV
    return ContractFirst(D, S, T, Factor, Add, Mem);
 };
 
+FTensorSymmetry::FTensorSymmetry(char const *pDecl, uint Rank)
+{
+   // read the generators
+   std::vector<FArraySizes>
+      Gens;
+   std::vector<FScalar>
+      GenSigns;
+   for (char const *p = pDecl; *p != 0; ) {
+      FArraySizes
+         Perm;
+      FScalar
+         Sign = 1.;
+      if (*p == '-') {
+         Sign = -1.;
+         ++ p;
+      }
+      for ( ; *p != 0 && *p != ','; ++ p)
+         Perm.push_back(*p - '0');
+      if (*p == ',')
+         ++ p;
+      bool
+         Valid = Perm.size() == Rank;
+      for (uint i = 0; Valid && i < Rank; ++ i)
+         Valid = Perm[i] < Rank && std::count(Perm.begin(), Perm.end(), Perm[i]) == 1;
+      if (!Valid)
+         throw std::runtime_error(boost::str(boost::format("invalid permutation symmetry '%s' for a tensor of rank %i.") % pDecl % Rank));
+      Gens.push_back(Perm);
+      GenSigns.push_back(Sign);
+   }
+
+   // close the group: multiply all elements found so far with the generators.
+   FArraySizes
+      Identity;
+   for (uint i = 0; i < Rank; ++ i)
+      Identity.push_back(i);
+   std::vector<FArraySizes>
+      Elems(1, Identity);
+   std::vector<FScalar>
+      ElemSigns(1, 1.);
+   for (size_t iElem = 0; iElem < Elems.size(); ++ iElem)
+      for (size_t iGen = 0; iGen < Gens.size(); ++ iGen) {
+         FArraySizes
+            Prod;
+         for (uint i = 0; i < Rank; ++ i)
+            Prod.push_back(Elems[iElem][Gens[iGen][i]]);
+         FScalar
+            Sign = ElemSigns[iElem] * GenSigns[iGen];
+         size_t
+            iFound = 0;
+         while (iFound < Elems.size() && !std::equal(Prod.begin(), Prod.end(), Elems[iFound].begin()))
+            ++ iFound;
+         if (iFound == Elems.size()) {
+            Elems.push_back(Prod);
+            ElemSigns.push_back(Sign);
+         } else if (ElemSigns[iFound] != Sign)
+            throw std::runtime_error(boost::str(boost::format("permutation symmetry '%s' forces the tensor to vanish.") % pDecl));
+      }
+   Perms.assign(Elems.begin() + 1, Elems.end());
+   Signs.assign(ElemSigns.begin() + 1, ElemSigns.end());
+}
+
+void FTensorSymmetry::AssertCompatible(FNdArrayView const &A) const
+{
+   for (size_t g = 0; g < Perms.size(); ++ g)
+      for (uint i = 0; i < A.Rank(); ++ i)
+         if (Perms[g].size() != A.Rank() || A.Sizes[Perms[g][i]] != A.Sizes[i])
+            throw std::runtime_error("permutation symmetry exchanges slots of different sizes.");
+}
+
+// true if pIdx is the lexicographically smallest of its images.
+bool FTensorSymmetry::IsCanonical(FArrayOffset const *pIdx, uint Rank) const
+{
+   for (size_t g = 0; g < Perms.size(); ++ g) {
+      FArraySizes const
+         &Perm = Perms[g];
+      for (uint i = Rank; i != 0; -- i) {
+         FArrayOffset
+            iImage = pIdx[Perm[i-1]];
+         if (iImage < pIdx[i-1])
+            return false;
+         if (iImage > pIdx[i-1])
+            break;
+      }
+   }
+   return true;
+}
+
+// run over all index tuples of A, first slot fastest.
+static bool NextIndex(FArrayOffset *pIdx, FNdArrayView const &A)
+{
+   for (uint i = 0; i < A.Rank(); ++ i) {
+      if (++ pIdx[i] < A.Sizes[i])
+         return true;
+      pIdx[i] = 0;
+   }
+   return false;
+}
+
+static FArrayOffset IndexOffset(FArrayOffset const *pIdx, FNdArrayView const &A)
+{
+   FArrayOffset r = 0;
+   for (uint i = 0; i < A.Rank(); ++ i)
+      r += pIdx[i] * A.Strides[i];
+   return r;
+}
+
+static FArrayOffset ImageOffset(FArrayOffset const *pIdx, FArraySizes const &Perm, FNdArrayView const &A)
+{
+   FArrayOffset r = 0;
+   for (uint i = 0; i < A.Rank(); ++ i)
+      r += pIdx[Perm[i]] * A.Strides[i];
+   return r;
+}
+
+FArrayOffset FTensorSymmetry::nPacked(FNdArrayView const &A) const
+{
+   AssertCompatible(A);
+   if (A.nValues() == 0)
+      return 0;
+   FArrayOffset
+      Idx[nMaxRank] = {0},
+      n = 0;
+   do {
+      if (IsCanonical(Idx, A.Rank()))
+         n += 1;
+   } while (NextIndex(Idx, A));
+   return n;
+}
+
+void FTensorSymmetry::Pack(FScalar *pOut, FNdArrayView const &A) const
+{
+   AssertCompatible(A);
+   if (A.nValues() == 0)
+      return;
+   FArrayOffset
+      Idx[nMaxRank] = {0};
+   FScalar
+      fNorm = 1./(1. + Perms.size());
+   do {
+      if (!IsCanonical(Idx, A.Rank()))
+         continue;
+      FScalar
+         v = A.pData[IndexOffset(Idx, A)];
+      for (size_t g = 0; g < Perms.size(); ++ g)
+         v += Signs[g] * A.pData[ImageOffset(Idx, Perms[g], A)];
+      *pOut++ = fNorm * v;
+   } while (NextIndex(Idx, A));
+}
+
+void FTensorSymmetry::Unpack(FNdArrayView &A, FScalar const *pIn) const
+{
+   AssertCompatible(A);
+   if (A.nValues() == 0)
+      return;
+   FArrayOffset
+      Idx[nMaxRank] = {0};
+   do {
+      if (!IsCanonical(Idx, A.Rank()))
+         continue;
+      FScalar
+         v = *pIn++;
+      A.pData[IndexOffset(Idx, A)] = v;
+      for (size_t g = 0; g < Perms.size(); ++ g)
+         A.pData[ImageOffset(Idx, Perms[g], A)] = Signs[g] * v;
+   } while (NextIndex(Idx, A));
+}
+
+
 static int FindChr(char what, char const *pDecl){
    char const *p = pDecl;
    for ( ; *p != 0 && *p != ','; ++ p)
@@ -462,10 +630,187 @@ static int FindChr(char what, char const *pDecl){
 }
 
 
+FContractCache::FContractCache(size_t MaxBytes_)
+   : m_MaxBytes(MaxBytes_), m_Bytes(0)
+{
+   omp_init_lock(&m_Lock);
+}
+
+FContractCache::~FContractCache()
+{
+   for (FEntryMap::iterator it = m_Entries.begin(); it != m_Entries.end(); ++ it)
+      delete it->second;
+   omp_destroy_lock(&m_Lock);
+}
+
+void FContractCache::AddStable(FScalar const *pData)
+{
+   omp_set_lock(&m_Lock);
+   m_Stable.insert(pData);
+   omp_unset_lock(&m_Lock);
+}
+
+bool FContractCache::IsStable(FScalar const *pData)
+{
+   omp_set_lock(&m_Lock);
+   bool r = m_Stable.count(pData) != 0;
+   omp_unset_lock(&m_Lock);
+   return r;
+}
+
+void FContractCache::Invalidate(FScalar const *pData)
+{
+   omp_set_lock(&m_Lock);
+   // intermediates made from dropped intermediates go, too.
+   std::set<FScalar const*>
+      Dropped;
+   Dropped.insert(pData);
+   for (bool Changed = true; Changed; ) {
+      Changed = false;
+      for (FEntryMap::iterator it = m_Entries.begin(); it != m_Entries.end(); ) {
+         FEntry *pEntry = it->second;
+         if (Dropped.count(pEntry->pSrc[0]) || Dropped.count(pEntry->pSrc[1])) {
+            Dropped.insert(&pEntry->Data[0]);
+            m_Stable.erase(&pEntry->Data[0]);
+            m_Bytes -= pEntry->Data.size() * sizeof(FScalar);
+            delete pEntry;
+            m_Entries.erase(it++);
+            Changed = true;
+         } else
+            ++ it;
+      }
+   }
+   omp_unset_lock(&m_Lock);
+}
+
+FScalar *FContractCache::Find(std::string const &Key)
+{
+   omp_set_lock(&m_Lock);
+   FEntryMap::iterator it = m_Entries.find(Key);
+   FScalar *r = (it != m_Entries.end() && it->second->Ready)? &it->second->Data[0] : 0;
+   omp_unset_lock(&m_Lock);
+   return r;
+}
+
+FScalar *FContractCache::Reserve(std::string const &Key, FArrayOffset nValues, FScalar const *pSrc0, FScalar const *pSrc1)
+{
+   FScalar *r = 0;
+   omp_set_lock(&m_Lock);
+   if (nValues != 0 && m_Bytes + nValues * sizeof(FScalar) <= m_MaxBytes && m_Entries.find(Key) == m_Entries.end()) {
+      FEntry *pEntry = new FEntry;
+      pEntry->Data.resize(nValues);
+      pEntry->pSrc[0] = pSrc0;
+      pEntry->pSrc[1] = pSrc1;
+      pEntry->Ready = false;
+      m_Entries[Key] = pEntry;
+      m_Bytes += nValues * sizeof(FScalar);
+      r = &pEntry->Data[0];
+   }
+   omp_unset_lock(&m_Lock);
+   return r;
+}
+
+void FContractCache::Commit(std::string const &Key)
+{
+   omp_set_lock(&m_Lock);
+   FEntry *pEntry = m_Entries[Key];
+   pEntry->Ready = true;
+   m_Stable.insert(&pEntry->Data[0]);
+   omp_unset_lock(&m_Lock);
+}
+
+// identifies the product of A[IdxA] and B[IdxB]: data, shapes and the index
+// pattern with the index names replaced by their order of appearance.
+static std::string ContractCacheKey(FNdArrayView const &A, std::string const &IdxA,
+   FNdArrayView const &B, std::string const &IdxB)
+{
+   std::string
+      Key;
+   char
+      Label[256] = {0},
+      nLabels = 0;
+   FNdArrayView const
+      *pTs[2] = {&A, &B};
+   std::string const
+      *pIdx[2] = {&IdxA, &IdxB};
+   for (uint k = 0; k < 2; ++ k) {
+      Key.append((char const*)&pTs[k]->pData, sizeof(pTs[k]->pData));
+      for (uint s = 0; s < pTs[k]->Rank(); ++ s) {
+         unsigned char c = (*pIdx[k])[s];
+         if (Label[c] == 0)
+            Label[c] = ++ nLabels;
+         Key += Label[c];
+         Key.append((char const*)&pTs[k]->Sizes[s], sizeof(FArrayOffset));
+         Key.append((char const*)&pTs[k]->Strides[s], sizeof(FArrayOffset));
+      }
+      Key += ',';
+   }
+   return Key;
+}
+
+// number of operations for contracting the terms A and B of a network, in
+// which every index occurs on exactly two terms. Rest receives the indices of
+// the product (those of A not on B, then those of B not on A).
+static double PairFlops(std::string const &A, std::string const &B, FArrayOffset const *pSizes, std::string &Rest)
+{
+   double
+      Flops = 1.;
+   Rest.clear();
+   for (uint s = 0; s < A.size(); ++ s) {
+      Flops *= pSizes[(unsigned char)A[s]];
+      if (B.find(A[s]) == std::string::npos)
+         Rest += A[s];
+   }
+   for (uint s = 0; s < B.size(); ++ s)
+      if (A.find(B[s]) == std::string::npos) {
+         Flops *= pSizes[(unsigned char)B[s]];
+         Rest += B[s];
+      }
+   return Flops;
+}
+
+static double IndexProduct(std::string const &Idx, FArrayOffset const *pSizes)
+{
+   double r = 1.;
+   for (uint s = 0; s < Idx.size(); ++ s)
+      r *= pSizes[(unsigned char)Idx[s]];
+   return r;
+}
+
+// fewest operations in which the network can be contracted pairwise.
+static double NetworkFlops(std::vector<std::string> const &Terms, FArrayOffset const *pSizes)
+{
+   std::string
+      Rest;
+   if (Terms.size() == 3) {
+      // D += S * T runs over all indices once, and all of them are on S or T.
+      return PairFlops(Terms[1], Terms[2], pSizes, Rest);
+   }
+   double
+      FlopsMin = -1.;
+   for (uint i0 = 0; i0 < Terms.size(); ++ i0)
+   for (uint i1 = i0+1; i1 < Terms.size(); ++ i1) {
+      double
+         Flops = PairFlops(Terms[i0], Terms[i1], pSizes, Rest);
+      std::vector<std::string>
+         Reduced;
+      for (uint i = 0; i < Terms.size(); ++ i)
+         if (i == i0)
+            Reduced.push_back(Rest);
+         else if (i != i1)
+            Reduced.push_back(Terms[i]);
+      Flops += NetworkFlops(Reduced, pSizes);
+      if (FlopsMin < 0. || Flops < FlopsMin)
+         FlopsMin = Flops;
+   }
+   return FlopsMin;
+}
+
+
 std::string g_dbgPrefix = ""; // FIXME: REMOVE THIS
 
 // note: (1) Declarations here come as 'dest,s0,s1,s2'. There is no '->', and dest comes first.
-void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, ct::FMemoryStack &Mem)
+void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, ct::FMemoryStack &Mem, FContractCache *pCache)
 {
    void *pBaseOfMemory = Mem.Alloc(0);
    bool Print = false;
@@ -505,39 +850,47 @@ void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, c
       return ContractBinary(*Ts[0], pDecl, *Ts[1], *Ts[2], Factor, Add, Mem);
    }
 
-   // count number of distinct and common indices for all tensor pairs.
-   // Find tensor pair with the smallest number of distinct indices
-   // and the largest number of common indices.
+   // find the pair for which contracting it first, and then the rest of the
+   // network in the best way, takes the fewest operations. Ties go to pairs
+   // of source tensors, whose product can be cached, and then to the pair
+   // with the smaller product.
+   FArrayOffset
+      IndexSizes[256];
+   std::vector<std::string>
+      Terms(nTerms);
+   for (uint i = 0; i < nTerms; ++ i) {
+      Terms[i].assign(&pDecl[iTerm[i]], &pDecl[iTerm[i+1]-1]);
+      for (uint s = 0; s < Ts[i]->Rank(); ++ s)
+         IndexSizes[(unsigned char)Terms[i][s]] = Ts[i]->Sizes[s];
+   }
    uint
       iBest = 0xffff, jBest = 0xffff;
-   size_t
-      DiMin = 0,
-      CoMax = 0;
+   double
+      FlopsMin = 0.,
+      DiMin = 0.;
    for (uint i0 = 0; i0 < nTerms; ++ i0)
    for (uint i1 = i0+1; i1 < nTerms; ++ i1) {
-      size_t
-         Di = 1,
-         Co = 1;
-      for (uint s0 = 0; s0 != Ts[i0]->Rank(); ++ s0)
-         if (-1 != FindChr(pDecl[iTerm[i0]+s0], &pDecl[iTerm[i1]])) {
-            // common
-            Co *= Ts[i0]->Sizes[s0];
-//             if (Ts[i0]->Sizes[s0] != Ts[i1]->Sizes[s1])
-//                throw std::runtime_error(boost::format("tensor sizes not consistent: %s") % pDecl);
-         } else {
-            // distinct: On T[i0], but not on T[i1]
-            Di *= Ts[i0]->Sizes[s0];
-         }
-      for (uint s1 = 0; s1 != Ts[i1]->Rank(); ++ s1)
-         if (-1 == FindChr(pDecl[iTerm[i1]+s1], &pDecl[iTerm[i0]]))
-            // distinct: On T[i1], but not on T[i0]
-            Di *= Ts[i1]->Sizes[s1];
-      if (iBest == 0xffff || Di < DiMin || (Di == DiMin && Co > CoMax)) {
-//          if (iBest == 0) continue; // FIXME: REMOVE THIS.
+      std::string
+         Rest;
+      double
+         Flops = PairFlops(Terms[i0], Terms[i1], IndexSizes, Rest),
+         Di = IndexProduct(Rest, IndexSizes);
+      if (pCache && i0 != 0 && pCache->Find(ContractCacheKey(*Ts[i0], Terms[i0], *Ts[i1], Terms[i1])))
+         Flops = 0.;
+      std::vector<std::string>
+         Reduced;
+      for (uint i = 0; i < nTerms; ++ i)
+         if (i == i0)
+            Reduced.push_back(Rest);
+         else if (i != i1)
+            Reduced.push_back(Terms[i]);
+      Flops += NetworkFlops(Reduced, IndexSizes);
+      if (iBest == 0xffff || Flops < FlopsMin ||
+          (Flops == FlopsMin && ((iBest == 0 && i0 != 0) || ((iBest == 0) == (i0 == 0) && Di < DiMin)))) {
          iBest = i0;
          jBest = i1;
+         FlopsMin = Flops;
          DiMin = Di;
-         CoMax = Co;
       }
    }
 
@@ -595,8 +948,8 @@ void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, c
    p[0] = 0; // remove the trailing ','.
 
    if (Print) {
-      std::cout << g_dbgPrefix << boost::format("co-pair: i = %i  j = %i  distinct: '%s'   Co = %i  Di = %i")
-         % iBest % jBest % std::string(pDistinct,pDistinct+nDistinct) % CoMax % DiMin << std::endl;
+      std::cout << g_dbgPrefix << boost::format("co-pair: i = %i  j = %i  distinct: '%s'   Flops = %.3e  Di = %.0f")
+         % iBest % jBest % std::string(pDistinct,pDistinct+nDistinct) % FlopsMin % DiMin << std::endl;
    }
 
    // allocate intermediate contraction result.
@@ -617,7 +970,7 @@ void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, c
       assert(Ts1[0] == &Tmp);
 //       std::string s0 = g_dbgPrefix;
 //       g_dbgPrefix = s0 + "RHS ";
-      ContractN(Ts1, pDecl1, 1., false, Mem);
+      ContractN(Ts1, pDecl1, 1., false, Mem, pCache);
       Ts2[0] = Ts[iBest];
       Ts2[1] = Ts[jBest];
       Ts2[2] = &Tmp;
@@ -626,7 +979,7 @@ void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, c
       for (uint s0 = 0; s0 < Ts2[2]->Rank(); ++ s0) *q++ = pDistinct[s0];
       q[0] = 0; // null-terminate.
 //       g_dbgPrefix = s0 + "TMP ";
-      ContractN(Ts2, pDecl2, Factor, Add, Mem);
+      ContractN(Ts2, pDecl2, Factor, Add, Mem, pCache);
 //       g_dbgPrefix = s0;
    } else {
       // factorization on rhs only.
@@ -639,10 +992,35 @@ void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, c
       for (uint s0 = 0; s0 < Ts2[2]->Rank(); ++ s0) *q++ = pDecl[iTerm[jBest]+s0];
       q[0] = 0; // null-terminate.
       std::string s0 = g_dbgPrefix;
+      // the product of two stable tensors may be there already, or be worth
+      // keeping for later contractions.
+      std::string
+         Key;
+      FScalar
+         *pCached = 0;
+      bool
+         Store = false;
+      if (pCache && pCache->IsStable(Ts[iBest]->pData) && pCache->IsStable(Ts[jBest]->pData)) {
+         Key = ContractCacheKey(*Ts[iBest], Terms[iBest], *Ts[jBest], Terms[jBest]);
+         pCached = pCache->Find(Key);
+         if (pCached == 0) {
+            FScalar *pNew = pCache->Reserve(Key, Tmp.nValues(), Ts[iBest]->pData, Ts[jBest]->pData);
+            if (pNew != 0) {
+               Tmp.pData = pNew;
+               Store = true;
+            }
+         }
+      }
 //       g_dbgPrefix = s0 + "TMP ";
-      ContractN(Ts2, pDecl2, 1., false, Mem);
+      if (pCached != 0)
+         Tmp.pData = pCached;
+      else {
+         ContractN(Ts2, pDecl2, 1., false, Mem, pCache);
+         if (Store)
+            pCache->Commit(Key);
+      }
 //       g_dbgPrefix = s0 + "RST ";
-      ContractN(Ts1, pDecl1, Factor, Add, Mem);
+      ContractN(Ts1, pDecl1, Factor, Add, Mem, pCache);
 //       g_dbgPrefix = s0;
    }
 
@@ -11,9 +11,14 @@ Copyright (c) 2016, Sandeep Sharma
 
 #include <stddef.h> // for size_t
 #include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 #include "CxDefs.h"
 #include "CxFixedSizeArray.h"
 #include "CxMemoryStack.h"
+#include "CxOpenMpProxy.h"
 
 typedef unsigned int
    uint;
@@ -67,6 +72,37 @@ struct FNdArrayView
 };
 
 
+// Permutational symmetry of the slots of a tensor, given by an ITF-style
+// declaration like "1032,2301": each entry lists, for every slot, the slot it
+// is exchanged with, such that T[pqrs] = T[qpsr] = T[rspq] (and products).
+// A leading '-' marks an antisymmetric permutation.
+// The packed form of a tensor keeps one value per set of equivalent elements,
+// in the order in which their lexicographically smallest index tuples occur
+// when running over the tensor with the first slot fastest. It does not depend
+// on the strides of the dense view.
+struct FTensorSymmetry
+{
+   FTensorSymmetry() {};
+   FTensorSymmetry(char const *pDecl, uint Rank);
+
+   bool empty() const { return Perms.empty(); }
+   // number of values in the packed form of A.
+   FArrayOffset nPacked(FNdArrayView const &A) const;
+   // store the symmetrized A into pOut[0..nPacked(A)).
+   void Pack(FScalar *pOut, FNdArrayView const &A) const;
+   // expand the packed pIn into all elements of A.
+   void Unpack(FNdArrayView &A, FScalar const *pIn) const;
+
+   // all non-trivial elements of the generated group.
+   std::vector<FArraySizes>
+      Perms;
+   std::vector<FScalar>
+      Signs;
+private:
+   void AssertCompatible(FNdArrayView const &A) const;
+   bool IsCanonical(FArrayOffset const *pIdx, uint Rank) const;
+};
+
 // perform contraction:
 //      Dest[AB] += f * \sum_L S[LA] T[LB],
 // where L runs over the first nCo slots of S, and of T, and the output is
@@ -93,7 +129,53 @@ void ContractFirst_Naive(FNdArrayView D, FNdArrayView S, FNdArrayView T,
 void ContractBinary(FNdArrayView D, char const *pDecl, FNdArrayView S, FNdArrayView T,
    FScalar Factor, bool Add, ct::FMemoryStack &Mem);
 
-void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, ct::FMemoryStack &Mem);
+// Pairwise intermediates of ContractN which can be shared between the
+// contractions of an equation set (e.g., the same density contracted with the
+// same integrals, but with differently permuted amplitudes). Only products of
+// two stable tensors are kept: tensors registered with AddStable, whose data
+// does not change until Invalidate is called for it, and the intermediates
+// held by the cache itself. May be used by several threads at once.
+struct FContractCache
+{
+   explicit FContractCache(size_t MaxBytes_);
+   ~FContractCache();
+
+   void AddStable(FScalar const *pData);
+   bool IsStable(FScalar const *pData);
+   // forget all intermediates which depend on the data at pData.
+   void Invalidate(FScalar const *pData);
+
+   // data of a finished intermediate, or 0.
+   FScalar *Find(std::string const &Key);
+   // storage for a new intermediate made from pSrc0 and pSrc1, or 0 if the
+   // budget is exhausted or another thread already makes it. Call Commit once
+   // the data is there.
+   FScalar *Reserve(std::string const &Key, FArrayOffset nValues, FScalar const *pSrc0, FScalar const *pSrc1);
+   void Commit(std::string const &Key);
+private:
+   struct FEntry {
+      std::vector<FScalar> Data;
+      FScalar const *pSrc[2];
+      bool Ready;
+   };
+   typedef std::map<std::string, FEntry*>
+      FEntryMap;
+   FEntryMap
+      m_Entries;
+   std::set<FScalar const*>
+      m_Stable;
+   size_t
+      m_MaxBytes, m_Bytes;
+   omp_lock_t
+      m_Lock;
+   FContractCache(FContractCache const &); // not implemented
+   void operator = (FContractCache const &); // not implemented
+};
+
+// Contractions of more than two source tensors are done pairwise. The order
+// is the one with the fewest floating point operations for the actual tensor
+// sizes; pairs of which pCache already holds the product count as free.
+void ContractN(FNdArrayView **Ts, char const *pDecl, FScalar Factor, bool Add, ct::FMemoryStack &Mem, FContractCache *pCache = 0);
 // these here are convenience functions with some runtime overhead.
 // They just call the upper ContractN.
 void ContractN(FNdArrayView Out, char const *pDecl, FScalar Factor, bool Add, ct::FMemoryStack &Mem,
@@ -76,7 +76,7 @@ void FJobContext::ExecHandCoded(FMemoryStack2 *Mem)
 #pragma omp parallel
      {
        char Header0[10], Header[256];
-       FILE *f = fopen("int/E3.npy", "rb");
+       FILE *f = fopen(RootFile("int/E3.npy").c_str(), "rb");
        fread(&Header0[0], 1, 10, f);
        uint16_t HeaderSize = (uint16_t)Header0[8] + (((uint16_t)Header0[9]) << 8);
        //char Header0[10], Header[256];
@@ -153,7 +153,7 @@ void FJobContext::ExecHandCoded(FMemoryStack2 *Mem)
 #pragma omp parallel
      {
        char Header0[10], Header[256];
-       FILE *f = fopen("int/E3.npy", "rb");
+       FILE *f = fopen(RootFile("int/E3.npy").c_str(), "rb");
        fread(&Header0[0], 1, 10, f);
        uint16_t HeaderSize = (uint16_t)Header0[8] + (((uint16_t)Header0[9]) << 8);
        //char Header0[10], Header[256];
@@ -218,12 +218,12 @@ void FJobContext::ExecHandCoded(FMemoryStack2 *Mem)
 	 *pBaseOfMemorylocal = Mem[omprank].Alloc(0);
 
       char AHeader0[10], AHeader[256];
-      FILE *fA = fopen("int/E3B.npy", "rb");
+      FILE *fA = fopen(RootFile("int/E3B.npy").c_str(), "rb");
       fread(&AHeader0[0], 1, 10, fA);
       size_t AHeaderSize = (uint16_t)AHeader0[8] + (((uint16_t)AHeader0[9]) << 8);
       
       char BHeader0[10], BHeader[256];
-      FILE *fB = fopen("int/E3C.npy", "rb");
+      FILE *fB = fopen(RootFile("int/E3C.npy").c_str(), "rb");
       fread(&BHeader0[0], 1, 10, fB);
       size_t BHeaderSize = (uint16_t)BHeader0[8] + (((uint16_t)BHeader0[9]) << 8);
 
@@ -298,12 +298,12 @@ void FJobContext::ExecHandCoded(FMemoryStack2 *Mem)
 	 *pBaseOfMemorylocal = Mem[omprank].Alloc(0);
 
       char AHeader0[10], AHeader[256];
-      FILE *fA = fopen("int/E3B.npy", "rb");
+      FILE *fA = fopen(RootFile("int/E3B.npy").c_str(), "rb");
       fread(&AHeader0[0], 1, 10, fA);
       size_t AHeaderSize = (uint16_t)AHeader0[8] + (((uint16_t)AHeader0[9]) << 8);
       
       char BHeader0[10], BHeader[256];
-      FILE *fB = fopen("int/E3C.npy", "rb");
+      FILE *fB = fopen(RootFile("int/E3C.npy").c_str(), "rb");
       fread(&BHeader0[0], 1, 10, fB);
       size_t BHeaderSize = (uint16_t)BHeader0[8] + (((uint16_t)BHeader0[9]) << 8);
 
@@ -387,7 +387,7 @@ void FJobContext::ExecHandCoded(FMemoryStack2 *Mem)
       void
 	 *pBaseOfMemorylocal = Mem[omprank].Alloc(0);
       char Header0[10], Header[256];
-      FILE *f = fopen("int/E3.npy", "rb");
+      FILE *f = fopen(RootFile("int/E3.npy").c_str(), "rb");
       fread(&Header0[0], 1, 10, f);
       uint16_t HeaderSize = (uint16_t)Header0[8] + (((uint16_t)Header0[9]) << 8);
       //FILE *f = fopen("scratch/node0/spatial_threepdm.0.0.bin.unpack", "rb");
@@ -455,7 +455,7 @@ void FJobContext::ExecHandCoded(FMemoryStack2 *Mem)
 	 *pBaseOfMemorylocal = Mem[omprank].Alloc(0);
 
       char AHeader0[10], AHeader[256];
-      FILE *fA = fopen("int/E3.npy", "rb");
+      FILE *fA = fopen(RootFile("int/E3.npy").c_str(), "rb");
       fread(&AHeader0[0], 1, 10, fA);
       size_t AHeaderSize = (uint16_t)AHeader0[8] + (((uint16_t)AHeader0[9]) << 8);
       
@@ -654,6 +654,8 @@ void FJobContext::InitAmplitudes(FMemoryStack2 &Mem)
 
      int ncore=t->Sizes[0], nvirt=t->Sizes[3];
      int nact = t->Sizes[2];
+     // W:eaca is shared between the roots; fold in the Fock term only once.
+     if (m_iRoot == 0)
      for (int i=0; i<ncore; i++)
      for (int p=0; p<nact;  p++)
      for (int a=0; a<nvirt; a++) 
@@ -668,7 +670,7 @@ void FJobContext::InitAmplitudes(FMemoryStack2 &Mem)
    if (guessInput.compare("") != 0) {
      FScalar zero = 0.0;
      PrintResult("Reading guess from "+guessInput, zero, 0);
-     ct::ReadNpy( guess ,guessInput);
+     ct::ReadNpy( guess ,RootFile(guessInput));
      Copy(*TN("T"), ViewFromNpy(guess));
    }
    else
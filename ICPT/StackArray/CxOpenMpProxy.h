@@ -18,6 +18,7 @@
    inline void omp_destroy_lock(omp_lock_t *){};
    inline void omp_init_lock(omp_lock_t *){};
    inline void omp_set_lock(omp_lock_t *){};
+   inline void omp_unset_lock(omp_lock_t *){};
 #endif
 
 #endif // OPENMP_PROXY_H
@@ -24,10 +24,10 @@ namespace MRLCC_AAVV {
 		/* 16*/{"W", "aeae", "",USAGE_Hamiltonian, STORAGE_Disk},
 		/* 17*/{"W", "aeea", "",USAGE_Hamiltonian, STORAGE_Disk},
 		/* 18*/{"W", "cccc", "",USAGE_Hamiltonian, STORAGE_Disk},
-		/* 19*/{"W", "aaaa", "",USAGE_Hamiltonian, STORAGE_Memory},
+		/* 19*/{"W", "aaaa", "1032,2301",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 20*/{"Inter", "e", "",USAGE_Intermediate, STORAGE_Memory},
 		/* 21*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 22*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 22*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 23*/{"S3", "a", "",USAGE_Density, STORAGE_Memory},
 		/* 24*/{"S1", "aAaA", "",USAGE_Density, STORAGE_Memory},
 		/* 25*/{"S2", "aaaa", "",USAGE_Density, STORAGE_Memory},
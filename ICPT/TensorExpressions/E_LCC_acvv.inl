@@ -20,7 +20,7 @@ namespace MRLCC_ACVV {
 		/* 12*/{"W", "aaaa", "",USAGE_Hamiltonian, STORAGE_Disk},
 		/* 13*/{"k", "e", "",USAGE_Intermediate, STORAGE_Memory},
 		/* 14*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 15*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 15*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 16*/{"S3", "a", "",USAGE_Density, STORAGE_Memory},
 		/* 17*/{"S1", "AA", "",USAGE_Density, STORAGE_Memory},
 		/* 18*/{"S2", "aa", "",USAGE_Density, STORAGE_Memory},
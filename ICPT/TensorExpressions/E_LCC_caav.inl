@@ -17,10 +17,10 @@ namespace MRLCC_CAAV {
 		/*  9*/{"W", "aeae", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 10*/{"W", "aeea", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 11*/{"W", "cccc", "",USAGE_Hamiltonian, STORAGE_Memory},
-		/* 12*/{"W", "aaaa", "",USAGE_Hamiltonian, STORAGE_Memory},
+		/* 12*/{"W", "aaaa", "1032,2301",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 13*/{"W", "e", "",USAGE_Intermediate, STORAGE_Memory},
 		/* 14*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 15*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 15*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 16*/{"S3", "a", "",USAGE_Density, STORAGE_Memory},
 		/* 17*/{"S1", "AaAa", "",USAGE_Density, STORAGE_Memory},
 		/* 18*/{"T", "cAae", "",USAGE_Amplitude, STORAGE_Memory},
@@ -20,7 +20,7 @@ namespace MRLCC_CCVV {
 		/* 12*/{"W", "aaaa", "",USAGE_Hamiltonian, STORAGE_Disk},
 		/* 13*/{"W", "e", "",USAGE_Intermediate, STORAGE_Memory},
 		/* 14*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 15*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 15*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 16*/{"E3", "a", "",USAGE_Intermediate, STORAGE_Memory},
 		/* 17*/{"S1", "aa", "",USAGE_Density, STORAGE_Memory},
 		/* 18*/{"S2", "aa", "",USAGE_Density, STORAGE_Memory},
@@ -24,9 +24,9 @@ namespace NEVPT2_AAVV {
 		/* 16*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 17*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 18*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
-		/* 19*/{"W", "aaaa", "",USAGE_Hamiltonian, STORAGE_Memory},
+		/* 19*/{"W", "aaaa", "1032,2301",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 20*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 21*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 21*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 22*/{"S3", "a", "",USAGE_Density, STORAGE_Memory},
 		/* 23*/{"S1", "aAaA", "",USAGE_Density, STORAGE_Memory},
 		/* 24*/{"S2", "aaaa", "",USAGE_Density, STORAGE_Memory},
@@ -17,9 +17,9 @@ namespace NEVPT2_ACVV {
 		/*  9*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory}, //dummy
 		/* 10*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 11*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
-		/* 12*/{"W", "aaaa", "",USAGE_Hamiltonian, STORAGE_Memory},
+		/* 12*/{"W", "aaaa", "1032,2301",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 13*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 14*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 14*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 15*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
 		/* 16*/{"S1", "AA", "",USAGE_Density, STORAGE_Memory},
 		/* 17*/{"S2", "aa", "",USAGE_Density, STORAGE_Memory},
@@ -17,9 +17,9 @@ namespace NEVPT2_CAAV {
 		/*  9*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 10*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 11*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
-		/* 12*/{"W", "aaaa", "",USAGE_Hamiltonian, STORAGE_Memory},
+		/* 12*/{"W", "aaaa", "1032,2301",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 13*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 14*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 14*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 15*/{"S3", "a", "",USAGE_Density, STORAGE_Memory},
 		/* 16*/{"S1", "AaAa", "",USAGE_Density, STORAGE_Memory},
 		/* 17*/{"T", "cAae", "",USAGE_Amplitude, STORAGE_Memory},
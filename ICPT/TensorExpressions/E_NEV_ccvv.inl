@@ -18,7 +18,7 @@ namespace NEVPT2_CCVV {
 		/* 10*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 11*/{"f", "aa", "",USAGE_Hamiltonian, STORAGE_Memory},
 		/* 12*/{"E1", "aa", "",USAGE_Density, STORAGE_Memory},
-		/* 13*/{"E2", "aaaa", "",USAGE_Density, STORAGE_Memory},
+		/* 13*/{"E2", "aaaa", "1032,2301",USAGE_Density, STORAGE_Memory},
 		/* 14*/{"f", "aa", "",USAGE_Density, STORAGE_Memory},
 		/* 15*/{"S1", "aa", "",USAGE_Density, STORAGE_Memory},
 		/* 16*/{"S2", "aa", "",USAGE_Density, STORAGE_Memory},
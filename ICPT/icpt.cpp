@@ -12,6 +12,9 @@ Copyright (c) 2016, Sandeep Sharma
 #include "CxDiis.h"
 #include <fstream>
 #include "boost/format.hpp"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "E_NEV_aavv.inl"
 #include "E_NEV_ccav.inl"
@@ -84,7 +87,7 @@ namespace srci {
 
 FJobData::FJobData()
   : WfDecl(FWfDecl()), RefEnergy(0.), ThrTrun(1e-4), ThrDen(1e-6), ThrVar(1e-14),  resultOut(""), guessInput(""),
-     LevelShift(0.), nOrb(0), MaxIt(100), WorkSpaceMb(1024), nMaxDiis(6), MethodClass(METHOD_MinE)
+     LevelShift(0.), nOrb(0), MaxIt(100), WorkSpaceMb(1024), DiskCacheMb(1024), ContractCacheMb(512), nMaxDiis(6), nRoots(1), MethodClass(METHOD_MinE)
 {}
 
 
@@ -130,6 +133,18 @@ void FJobData::ReadInputFile(char const *pArgFile)
          WfDecl.Ms2 = atoi(ArgValue.c_str());
       else if (ArgName == "ref-energy")
          RefEnergy = atof(ArgValue.c_str());
+      else if (ArgName == "ref-energies") {
+         // comma separated, one for each root.
+         std::stringstream
+            Energies(ArgValue);
+         std::string
+            Energy;
+         RefEnergies.clear();
+         while (std::getline(Energies, Energy, ','))
+            RefEnergies.push_back(atof(Energy.c_str()));
+      }
+      else if (ArgName == "nroots")
+         nRoots = atoi(ArgValue.c_str());
       else if (ArgName == "thr-den")
          ThrDen = atof(ArgValue.c_str());
       else if (ArgName == "orbitalFile")
@@ -156,9 +171,15 @@ void FJobData::ReadInputFile(char const *pArgFile)
 	ct::ReadNpy(Int1e_CoreH, ArgValue);
       else if (ArgName == "work-space-mb")
          WorkSpaceMb = atoi(ArgValue.c_str());
+      else if (ArgName == "disk-cache-mb")
+         DiskCacheMb = atoi(ArgValue.c_str());
+      else if (ArgName == "contract-cache-mb")
+         ContractCacheMb = atoi(ArgValue.c_str());
       else
          throw std::runtime_error("argument '" + ArgName + "' not recognized.");
    }
+   if (nRoots == 0)
+      throw std::runtime_error("nroots must be at least one.");
    if (Int1e_Fock.Rank() != 0) {
       if (Int1e_Fock.Rank() != 2 || Int1e_Fock.Shape[0] != Int1e_Fock.Shape[1])
          throw std::runtime_error("int1e/fock must specify a rank 2 square matrix.");
@@ -232,6 +253,8 @@ void FJobContext::SaveToDisk(std::string file, std::string op) {
 void FJobContext::Run(FMemoryStack2 *Mem)
 {
    Init(Mem[0]);
+   if (nRoots > 1)
+      return RunRoots(Mem);
    InitAmplitudes(Mem[0]);
 
 
@@ -254,8 +277,13 @@ void FJobContext::Run(FMemoryStack2 *Mem)
    //Allocate("p", Mem[0]);
    BackToNonOrthogonal("p", "P");  //p<- P
    TN("Ap")->ClearData();                //Ap clear
-   ExecEquationSet(Method.EqsRes, m_Tensors, Mem[0]);      //Ap = A*p
+   ExecEquationSetParallel(Method.EqsRes, Mem);      //Ap = A*p
+   void
+      *pBaseOfUnpacked = Mem[0].Alloc(0);
+   UnpackTensors(Mem[0]);
    ExecHandCoded(Mem);
+   ReleaseUnpackedTensors();
+   Mem[0].Free(pBaseOfUnpacked);
    //DeAllocate("p", Mem[0]);
    MakeOrthogonal("Ap", "AP");     //Ap -> AP
    ct::Add(TN("AP")->pData, TN("P")->pData, Shift, TN("AP")->nValues());   //AP = AP + shift * P
@@ -279,8 +307,13 @@ void FJobContext::Run(FMemoryStack2 *Mem)
       BackToNonOrthogonal("p", "P");                          //p <- P
       TN("Ap")->ClearData();                                       // Ap->clear
       tResid -= srci::GetTime();
-      ExecEquationSet(Method.EqsRes, m_Tensors, Mem[0]);
+      ExecEquationSetParallel(Method.EqsRes, Mem);
+      void
+         *pBaseOfUnpacked = Mem[0].Alloc(0);
+      UnpackTensors(Mem[0]);
       ExecHandCoded(Mem);
+      ReleaseUnpackedTensors();
+      Mem[0].Free(pBaseOfUnpacked);
       //DeAllocate("p", Mem[0]);
       tResid += srci::GetTime();
 
@@ -348,14 +381,224 @@ void FJobContext::Run(FMemoryStack2 *Mem)
 }
 
 
+// Solves for all roots together. Each root has its own amplitudes, residuals
+// and densities; the integrals are shared. The conjugate gradient iterations of
+// the roots run in lock step, so that every sweep through the residual
+// equations serves all roots which are not yet converged.
+void FJobContext::RunRoots(FMemoryStack2 *Mem)
+{
+   std::vector<uint>
+      Active;
+   std::vector<FScalar>
+      Energy(nRoots, 0.), LastEnergy(nRoots, 0.), Nrm2(nRoots, 0.), tRold(nRoots, 0.), RootRefEnergy(nRoots, RefEnergy);
+   FScalar
+      scale = 1.0, tResid = 0, tRest = 0;
+   double tStart = srci::GetTime(), tMain = -srci::GetTime();
+
+   for (uint iRoot = 0; iRoot != nRoots; ++ iRoot) {
+      if (iRoot < RefEnergies.size())
+         RootRefEnergy[iRoot] = RefEnergies[iRoot];
+      SelectRoot(iRoot);
+      InitAmplitudes(Mem[0]);
+      MakeOverlapAndOrthogonalBasis(Mem);
+      MakeOrthogonal(std::string("b"), std::string("B"));  //b -> B
+      if (guessInput.compare("") == 0)
+         MakeOrthogonal(std::string("t"), std::string("T"));  //t -> T
+      Copy(*TN("P"), *TN("T"));         //P <- T
+      BackToNonOrthogonal("p", "P");  //p<- P
+      TN("Ap")->ClearData();                //Ap clear
+      Active.push_back(iRoot);
+   }
+   MakeResidualsForRoots(Active, Mem);      //Ap = A*p
+   for (uint iRoot = 0; iRoot != nRoots; ++ iRoot) {
+      SelectRoot(iRoot);
+      MakeOrthogonal("Ap", "AP");     //Ap -> AP
+      ct::Add(TN("AP")->pData, TN("P")->pData, Shift, TN("AP")->nValues());   //AP = AP + shift * P
+      Copy(*TN("R"), *TN("AP"));        //R <- AP
+      ct::Scale(TN("R")->pData, -scale, TN("R")->nValues());                     //R = -1.0*R
+      ct::Add(TN("R")->pData, TN("B")->pData, scale, TN("R")->nValues());    //R = R+B
+      tRold[iRoot] = ct::Dot(TN("R")->pData, TN("R")->pData, TN("R")->nValues()); //<R|R>
+      Copy(*TN("P"), *TN("R"));
+   }
+
+   std::cout << format("\n Convergence thresholds:   THRDEN = %6.2e  THRVAR = %6.2e\n") % ThrDen % ThrVar;
+   std::cout << "\n ITER. ROOT      SQ.NORM        ENERGY      ENERGY CHANGE     VAR       TIME" << std::endl;
+
+   for (uint iIt = 0; iIt < MaxIt && !Active.empty(); ++ iIt)
+   {
+      for (uint k = 0; k < Active.size(); ++ k) {
+         SelectRoot(Active[k]);
+         BackToNonOrthogonal("p", "P");                          //p <- P
+         TN("Ap")->ClearData();                                       // Ap->clear
+      }
+      tResid -= srci::GetTime();
+      MakeResidualsForRoots(Active, Mem);
+      tResid += srci::GetTime();
+
+      std::vector<uint>
+         StillActive;
+      for (uint k = 0; k < Active.size(); ++ k) {
+         uint iRoot = Active[k];
+         SelectRoot(iRoot);
+         MakeOrthogonal("Ap", "AP");                           //Ap -> AP
+         ct::Add(TN("AP")->pData, TN("P")->pData, Shift, TN("AP")->nValues());   //AP = AP + shift * P
+
+         FScalar alpha = tRold[iRoot] / ct::Dot(TN("P")->pData, TN("AP")->pData, TN("P")->nValues());   //<P|AP>
+
+         ct::Add(TN("T")->pData, TN("P")->pData, alpha, TN("R")->nValues());                    //T = T+alph*P
+         ct::Add(TN("R")->pData, TN("AP")->pData, -alpha, TN("R")->nValues());                  //R = R-alph*AP
+
+         FScalar
+            tResidual = ct::Dot(TN("R")->pData, TN("R")->pData, TN("R")->nValues());           // <R|R>
+         Nrm2[iRoot] = ct::Dot(TN("T")->pData, TN("T")->pData, TN("T")->nValues());            // <T|T>
+         Energy[iRoot] = -ct::Dot(TN("T")->pData, TN("B")->pData, TN("T")->nValues())          // -<T|B> - <T|R>
+            -ct::Dot(TN("T")->pData, TN("R")->pData, TN("T")->nValues());
+
+         std::cout << format("%4i %4i   %14.8f %14.8f %14.8f    %8.2e%10.2f\n")
+            % (1+iIt) % (1+iRoot) % Nrm2[iRoot] % (Energy[iRoot]+RootRefEnergy[iRoot])
+            % (Energy[iRoot]-LastEnergy[iRoot]) % tResidual % (srci::GetTime() - tStart);
+         if (tResidual < ThrVar)
+            continue;
+
+         ct::Scale(TN("P")->pData, tResidual/tRold[iRoot], TN("P")->nValues());                  //P = (rnew/rold)*P
+         ct::Add(TN("P")->pData, TN("R")->pData, scale, TN("R")->nValues());                     //P = P+R
+         tRold[iRoot] = tResidual;
+         LastEnergy[iRoot] = Energy[iRoot];
+         StillActive.push_back(iRoot);
+      }
+      std::cout << std::flush;
+      tStart = srci::GetTime();
+      Active.swap(StillActive);
+   }
+
+   for (uint k = 0; k < Active.size(); ++ k)
+      std::cout << format("\n*WARNING: No convergence for root %i."
+                     " Stopped at NIT: %i  DEN: %.2e  VAR: %.2e")
+               % Active[k] % MaxIt % (Energy[Active[k]] - LastEnergy[Active[k]]) % tRold[Active[k]] << std::endl;
+   std::cout << "\n";
+   tMain += srci::GetTime();
+   tRest = tMain - tResid;
+   PrintTiming("main loop", tMain);
+   PrintTiming("residual", tResid);
+   PrintTiming("rest", tRest);
+
+   FScalar
+      AverageEnergy = 0.;
+   std::cout << "\n";
+   for (uint iRoot = 0; iRoot != nRoots; ++ iRoot) {
+      PrintResult("Coefficient of reference function", 1./std::sqrt(Nrm2[iRoot]), iRoot);
+      if (RootRefEnergy[iRoot] != 0.)
+         PrintResult("Correlation energy", Energy[iRoot], iRoot);
+      PrintResult("ENERGY", RootRefEnergy[iRoot] + Energy[iRoot], iRoot);
+      AverageEnergy += (RootRefEnergy[iRoot] + Energy[iRoot])/nRoots;
+   }
+   std::cout << "\n";
+   PrintResult("State-averaged energy", AverageEnergy, -1);
+
+   if (resultOut.compare("") != 0) {
+      for (uint iRoot = 0; iRoot != nRoots; ++ iRoot) {
+         SelectRoot(iRoot);
+         PrintResult("Writing result to "+RootFile(resultOut), 0, iRoot);
+         ct::FShapeNpy outshape = ct::MakeShape(TN("T")->Sizes[0], TN("T")->Sizes[1],TN("T")->Sizes[2],TN("T")->Sizes[3]);
+         ct::WriteNpy(RootFile(resultOut), TN("T")->pData, outshape);
+      }
+   }
+}
+
+
+// Ap = A*p for the given roots.
+void FJobContext::MakeResidualsForRoots(std::vector<uint> const &Roots, FMemoryStack2 *Mem)
+{
+   ExecEquationSetRoots(Method.EqsRes, Roots, Mem[0]);
+   for (uint k = 0; k < Roots.size(); ++ k) {
+      SelectRoot(Roots[k]);
+      void
+         *pBaseOfUnpacked = Mem[0].Alloc(0);
+      UnpackTensors(Mem[0]);
+      ExecHandCoded(Mem);
+      ReleaseUnpackedTensors();
+      Mem[0].Free(pBaseOfUnpacked);
+   }
+}
+
+
+bool FJobContext::IsPerRoot(uint i) const
+{
+   FTensorDecl const
+      &Decl = Method.pTensorDecls[i];
+   return Decl.Usage != USAGE_Hamiltonian && 0 != strcmp(Decl.pName, "delta");
+}
+
+FSrciTensor &FJobContext::RootTensor(uint iRoot, uint i)
+{
+   if (iRoot == m_iRoot || !IsPerRoot(i))
+      return m_Tensors[i];
+   return m_RootTensors[iRoot][i];
+}
+
+void FJobContext::SelectRoot(uint iRoot)
+{
+   if (iRoot == m_iRoot)
+      return;
+   for (uint i = 0; i != m_Tensors.size(); ++ i) {
+      if (!IsPerRoot(i))
+         continue;
+      m_RootTensors[m_iRoot][i] = m_Tensors[i];
+      m_RootPackedData[m_iRoot][i] = m_PackedData[i];
+      m_Tensors[i] = m_RootTensors[iRoot][i];
+      m_PackedData[i] = m_RootPackedData[iRoot][i];
+   }
+   m_iRoot = iRoot;
+}
+
+// with several roots, files belonging to a single root carry its number in
+// front of their extension: int/E2.npy -> int/E2.1.npy for the second root.
+std::string FJobContext::RootFile(std::string const &FileName) const
+{
+   if (nRoots < 2)
+      return FileName;
+   std::string
+      Suffix = boost::str(format(".%i") % m_iRoot);
+   size_t
+      iDot = FileName.rfind('.'),
+      iSlash = FileName.rfind('/');
+   if (iDot == std::string::npos || (iSlash != std::string::npos && iDot < iSlash))
+      return FileName + Suffix;
+   return FileName.substr(0, iDot) + Suffix + FileName.substr(iDot);
+}
+
 void FJobContext::CleanAmplitudes(std::string const &r_or_t)
 {
 }
 
 
+// in-memory tensors do not change while a set runs, except for the
+// destinations of its equations, which are invalidated after they are written.
+static void AddStableTensors(FContractCache &Intermediates, std::vector<FSrciTensor> const &Tensors, FMethodInfo const &Method)
+{
+   for (size_t i = 0; i < Tensors.size(); ++ i)
+      if (Method.pTensorDecls[i].Storage == STORAGE_Memory && Tensors[i].pData != 0)
+         Intermediates.AddStable(Tensors[i].pData);
+}
+
 void FJobContext::ExecEquationSet( FEqSet const &Set, std::vector<FSrciTensor>& m_Tensors, FMemoryStack2 &Mem)
 {
 //    std::cout << "! EXEC: " << Set.pDesc << std::endl;
+   bool
+      // threads running hand coded sets pass private tensor copies; they
+      // read disk tensors themselves and see packed tensors unpacked.
+      OwnTensors = &m_Tensors == &this->m_Tensors,
+      UseCache = m_DiskCache.BudgetBytes != 0 && OwnTensors;
+   std::vector<int>
+      // packed tensors unpacked for the current equation
+      Unpacked;
+   FContractCache
+      Intermediates(ContractCacheMb * 1048576),
+      *pIntermediates = 0;
+   if (ContractCacheMb != 0 && OwnTensors) {
+      AddStableTensors(Intermediates, m_Tensors, Method);
+      pIntermediates = &Intermediates;
+   }
    for (FEqInfo const *pEq = Set.pEqs; pEq != Set.pEqs + Set.nEqs; ++ pEq) {
      //std::cout << "****  "<<pEq->pCoDecl<<std::endl;
       if (pEq->nTerms != 3) {
@@ -366,14 +609,29 @@ void FJobContext::ExecEquationSet( FEqSet const &Set, std::vector<FSrciTensor>&
          for (uint i = 0; i < pEq->nTerms; ++i) {
 	   pTs[i] = &m_Tensors[pEq->iTerms[i]];//TensorById(pEq->iTerms[i]);
 	   if (Method.pTensorDecls[pEq->iTerms[i]].Storage == STORAGE_Disk) {
+	     if (UseCache)
+	       AcquireDiskTensor(pEq->iTerms[i], Set, pEq);
+	     else
+	       FillData(pEq->iTerms[i], Mem);
+	   } else if (OwnTensors && m_PackedData[pEq->iTerms[i]] != 0 && pTs[i]->pData == 0) {
+	     if (i == 0)
+	       throw std::runtime_error("packed tensors are read-only.");
 	     FillData(pEq->iTerms[i], Mem);
+	     Unpacked.push_back(pEq->iTerms[i]);
 	   }
 	   if (i != 0 && pTs[i] == pTs[0])
 	     throw std::runtime_error(boost::str(format("contraction %i has overlapping dest and source tensors."
 							" Tensors may not contribute to contractions involving themselves.") % (pEq - Set.pEqs)));
          }
-         ContractN(pTs, pEq->pCoDecl, pEq->Factor, true, Mem);
+         if (UseCache)
+            PrefetchDiskTensor(Set, pEq);
+         ContractN(pTs, pEq->pCoDecl, pEq->Factor, true, Mem, pIntermediates);
          Mem.Free(pTs);
+         for (size_t k = 0; k < Unpacked.size(); ++ k)
+            m_Tensors[Unpacked[k]].pData = 0;
+         Unpacked.clear();
+         if (pIntermediates)
+            pIntermediates->Invalidate(m_Tensors[pEq->iTerms[0]].pData);
       } else {
 	void
 	  *pBaseOfMemory = Mem.Alloc(0);
@@ -383,7 +641,15 @@ void FJobContext::ExecEquationSet( FEqSet const &Set, std::vector<FSrciTensor>&
 	   *pT = &m_Tensors[pEq->iTerms[2]];//TensorById(pEq->iTerms[i]);
 	 for (int j=0; j<3; j++) 
 	   if (Method.pTensorDecls[pEq->iTerms[j]].Storage == STORAGE_Disk) {
+	     if (UseCache)
+	       AcquireDiskTensor(pEq->iTerms[j], Set, pEq);
+	     else
+	       FillData(pEq->iTerms[j], Mem);
+	   } else if (OwnTensors && m_PackedData[pEq->iTerms[j]] != 0 && m_Tensors[pEq->iTerms[j]].pData == 0) {
+	     if (j == 0)
+	       throw std::runtime_error("packed tensors are read-only.");
 	     FillData(pEq->iTerms[j], Mem);
+	     Unpacked.push_back(pEq->iTerms[j]);
 	   }
 
 	 //*pD = TensorById(pEq->iTerms[0]),
@@ -392,13 +658,459 @@ void FJobContext::ExecEquationSet( FEqSet const &Set, std::vector<FSrciTensor>&
          if (pD == pS || pD == pT)
             throw std::runtime_error(boost::str(format("contraction %i has overlapping dest and source tensors."
                " Tensors may not contribute to contractions involving themselves.") % (pEq - Set.pEqs)));
+         if (UseCache)
+            PrefetchDiskTensor(Set, pEq);
          ContractBinary(*pD, pEq->pCoDecl, *pS, *pT, pEq->Factor, true, Mem);
 	 Mem.Free(pBaseOfMemory);
+         for (size_t k = 0; k < Unpacked.size(); ++ k)
+            m_Tensors[Unpacked[k]].pData = 0;
+         Unpacked.clear();
+         if (pIntermediates)
+            pIntermediates->Invalidate(pD->pData);
       }
    }
 };
 
 
+// Equations only accumulate into their destination, so two of them need to be
+// ordered only if one reads the tensor the other one writes. The equations are
+// sorted into levels of that dependency graph and all contractions of a level
+// run concurrently, each thread on its own part of the memory stack.
+// Destinations written by more than one equation of a level are accumulated in
+// private per-thread copies, which are summed into the shared tensor at the end
+// of the level.
+void FJobContext::ExecEquationSetParallel(FEqSet const &Set, FMemoryStack2 *Mem)
+{
+   int
+      nThreads = numthrds;
+   bool
+      HaveDiskTensors = false;
+   for (FEqInfo const *pEq = Set.pEqs; pEq != Set.pEqs + Set.nEqs; ++ pEq)
+      for (uint k = 0; k < pEq->nTerms; ++ k)
+         if (Method.pTensorDecls[pEq->iTerms[k]].Storage == STORAGE_Disk)
+            HaveDiskTensors = true;
+   // disk tensors are read through the disk cache, which is not thread safe.
+   if (nThreads == 1 || Set.nEqs < 2 || HaveDiskTensors)
+      return ExecEquationSet(Set, m_Tensors, Mem[0]);
+
+   std::vector<size_t>
+      Level(Set.nEqs, 0);
+   size_t
+      nLevels = 0;
+   for (size_t j = 0; j < Set.nEqs; ++ j) {
+      FEqInfo const
+         &EqJ = Set.pEqs[j];
+      for (uint k = 1; k < EqJ.nTerms; ++ k)
+         if (EqJ.iTerms[k] == EqJ.iTerms[0])
+            throw std::runtime_error(boost::str(format("contraction %i has overlapping dest and source tensors."
+               " Tensors may not contribute to contractions involving themselves.") % j));
+      for (size_t i = 0; i < j; ++ i) {
+         FEqInfo const
+            &EqI = Set.pEqs[i];
+         bool
+            Dependent = false;
+         for (uint k = 1; k < EqJ.nTerms; ++ k)
+            if (EqJ.iTerms[k] == EqI.iTerms[0])
+               Dependent = true;
+         for (uint k = 1; k < EqI.nTerms; ++ k)
+            if (EqI.iTerms[k] == EqJ.iTerms[0])
+               Dependent = true;
+         if (Dependent)
+            Level[j] = std::max(Level[j], Level[i] + 1);
+      }
+      nLevels = std::max(nLevels, Level[j] + 1);
+   }
+
+   // packed tensors stay unpacked while the set runs.
+   void
+      *pBaseOfUnpacked = Mem[0].Alloc(0);
+   std::vector<int>
+      Unpacked;
+   for (FEqInfo const *pEq = Set.pEqs; pEq != Set.pEqs + Set.nEqs; ++ pEq)
+      for (uint k = 0; k < pEq->nTerms; ++ k) {
+         int i = pEq->iTerms[k];
+         if (m_PackedData[i] != 0 && m_Tensors[i].pData == 0) {
+            if (k == 0)
+               throw std::runtime_error("packed tensors are read-only.");
+            FillData(i, Mem[0]);
+            Unpacked.push_back(i);
+         }
+      }
+
+   FContractCache
+      Intermediates(ContractCacheMb * 1048576);
+   AddStableTensors(Intermediates, m_Tensors, Method);
+
+   SplitStackmem(Mem);
+   for (size_t iLevel = 0; iLevel < nLevels; ++ iLevel) {
+      std::vector<FEqInfo const*>
+         Eqs;
+      std::map<int, int>
+         nWriters;
+      for (size_t j = 0; j < Set.nEqs; ++ j)
+         if (Level[j] == iLevel) {
+            Eqs.push_back(&Set.pEqs[j]);
+            nWriters[Set.pEqs[j].iTerms[0]] += 1;
+         }
+      std::vector<int>
+         // destinations which get private per-thread copies
+         Shared;
+      for (std::map<int, int>::const_iterator it = nWriters.begin(); it != nWriters.end(); ++ it)
+         if (it->second > 1)
+            Shared.push_back(it->first);
+      std::vector<FScalar*>
+         // [iThread * Shared.size() + iShared], allocated when first needed.
+         pPrivate(nThreads * Shared.size(), (FScalar*)0);
+
+#pragma omp parallel num_threads(nThreads)
+      {
+         FMemoryStack2
+            &ThreadMem = Mem[omprank];
+         void
+            *pBaseOfMemory = ThreadMem.Alloc(0);
+
+#pragma omp for schedule(dynamic)
+         for (int iEq = 0; iEq < (int)Eqs.size(); ++ iEq) {
+            FEqInfo const
+               *pEq = Eqs[iEq];
+            std::vector<FSrciTensor>
+               Ts(pEq->nTerms);
+            std::vector<FNdArrayView*>
+               pTs(pEq->nTerms);
+            for (uint k = 0; k < pEq->nTerms; ++ k) {
+               Ts[k] = m_Tensors[pEq->iTerms[k]];
+               pTs[k] = &Ts[k];
+            }
+            size_t
+               iShared = std::find(Shared.begin(), Shared.end(), pEq->iTerms[0]) - Shared.begin();
+            if (iShared != Shared.size()) {
+               FScalar
+                  *&pData = pPrivate[omprank * Shared.size() + iShared];
+               if (pData == 0) {
+                  FScalar Zero = 0;
+                  pData = ThreadMem.AllocN(Ts[0].nValues(), Zero);
+                  memset(pData, 0, Ts[0].nValues() * sizeof(pData[0]));
+               }
+               Ts[0].pData = pData;
+            }
+            void
+               *pBaseOfContraction = ThreadMem.Alloc(0);
+            if (pEq->nTerms == 3)
+               ContractBinary(Ts[0], pEq->pCoDecl, Ts[1], Ts[2], pEq->Factor, true, ThreadMem);
+            else
+               ContractN(&pTs[0], pEq->pCoDecl, pEq->Factor, true, ThreadMem, ContractCacheMb != 0? &Intermediates : 0);
+            ThreadMem.Free(pBaseOfContraction);
+         }
+
+         for (size_t iShared = 0; iShared < Shared.size(); ++ iShared) {
+            FSrciTensor
+               &Dest = m_Tensors[Shared[iShared]];
+            long
+               nValues = Dest.nValues();
+#pragma omp for schedule(static)
+            for (long i = 0; i < nValues; ++ i)
+               for (int iThread = 0; iThread < nThreads; ++ iThread) {
+                  FScalar const
+                     *pData = pPrivate[iThread * Shared.size() + iShared];
+                  if (pData != 0)
+                     Dest.pData[i] += pData[i];
+               }
+         }
+         ThreadMem.Free(pBaseOfMemory);
+      }
+      for (std::map<int, int>::const_iterator it = nWriters.begin(); it != nWriters.end(); ++ it)
+         Intermediates.Invalidate(m_Tensors[it->first].pData);
+   }
+   MergeStackmem(Mem);
+   for (size_t k = 0; k < Unpacked.size(); ++ k)
+      m_Tensors[Unpacked[k]].pData = 0;
+   Mem[0].Free(pBaseOfUnpacked);
+}
+
+
+// Make views in which the root is an additional, last index of the destination
+// and of the one per-root source of the equation, like in
+// Ap[abcd#] += W[abef] p[efcd#]. Not possible if any other term depends on the
+// root, or if the copies of the roots are not evenly spaced in memory.
+bool FJobContext::MakeRootBatch(std::vector<FNdArrayView> &Views, std::string &Decl, FEqInfo const *pEq, std::vector<uint> const &Roots)
+{
+   char const
+      RootIndex = '#';
+   if (Roots.size() < 2 || !IsPerRoot(pEq->iTerms[0]) || 0 != strchr(pEq->pCoDecl, RootIndex))
+      return false;
+   std::vector<std::string>
+      Terms;
+   {
+      std::stringstream
+         CoDecl(pEq->pCoDecl);
+      std::string
+         Term;
+      while (std::getline(CoDecl, Term, ','))
+         Terms.push_back(Term);
+   }
+   if (Terms.size() != pEq->nTerms)
+      return false;
+   uint
+      nPerRoot = 0;
+   Views.resize(pEq->nTerms);
+   for (uint i = 0; i < pEq->nTerms; ++ i) {
+      uint
+         iTensor = pEq->iTerms[i];
+      if (!IsPerRoot(iTensor)) {
+         Views[i] = m_Tensors[iTensor];
+         continue;
+      }
+      nPerRoot += 1;
+      FSrciTensor const
+         &First = RootTensor(Roots[0], iTensor);
+      if (nPerRoot > 2 || !m_Symmetries[iTensor].empty() || First.pData == 0)
+         return false;
+      std::ptrdiff_t
+         Spacing = RootTensor(Roots[1], iTensor).pData - First.pData;
+      if (Spacing <= 0)
+         return false;
+      for (uint k = 1; k < Roots.size(); ++ k) {
+         FSrciTensor const
+            &Other = RootTensor(Roots[k], iTensor);
+         if (Other.pData != First.pData + k * Spacing || Other.Sizes != First.Sizes || Other.Strides != First.Strides)
+            return false;
+      }
+      Views[i] = First;
+      Views[i].Strides.resize(Views[i].Sizes.size());
+      Views[i].Sizes.push_back(Roots.size());
+      Views[i].Strides.push_back(Spacing);
+      Terms[i] += RootIndex;
+   }
+   if (nPerRoot != 2)
+      return false;
+   Decl = Terms[0];
+   for (uint i = 1; i < Terms.size(); ++ i)
+      Decl += "," + Terms[i];
+   return true;
+}
+
+// Like ExecEquationSet, but for several roots at once. The disk tensors of an
+// equation are acquired only once for all roots, and products of integrals are
+// shared between the roots through the contraction cache. Equations whose only
+// per-root source is the amplitude are contracted for all roots in a single
+// call, with the root as an additional index; this turns the matrix-vector
+// products of the roots into one matrix-matrix product.
+void FJobContext::ExecEquationSetRoots(FEqSet const &Set, std::vector<uint> const &Roots, FMemoryStack2 &Mem)
+{
+   bool
+      UseCache = m_DiskCache.BudgetBytes != 0;
+   std::vector<int>
+      Unpacked;
+   std::vector<FNdArrayView>
+      Batch;
+   std::string
+      BatchDecl;
+   FContractCache
+      Intermediates(ContractCacheMb * 1048576),
+      *pIntermediates = 0;
+   if (ContractCacheMb != 0) {
+      for (uint k = 0; k < Roots.size(); ++ k) {
+         SelectRoot(Roots[k]);
+         AddStableTensors(Intermediates, m_Tensors, Method);
+      }
+      pIntermediates = &Intermediates;
+   }
+   for (FEqInfo const *pEq = Set.pEqs; pEq != Set.pEqs + Set.nEqs; ++ pEq) {
+      void
+         *pBaseOfMemory = Mem.Alloc(0);
+      for (uint i = 0; i < pEq->nTerms; ++ i)
+         if (Method.pTensorDecls[pEq->iTerms[i]].Storage == STORAGE_Disk) {
+            if (UseCache)
+               AcquireDiskTensor(pEq->iTerms[i], Set, pEq);
+            else
+               FillData(pEq->iTerms[i], Mem);
+         }
+      if (UseCache)
+         PrefetchDiskTensor(Set, pEq);
+      FNdArrayView
+         **pTs;
+      Mem.Alloc(pTs, pEq->nTerms);
+      if (MakeRootBatch(Batch, BatchDecl, pEq, Roots)) {
+         for (uint i = 0; i < pEq->nTerms; ++ i)
+            pTs[i] = &Batch[i];
+         ContractN(pTs, BatchDecl.c_str(), pEq->Factor, true, Mem, pIntermediates);
+         if (pIntermediates)
+            for (uint k = 0; k < Roots.size(); ++ k)
+               pIntermediates->Invalidate(RootTensor(Roots[k], pEq->iTerms[0]).pData);
+      } else {
+         for (uint k = 0; k < Roots.size(); ++ k) {
+            SelectRoot(Roots[k]);
+            void
+               *pBaseOfUnpacked = Mem.Alloc(0);
+            for (uint i = 0; i < pEq->nTerms; ++ i) {
+               pTs[i] = &m_Tensors[pEq->iTerms[i]];
+               if (m_PackedData[pEq->iTerms[i]] != 0 && pTs[i]->pData == 0) {
+                  if (i == 0)
+                     throw std::runtime_error("packed tensors are read-only.");
+                  FillData(pEq->iTerms[i], Mem);
+                  Unpacked.push_back(pEq->iTerms[i]);
+               }
+               if (i != 0 && pTs[i] == pTs[0])
+                  throw std::runtime_error(boost::str(format("contraction %i has overlapping dest and source tensors."
+                     " Tensors may not contribute to contractions involving themselves.") % (pEq - Set.pEqs)));
+            }
+            ContractN(pTs, pEq->pCoDecl, pEq->Factor, true, Mem, pIntermediates);
+            Mem.Free(pBaseOfUnpacked);
+            for (size_t j = 0; j < Unpacked.size(); ++ j)
+               m_Tensors[Unpacked[j]].pData = 0;
+            Unpacked.clear();
+            if (pIntermediates)
+               pIntermediates->Invalidate(m_Tensors[pEq->iTerms[0]].pData);
+         }
+      }
+      Mem.Free(pBaseOfMemory);
+   }
+}
+
+
+// number of equations after pEq until tensor i is used again, counting
+// cyclically since sets are executed once per iteration. 0 if pEq uses it,
+// Set.nEqs+1 if the set never does.
+static size_t NextUse(int i, FEqSet const &Set, FEqInfo const *pEq)
+{
+   size_t
+      iEq = pEq - Set.pEqs;
+   for (size_t d = 0; d <= Set.nEqs; ++ d) {
+      FEqInfo const
+         &Eq = Set.pEqs[(iEq + d) % Set.nEqs];
+      for (uint k = 0; k < Eq.nTerms; ++ k)
+         if (Eq.iTerms[k] == i)
+            return d;
+   }
+   return Set.nEqs + 1;
+}
+
+void FJobContext::FinishPrefetch()
+{
+   if (m_DiskCache.iPending < 0)
+      return;
+   int
+      iPending = m_DiskCache.iPending;
+   m_DiskCache.iPending = -1;
+   m_DiskCache.Pending.get();
+   m_DiskCache.Resident[iPending] = m_DiskCache.pPending;
+   m_DiskCache.pPending = 0;
+}
+
+// drop resident tensors, furthest next use first, until nBytes more fit into
+// the budget. Only tensors whose next use is later than MaxNextUse may go.
+bool FJobContext::EvictDiskTensors(size_t nBytes, size_t MaxNextUse, FEqSet const &Set, FEqInfo const *pEq)
+{
+   FDiskTensorCache
+      &Cache = m_DiskCache;
+   while (Cache.ResidentBytes + nBytes > Cache.BudgetBytes) {
+      std::map<int, FDiskTensorCache::FEntry*>::iterator
+         itVictim = Cache.Resident.end();
+      size_t
+         VictimUse = MaxNextUse;
+      for (std::map<int, FDiskTensorCache::FEntry*>::iterator it = Cache.Resident.begin(); it != Cache.Resident.end(); ++ it) {
+         size_t Use = NextUse(it->first, Set, pEq);
+         if (Use > VictimUse) {
+            VictimUse = Use;
+            itVictim = it;
+         }
+      }
+      if (itVictim == Cache.Resident.end())
+         return false;
+      Cache.ResidentBytes -= itVictim->second->Data.size() * sizeof(FScalar);
+      m_Tensors[itVictim->first].pData = 0;
+      delete itVictim->second;
+      Cache.Resident.erase(itVictim);
+   }
+   return true;
+}
+
+// make disk tensor i resident and point m_Tensors[i] to it.
+FScalar *FJobContext::AcquireDiskTensor(int i, FEqSet const &Set, FEqInfo const *pEq)
+{
+   FDiskTensorCache
+      &Cache = m_DiskCache;
+   if (Cache.iPending >= 0 && (Cache.iPending == i || !exists(i, Cache.Resident)))
+      FinishPrefetch();
+   if (!exists(i, Cache.Resident)) {
+      size_t
+         nBytes = m_Tensors[i].nValues() * sizeof(FScalar);
+      EvictDiskTensors(nBytes, 0, Set, pEq);
+      FDiskTensorCache::FEntry
+         *pEntry = new FDiskTensorCache::FEntry;
+      pEntry->Data.resize(m_Tensors[i].nValues());
+      FSrciTensor
+         View = m_Tensors[i];
+      View.pData = &pEntry->Data[0];
+      LoadData(i, View);
+      pEntry->Sizes = View.Sizes;
+      pEntry->Strides = View.Strides;
+      Cache.ResidentBytes += nBytes;
+      Cache.Resident[i] = pEntry;
+   }
+   FDiskTensorCache::FEntry
+      *pEntry = Cache.Resident[i];
+   m_Tensors[i].pData = &pEntry->Data[0];
+   m_Tensors[i].Sizes = pEntry->Sizes;
+   m_Tensors[i].Strides = pEntry->Strides;
+   return m_Tensors[i].pData;
+}
+
+// start reading the first disk tensor after pEq that is not resident, while
+// the contraction of pEq runs.
+void FJobContext::PrefetchDiskTensor(FEqSet const &Set, FEqInfo const *pEq)
+{
+   FDiskTensorCache
+      &Cache = m_DiskCache;
+   if (Cache.iPending >= 0)
+      return;
+   size_t
+      iEq = pEq - Set.pEqs;
+   for (size_t d = 1; d < Set.nEqs; ++ d) {
+      FEqInfo const
+         &Eq = Set.pEqs[(iEq + d) % Set.nEqs];
+      for (uint k = 0; k < Eq.nTerms; ++ k) {
+         int i = Eq.iTerms[k];
+         if (Method.pTensorDecls[i].Storage != STORAGE_Disk || exists(i, Cache.Resident))
+            continue;
+         size_t
+            nBytes = m_Tensors[i].nValues() * sizeof(FScalar);
+         if (!EvictDiskTensors(nBytes, d, Set, pEq))
+            return;
+         FDiskTensorCache::FEntry
+            *pEntry = new FDiskTensorCache::FEntry;
+         pEntry->Data.resize(m_Tensors[i].nValues());
+         FSrciTensor
+            View = m_Tensors[i];
+         View.pData = &pEntry->Data[0];
+         Cache.ResidentBytes += nBytes;
+         Cache.iPending = i;
+         Cache.pPending = pEntry;
+         Cache.Pending = std::async(std::launch::async, [this, i, pEntry, View]() mutable {
+            LoadData(i, View);
+            pEntry->Sizes = View.Sizes;
+            pEntry->Strides = View.Strides;
+         });
+         return;
+      }
+   }
+}
+
+void FJobContext::ClearDiskCache()
+{
+   FDiskTensorCache
+      &Cache = m_DiskCache;
+   FinishPrefetch();
+   for (std::map<int, FDiskTensorCache::FEntry*>::iterator it = Cache.Resident.begin(); it != Cache.Resident.end(); ++ it) {
+      if ((size_t)it->first < m_Tensors.size())
+         m_Tensors[it->first].pData = 0;
+      delete it->second;
+   }
+   Cache.Resident.clear();
+   Cache.ResidentBytes = 0;
+}
+
+
 void FJobContext::ReadMethodFile()
 {
   if (MethodName == "NEVPT2_AAVV") 
@@ -441,6 +1153,7 @@ void FJobContext::Init(ct::FMemoryStack2 &Mem)
 
    InitDomains();
    CreateTensors(Mem);
+   m_DiskCache.BudgetBytes = DiskCacheMb * 1048576;
    InitAmpResPairs();
 }
 
@@ -523,6 +1236,34 @@ FNdArrayView ViewFromNpy(ct::FArrayNpy &A)
 }
 
 void FJobContext::FillData(int i, ct::FMemoryStack2 &Mem) {
+  double A = 1.0;
+
+  if (Method.pTensorDecls[i].Usage != USAGE_PlaceHolder) {
+    double* tensorData = Mem.AllocN(m_Tensors[i].nValues(), A);
+    m_Tensors[i].pData = tensorData;
+  }
+  if (m_PackedData[i] != 0)
+    m_Symmetries[i].Unpack(m_Tensors[i], m_PackedData[i]);
+  else
+    LoadData(i, m_Tensors[i]);
+}
+
+void FJobContext::UnpackTensors(ct::FMemoryStack2 &Mem)
+{
+   for (uint i = 0; i != m_Tensors.size(); ++ i)
+      if (m_PackedData[i] != 0)
+         FillData(i, Mem);
+}
+
+void FJobContext::ReleaseUnpackedTensors()
+{
+   for (uint i = 0; i != m_Tensors.size(); ++ i)
+      if (m_PackedData[i] != 0)
+         m_Tensors[i].pData = 0;
+}
+
+// fill the data of tensor i into Out, whose storage is already allocated
+void FJobContext::LoadData(int i, FSrciTensor &Out) {
   FTensorDecl const
     &Decl = Method.pTensorDecls[i];
 
@@ -533,41 +1274,34 @@ void FJobContext::FillData(int i, ct::FMemoryStack2 &Mem) {
   uint
     nIntTerms = sizeof(pIntNames)/sizeof(pIntNames[0]);
 
-  double A = 1.0;
-
-  if (Decl.Usage != USAGE_PlaceHolder) {
-    double* tensorData = Mem.AllocN(m_Tensors[i].nValues(), A);
-    m_Tensors[i].pData = tensorData;
-  }
-     
   if (Decl.Usage == USAGE_Density) {
     uint k;
     const char *delta = "delta";
     if (0 == strcmp(Decl.pName, delta)) {
-      m_Tensors[i].ClearData();
+      Out.ClearData();
       for (int i1=0; i1<m_Domains[Decl.pDomain[0]].nSize; i1++) 
-	m_Tensors[i](i1,i1) = 1.0;
+	Out(i1,i1) = 1.0;
     }
     else if (Decl.pName[0] == 'S') {;}
     else {
-      std::string filename = "int/"+string(Decl.pName)+".npy";
-      m_Tensors[i].Sizes.clear();
-      m_Tensors[i].Strides.clear();
-      ct::ReadNpyData(m_Tensors[i], filename);
+      std::string filename = RootFile("int/"+string(Decl.pName)+".npy");
+      Out.Sizes.clear();
+      Out.Strides.clear();
+      ct::ReadNpyData(Out, filename);
     }
   }
   else if (Decl.Usage == USAGE_Hamiltonian) {
     if (0 == strcmp(Decl.pName, "W") ){// && 0==strcmp( string(Decl.pDomain).c_str(), "caca") ) {
       std::string filename = "int/W:"+string(Decl.pDomain)+".npy";
-      m_Tensors[i].Sizes.clear();
-      m_Tensors[i].Strides.clear();
-      ct::ReadNpyData(m_Tensors[i], filename);
+      Out.Sizes.clear();
+      Out.Strides.clear();
+      ct::ReadNpyData(Out, filename);
     }
     else {
       uint k;
       for (k = 0; k < nIntTerms; ++k)
 	if (0 == strcmp(Decl.pName, pIntNames[k])) {
-	  CopyDomianSubset(m_Tensors[i], ViewFromNpy(*pIntArrays[k]), Decl.pDomain, m_Domains);
+	  CopyDomianSubset(Out, ViewFromNpy(*pIntArrays[k]), Decl.pDomain, m_Domains);
 	  break;
 	}
       if (k == nIntTerms)
@@ -579,6 +1313,11 @@ void FJobContext::FillData(int i, ct::FMemoryStack2 &Mem) {
 void FJobContext::CreateTensors(ct::FMemoryStack2 &Mem)
 {
    m_Tensors.resize(Method.nTensorDecls);
+   m_Symmetries.resize(Method.nTensorDecls);
+   m_PackedData.assign(Method.nTensorDecls, (FScalar*)0);
+   m_iRoot = 0;
+   m_RootTensors.assign(nRoots > 1? nRoots : 0, m_Tensors);
+   m_RootPackedData.assign(nRoots > 1? nRoots : 0, m_PackedData);
    // create meta-information: shapes & sizes.
    size_t
       TotalSize = 0;
@@ -586,8 +1325,13 @@ void FJobContext::CreateTensors(ct::FMemoryStack2 &Mem)
       FTensorDecl const
          &Decl = Method.pTensorDecls[i];
       CreateTensorFromShape(m_Tensors[i], Decl.pDomain, Decl.pSymmetry, m_Domains);
+      // only tensors which are read from input and never written are packed.
+      if (Decl.pSymmetry != 0 && Decl.pSymmetry[0] != 0 && Decl.Storage == STORAGE_Memory &&
+          (Decl.Usage == USAGE_Density || Decl.Usage == USAGE_Hamiltonian))
+         m_Symmetries[i] = FTensorSymmetry(Decl.pSymmetry, m_Tensors[i].Rank());
       if (Decl.Usage != USAGE_PlaceHolder && Decl.Storage != STORAGE_Disk) //placeholders dont have their own data
-	TotalSize += m_Tensors[i].nValues();
+	TotalSize += (IsPerRoot(i)? nRoots : 1) *
+	  (m_Symmetries[i].empty()? m_Tensors[i].nValues() : m_Symmetries[i].nPacked(m_Tensors[i]));
 
 
       // keep a link in case we need to look up the contents of
@@ -606,8 +1350,40 @@ void FJobContext::CreateTensors(ct::FMemoryStack2 &Mem)
    //iDataOff = 0;
      
    for (uint i = 0; i != Method.nTensorDecls; ++i) {
-     if (Method.pTensorDecls[i].Storage != STORAGE_Disk)
-       FillData(i, Mem);
+     if (Method.pTensorDecls[i].Storage == STORAGE_Disk)
+       continue;
+     // with several roots, the copies of a per-root tensor are stored back to back.
+     uint
+       nCopies = (nRoots > 1 && IsPerRoot(i))? nRoots : 1;
+     FSrciTensor
+       Shape = m_Tensors[i];
+     for (m_iRoot = 0; m_iRoot != nCopies; ++ m_iRoot) {
+       m_Tensors[i] = Shape;
+       if (m_Symmetries[i].empty())
+         FillData(i, Mem);
+       else {
+         // read the full tensor on top of the stack and keep only its packed form.
+         FScalar
+           *pPacked = Mem.AllocN(m_Symmetries[i].nPacked(m_Tensors[i]), A);
+         void
+           *pBaseOfMemory = Mem.Alloc(0);
+         m_PackedData[i] = 0;
+         FillData(i, Mem);
+         m_Symmetries[i].Pack(pPacked, m_Tensors[i]);
+         Mem.Free(pBaseOfMemory);
+         m_Tensors[i].pData = 0;
+         m_PackedData[i] = pPacked;
+       }
+       if (nCopies != 1) {
+         m_RootTensors[m_iRoot][i] = m_Tensors[i];
+         m_RootPackedData[m_iRoot][i] = m_PackedData[i];
+       }
+     }
+     m_iRoot = 0;
+     if (nCopies != 1) {
+       m_Tensors[i] = m_RootTensors[0][i];
+       m_PackedData[i] = m_RootPackedData[0][i];
+     }
    }
    
    size_t nSizeVec;// = m_pResEnd - m_pRes;
@@ -658,8 +1434,11 @@ void FJobContext::InitAmpResPairs()
 }
 
 void FJobContext::DeleteData(ct::FMemoryStack2 &Mem) {
+  ClearDiskCache();
   Mem.Free(m_TensorData);
   m_Tensors.resize(0);
+  m_RootTensors.clear();
+  m_RootPackedData.clear();
 }
 
 void FJobContext::ClearTensors(size_t UsageFlags)
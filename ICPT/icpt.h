@@ -11,6 +11,8 @@ Copyright (c) 2016, Sandeep Sharma
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <vector>
+#include <future>
 #include <cmath>
 #include <boost/format.hpp>
 #include "CxPodArray.h"
@@ -161,6 +163,9 @@ struct FJobData
       WfDecl;
    FScalar
       RefEnergy;
+   std::vector<FScalar>
+      // reference energies of the individual roots, if more than one is solved for.
+      RefEnergies;
    ct::FArrayNpy
       Int1e_Fock,
       Int1e_CoreH,
@@ -193,8 +198,11 @@ struct FJobData
    uint
       nOrb,
       MaxIt,
-      nMaxDiis;
+      nMaxDiis,
+      nRoots; // number of states solved for together; each has its own density files.
   size_t WorkSpaceMb;
+  size_t DiskCacheMb; // budget for disk tensors kept in memory; 0 reads them for every contraction
+  size_t ContractCacheMb; // budget for intermediates shared between the equations of a set
    FMethodClass
       MethodClass;
 
@@ -254,6 +262,33 @@ typedef std::map<FDomainName, FDomainInfo>
 
 
 
+// Heap copies of the STORAGE_Disk tensors used by the equation sets. They
+// stay resident between contractions and iterations within a memory budget.
+// ExecEquationSet reads the next one it will need in a background thread and,
+// when the budget is full, drops the tensor whose next use is furthest away.
+struct FDiskTensorCache
+{
+   struct FEntry {
+      std::vector<FScalar>
+         Data;
+      FArraySizes
+         Sizes, Strides;
+   };
+   std::map<int, FEntry*>
+      Resident;
+   size_t
+      BudgetBytes, ResidentBytes;
+   int
+      // tensor being read in the background, or -1.
+      iPending;
+   FEntry
+      *pPending;
+   std::future<void>
+      Pending;
+   FDiskTensorCache() : BudgetBytes(0), ResidentBytes(0), iPending(-1), pPending(0) {}
+};
+
+
 static FScalar pow2(FScalar x) {
    return x*x;
 }
@@ -300,8 +335,29 @@ private:
 
    void UpdateAmplitudes(FScalar LevelShift, ct::FMemoryStack2 *Mem);
    void ExecEquationSet(FEqSet const &Eqs, std::vector<FSrciTensor>& m_Tensors, ct::FMemoryStack2 &Mem);
+   // executes independent equations of the set concurrently on the per-thread stacks.
+   void ExecEquationSetParallel(FEqSet const &Eqs, ct::FMemoryStack2 *Mem);
+   // executes the set for all given roots in one pass over its equations.
+   void ExecEquationSetRoots(FEqSet const &Eqs, std::vector<uint> const &Roots, ct::FMemoryStack2 &Mem);
+   bool MakeRootBatch(std::vector<FNdArrayView> &Views, std::string &Decl, FEqInfo const *pEq, std::vector<uint> const &Roots);
+   void MakeResidualsForRoots(std::vector<uint> const &Roots, ct::FMemoryStack2 *Mem);
+   void RunRoots(ct::FMemoryStack2 *Mem);
+   // make the amplitudes, residuals and densities of root iRoot the current ones.
+   void SelectRoot(uint iRoot);
+   FSrciTensor &RootTensor(uint iRoot, uint i);
+   bool IsPerRoot(uint i) const;
+   std::string RootFile(std::string const &FileName) const;
    void CleanAmplitudes(std::string const &r_or_t);
    void FillData (int i, ct::FMemoryStack2 &Mem);
+   void LoadData (int i, FSrciTensor &Out);
+   FScalar *AcquireDiskTensor(int i, FEqSet const &Set, FEqInfo const *pEq);
+   void PrefetchDiskTensor(FEqSet const &Set, FEqInfo const *pEq);
+   bool EvictDiskTensors(size_t nBytes, size_t MaxNextUse, FEqSet const &Set, FEqInfo const *pEq);
+   void FinishPrefetch();
+   void ClearDiskCache();
+   // expand all packed tensors on Mem, for code addressing them directly.
+   void UnpackTensors(ct::FMemoryStack2 &Mem);
+   void ReleaseUnpackedTensors();
    void SaveToDisk(std::string file, std::string op);
    void DeAllocate(std::string op, ct::FMemoryStack2 &Mem);
    void Allocate(std::string op, ct::FMemoryStack2 &Mem);
@@ -313,6 +369,22 @@ private:
       m_Domains;
    std::vector<FSrciTensor>
       m_Tensors;
+   FDiskTensorCache
+      m_DiskCache;
+   std::vector<FTensorSymmetry>
+      m_Symmetries;
+   std::vector<FScalar*>
+      // read-only tensors with a permutation symmetry are kept in packed form
+      // here, and unpacked for the contractions using them. 0 for all others.
+      m_PackedData;
+   uint
+      m_iRoot;
+   std::vector< std::vector<FSrciTensor> >
+      // with several roots: the views of the per-root tensors of all roots.
+      // those of root m_iRoot are stale; its current views are in m_Tensors.
+      m_RootTensors;
+   std::vector< std::vector<FScalar*> >
+      m_RootPackedData;
 
    typedef std::map<std::string, FSrciTensor* >
       FTensorByNameMap;
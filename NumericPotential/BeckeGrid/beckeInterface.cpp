@@ -72,6 +72,40 @@ void fitDensity(int ia, int rindex) {
   densityYlm[ia].fit(rindex, &density[0]);
 }
 
+//fits the density of atom ia on all its radial shells. The shells are
+//evaluated in blocks so that getValuesAtGrid and the Becke partition see
+//large grids, and each block is projected on the Ylm with one GEMM.
+void fitDensityOfAtom(int ia) {
+  int nang = RawDataOnGrid::lebdevgrid.rows();
+  int nr = densityYlm[ia].radialGrid.size();
+  int blockShells = max(1, min(nr, 32768/nang));
+
+  MatrixXdR grid(blockShells*nang, 3);
+  vector<double> density(blockShells*nang), becke(natm*blockShells*nang);
+
+  for (int r0 = 0; r0 < nr; r0 += blockShells) {
+    int nshells = min(blockShells, nr - r0), GridSize = nshells * nang;
+
+    #pragma omp parallel for
+    for (int s = 0; s < nshells; s++) {
+      grid.block(s*nang, 0, nang, 3) = RawDataOnGrid::lebdevgrid.leftCols(3) * densityYlm[ia].radialGrid(r0 + s);
+      grid.block(s*nang, 0, nang, 3).rowwise() += densityYlm[ia].coord.transpose();
+    }
+
+    getValuesAtGrid(&grid(0,0), GridSize, &density[0]);
+    getBeckePartition(&grid(0,0), GridSize, &becke[0]);
+
+    #pragma omp parallel for
+    for (int i = 0; i<GridSize; i++) {
+      double beckenorm = 0.0;
+      for (int a =0; a<natm; a++)
+        beckenorm += becke[a * GridSize + i];
+      density[i] *= becke[ia*GridSize + i]/beckenorm;
+    }
+    densityYlm[ia].fitShells(r0, nshells, &density[0]);
+  }
+}
+
 //void getDensityOnLebdevGridAtGivenR(int rindex, double* densityOut) {
 //densityYlm.getValue(rindex, densityOut);
 //}
@@ -83,7 +117,7 @@ void solvePoissonsEquation(int ia) {
 
   int nr = densityYlm[ia].radialGrid.size();
   double h = 1./(1.*nr+1.), rm = densityYlm[ia].rm;
-  VectorXd drdz(nr), d2rdz2(nr), b(nr);
+  VectorXd drdz(nr), d2rdz2(nr);
   VectorXd& z = densityYlm[ia].zgrid, &r = densityYlm[ia].radialGrid;
 
   for (int i=0; i<nr; i++) {
@@ -118,32 +152,29 @@ void solvePoissonsEquation(int ia) {
   A2Der.block(nr-3, nr-6, 1, 6) <<  2., -27.,  270., -490.,  270., -27.;
   A1Der.block(nr-3, nr-6, 1, 6) << -1.,   9.,  -45.,    0.,   45.,  -9.;
 
+  //A only depends on l, so the 2l+1 components of each l share one factorization
   int lmax = densityYlm[ia].lmax;
   for (int l = 0; l < lmax; l++) {
-    for (int m = -l; m < l+1; m++) {
-      int lm = l * l + (l + m);
+    MatrixXd b = -4 * M_PI * r.asDiagonal() * densityYlm[ia].CoeffsYlm.middleCols(l * l, 2 * l + 1);
 
-      b = -4 * M_PI * r.cwiseProduct(densityYlm[ia].CoeffsYlm.col(lm));
-
-      if (l == 0) {
-        b(0) += sqrt(4 * M_PI) * (-137. / (180. * h * h)/(drdz(0) * drdz(0))) * totalQ;
-        b(1) += sqrt(4 * M_PI) * (  13. / (180. * h * h)/(drdz(1) * drdz(1))) * totalQ;
-        b(2) += sqrt(4 * M_PI) * (  -2. / (180. * h * h)/(drdz(2) * drdz(2))) * totalQ;
+    if (l == 0) {
+      b(0, 0) += sqrt(4 * M_PI) * (-137. / (180. * h * h)/(drdz(0) * drdz(0))) * totalQ;
+      b(1, 0) += sqrt(4 * M_PI) * (  13. / (180. * h * h)/(drdz(1) * drdz(1))) * totalQ;
+      b(2, 0) += sqrt(4 * M_PI) * (  -2. / (180. * h * h)/(drdz(2) * drdz(2))) * totalQ;
         
-        b(0) += sqrt(4 * M_PI) * (  10. / (60. * h)*(-d2rdz2(0) / pow(drdz(0),3))) * totalQ;
-        b(1) += sqrt(4 * M_PI) * (  -2. / (60. * h)*(-d2rdz2(1) / pow(drdz(1),3))) * totalQ;
-        b(2) += sqrt(4 * M_PI) * (   1. / (60. * h)*(-d2rdz2(2) / pow(drdz(2),3))) * totalQ;
-      }
+      b(0, 0) += sqrt(4 * M_PI) * (  10. / (60. * h)*(-d2rdz2(0) / pow(drdz(0),3))) * totalQ;
+      b(1, 0) += sqrt(4 * M_PI) * (  -2. / (60. * h)*(-d2rdz2(1) / pow(drdz(1),3))) * totalQ;
+      b(2, 0) += sqrt(4 * M_PI) * (   1. / (60. * h)*(-d2rdz2(2) / pow(drdz(2),3))) * totalQ;
+    }
       
-      for (int i=0; i<nr; i++) {
-        A.row(i) = A2Der.row(i) / (180. * h * h)/(drdz(i) * drdz(i))
-            + A1Der.row(i) / (60 * h) * (-d2rdz2(i) / pow(drdz(i), 3));
+    for (int i=0; i<nr; i++) {
+      A.row(i) = A2Der.row(i) / (180. * h * h)/(drdz(i) * drdz(i))
+          + A1Der.row(i) / (60 * h) * (-d2rdz2(i) / pow(drdz(i), 3));
         
-        A(i, i) += (-l * (l + 1) / r(i) / r(i)); 
-      }
-
-      potentialYlm[ia].CoeffsYlm.col(lm) = A.colPivHouseholderQr().solve(b);
+      A(i, i) += (-l * (l + 1) / r(i) / r(i)); 
     }
+
+    potentialYlm[ia].CoeffsYlm.middleCols(l * l, 2 * l + 1) = A.colPivHouseholderQr().solve(b);
   }
 }
 
@@ -155,7 +186,7 @@ void solveScreenedPoissonsEquation(int ia, double lambda) {
 
   int nr = densityYlm[ia].radialGrid.size();
   double h = 1./(1.*nr+1.), rm = densityYlm[ia].rm;
-  VectorXd drdz(nr), d2rdz2(nr), b(nr);
+  VectorXd drdz(nr), d2rdz2(nr);
   VectorXd& z = densityYlm[ia].zgrid, &r = densityYlm[ia].radialGrid;
 
   for (int i=0; i<nr; i++) {
@@ -193,32 +224,29 @@ void solveScreenedPoissonsEquation(int ia, double lambda) {
   for (int i=0; i<nr; i++)
     A2Der(i,i) = -lambda*lambda;
   
+  //A only depends on l, so the 2l+1 components of each l share one factorization
   int lmax = densityYlm[ia].lmax;
   for (int l = 0; l < lmax; l++) {
-    for (int m = -l; m < l+1; m++) {
-      int lm = l * l + (l + m);
-
-      b = -4 * M_PI * r.cwiseProduct(densityYlm[ia].CoeffsYlm.col(lm));
+    MatrixXd b = -4 * M_PI * r.asDiagonal() * densityYlm[ia].CoeffsYlm.middleCols(l * l, 2 * l + 1);
 
-      if (l == 0) {
-        b(0) += sqrt(4 * M_PI) * (-137. / (180. * h * h)/(drdz(0) * drdz(0))) * totalQ;
-        b(1) += sqrt(4 * M_PI) * (  13. / (180. * h * h)/(drdz(1) * drdz(1))) * totalQ;
-        b(2) += sqrt(4 * M_PI) * (  -2. / (180. * h * h)/(drdz(2) * drdz(2))) * totalQ;
+    if (l == 0) {
+      b(0, 0) += sqrt(4 * M_PI) * (-137. / (180. * h * h)/(drdz(0) * drdz(0))) * totalQ;
+      b(1, 0) += sqrt(4 * M_PI) * (  13. / (180. * h * h)/(drdz(1) * drdz(1))) * totalQ;
+      b(2, 0) += sqrt(4 * M_PI) * (  -2. / (180. * h * h)/(drdz(2) * drdz(2))) * totalQ;
         
-        b(0) += sqrt(4 * M_PI) * (  10. / (60. * h)*(-d2rdz2(0) / pow(drdz(0),3))) * totalQ;
-        b(1) += sqrt(4 * M_PI) * (  -2. / (60. * h)*(-d2rdz2(1) / pow(drdz(1),3))) * totalQ;
-        b(2) += sqrt(4 * M_PI) * (   1. / (60. * h)*(-d2rdz2(2) / pow(drdz(2),3))) * totalQ;
-      }
+      b(0, 0) += sqrt(4 * M_PI) * (  10. / (60. * h)*(-d2rdz2(0) / pow(drdz(0),3))) * totalQ;
+      b(1, 0) += sqrt(4 * M_PI) * (  -2. / (60. * h)*(-d2rdz2(1) / pow(drdz(1),3))) * totalQ;
+      b(2, 0) += sqrt(4 * M_PI) * (   1. / (60. * h)*(-d2rdz2(2) / pow(drdz(2),3))) * totalQ;
+    }
       
-      for (int i=0; i<nr; i++) {
-        A.row(i) = A2Der.row(i) / (180. * h * h)/(drdz(i) * drdz(i))
-            + A1Der.row(i) / (60 * h) * (-d2rdz2(i) / pow(drdz(i), 3));
+    for (int i=0; i<nr; i++) {
+      A.row(i) = A2Der.row(i) / (180. * h * h)/(drdz(i) * drdz(i))
+          + A1Der.row(i) / (60 * h) * (-d2rdz2(i) / pow(drdz(i), 3));
         
-        A(i, i) += (-l * (l + 1) / r(i) / r(i)); 
-      }
-
-      potentialYlm[ia].CoeffsYlm.col(lm) = A.colPivHouseholderQr().solve(b);
+      A(i, i) += (-l * (l + 1) / r(i) / r(i)); 
     }
+
+    potentialYlm[ia].CoeffsYlm.middleCols(l * l, 2 * l + 1) = A.colPivHouseholderQr().solve(b);
   }
 }
 
@@ -231,6 +259,19 @@ void getPotentialBeckeOfAtom(int ia, int ngrid, double* grid, double* potential)
   splinePotential[ia].getPotential(ngrid, grid, potential);
 }
 
+//potential of all the given atoms in one threaded pass over the grid
+void getPotentialBeckeOfAtoms(const vector<int>& atoms, int ngrid, double* grid, double* potential) {
+  #pragma omp parallel
+  {
+    CalculateSphHarmonics sph(RawDataOnGrid::lmax);
+    VectorXd CoeffsYlm;
+    #pragma omp for
+    for (int i=0; i<ngrid; i++)
+      for (int k=0; k<atoms.size(); k++)
+        potential[i] += splinePotential[atoms[k]].getValue(&grid[3*i], sph, CoeffsYlm);
+  }
+}
+
 void getPotentialBecke(int ngrid, double* grid, double* potential, int lmax,
                        int* nrad, double* rm, double* pdm) {
   coordScale = 1.0;
@@ -251,26 +292,24 @@ void getPotentialBecke(int ngrid, double* grid, double* potential, int lmax,
   MPI_Comm_size(comm, &psize);
   
   
-  for (int ia=rank; ia<natm; ia+=psize) {
-    //current_time = time(NULL); cout << "atom "<<ia<<"  "<<current_time-Initcurrent_time<<endl;
-    initDensityRadialGrid(ia, nrad[ia], rm[ia]);
-    //cout << densityYlm[ia].radialGrid.rows()<<" num r rows "<<endl;
-    
-    for (int rindex = 0; rindex < nrad[ia] ; rindex++)
-      fitDensity(ia, rindex);
-
-    //current_time = time(NULL); cout << "fit density "<<ia<<"  "<<current_time-Initcurrent_time<<endl;
+  vector<int> atoms;
+  for (int ia=rank; ia<natm; ia+=psize)
+    atoms.push_back(ia);
 
-    solvePoissonsEquation(ia);
-   //current_time = time(NULL); cout << "solve poisson "<<ia<<"  "<<current_time-Initcurrent_time<<endl;
-
-    fitSplinePotential(ia);
-    //current_time = time(NULL); cout << "fit spline "<<ia<<"  "<<current_time-Initcurrent_time<<endl;
+  for (int k=0; k<atoms.size(); k++) {
+    initDensityRadialGrid(atoms[k], nrad[atoms[k]], rm[atoms[k]]);
+    fitDensityOfAtom(atoms[k]);
+  }
 
-    getPotentialBeckeOfAtom(ia, ngrid, grid, potential);
-   //current_time = time(NULL); cout << "get potential "<<ia<<"  "<<current_time-Initcurrent_time<<endl;
+  //the radial equations and spline fits of different atoms are independent
+  #pragma omp parallel for schedule(dynamic)
+  for (int k=0; k<atoms.size(); k++) {
+    solvePoissonsEquation(atoms[k]);
+    fitSplinePotential(atoms[k]);
   }
 
+  getPotentialBeckeOfAtoms(atoms, ngrid, grid, potential);
+
   cout.precision(15);
   MPI_Allreduce(MPI_IN_PLACE, potential, ngrid, MPI_DOUBLE, MPI_SUM, comm);
   
@@ -50,7 +50,6 @@ void SplineFit::Init(const RawDataOnGrid& potentialYlm){
   int nlm = potentialYlm.CoeffsYlm.cols();
   int nr  = zgrid.size();
   
-  CoeffsYlm.resize(nlm);
   CoeffsYlmFit.resize(nlm);
 
   vector<double> vals(nr+2,0.0);
@@ -71,30 +70,35 @@ void SplineFit::Init(const RawDataOnGrid& potentialYlm){
   }
 }
 
+double SplineFit::getValue(const double* point, CalculateSphHarmonics& sph,
+                           VectorXd& CoeffsYlm) const {
+  double sphCoord[3];
+  double X = point[0] - coord[0],
+      Y = point[1] - coord[1],
+      Z = point[2] - coord[2];
+  getSphericalCoords(X, Y, Z, 
+                     sphCoord[0], sphCoord[1], sphCoord[2]);
+      
+  sph.populate(sphCoord[1], sphCoord[2]); //sphcoords
+  double r = sphCoord[0];
+  double z = (1./M_PI) * acos( (r - rm)/(r+rm));
+
+  CoeffsYlm.resize(CoeffsYlmFit.size());
+  for (int lm=0; lm<CoeffsYlmFit.size(); lm++)
+    CoeffsYlm[lm] = CoeffsYlmFit[lm](z);
+      
+  return CoeffsYlm.dot( sph.values )/r;
+}
+
 void SplineFit::getPotential(int ngrid, double* grid, double* potential) {
 
   #pragma omp parallel
   {    
-    double sphCoord[3];
     CalculateSphHarmonics sph(lmax); 
+    VectorXd CoeffsYlm;
     #pragma omp for
-    for (int i=0; i<ngrid; i++) {
-      double X = grid[3*i] - coord[0],
-          Y = grid[3*i+1] - coord[1],
-          Z = grid[3*i+2] - coord[2];
-      getSphericalCoords(X, Y, Z, 
-                         sphCoord[0], sphCoord[1], sphCoord[2]);
-      
-      sph.populate(sphCoord[1], sphCoord[2]); //sphcoords
-      double r = sphCoord[0];
-      double z = (1./M_PI) * acos( (r - rm)/(r+rm));
-      
-      for (int lm=0; lm<CoeffsYlmFit.size(); lm++)
-        CoeffsYlm[lm] = CoeffsYlmFit[lm](z);
-      
-      potential[i] += CoeffsYlm.dot( sph.values )/r;
-      
-    }
+    for (int i=0; i<ngrid; i++)
+      potential[i] += getValue(&grid[3*i], sph, CoeffsYlm);
   }
 }
 
@@ -154,12 +158,15 @@ void RawDataOnGrid::InitRadialGrids(int rmax, double prm) {
   
 //calculate the coefficients for spherical Harmonics for lebdev grid at radius r
 void RawDataOnGrid::fit(int rindex, double* density) {
-  int nang = densityStore.size();
-  for (int i=0; i<densityStore.size(); i++)
-    densityStore(i) = density[i];  
+  fitShells(rindex, 1, density);
+}
 
-  GridValues.row(rindex) = densityStore;
-  CoeffsYlm.row(rindex) = WeightedSphVals.transpose() * densityStore;
+//one GEMM projects all the shells onto the spherical harmonics
+void RawDataOnGrid::fitShells(int rstart, int nshells, const double* density) {
+  int nang = lebdevgrid.rows();
+  GridValues.middleRows(rstart, nshells) = Map<const MatrixXdR>(density, nshells, nang);
+  CoeffsYlm.middleRows(rstart, nshells).noalias() =
+      GridValues.middleRows(rstart, nshells) * WeightedSphVals;
 }
 
 void RawDataOnGrid::getValue(int rindex, double* densityOut) {
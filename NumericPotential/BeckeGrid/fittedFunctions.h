@@ -41,6 +41,8 @@ struct RawDataOnGrid {
   
   //calculate the coefficients for spherical Harmonics for lebdev grid at radius r
   void fit(int rindex,double* density);  
+  //same for nshells consecutive radii, density is nshells x #lebdev
+  void fitShells(int rstart, int nshells, const double* density);
   void getValue(int rindex, double* densityOut);
   
 };
@@ -51,9 +53,10 @@ struct SplineFit {
   VectorXd zgrid; //r = rm*(1+cos(pi z))/(1-cos(pi z))  
   double rm;
   int lmax;
-  VectorXd CoeffsYlm; //#lm (this is just used during claculations)
 
   void Init(const RawDataOnGrid& in);
   void getPotential(int ngrid, double* grid, double* potential);
+  //potential at one point, sph and CoeffsYlm are scratch owned by the caller
+  double getValue(const double* point, CalculateSphHarmonics& sph, VectorXd& CoeffsYlm) const;
 };
 
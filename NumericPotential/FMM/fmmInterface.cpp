@@ -10,15 +10,27 @@
 
 using namespace Eigen;
 
+//AO values on the quadrature points of one leaf of the tree. Only the AOs
+//that are larger than AoScreenTol somewhere in the leaf are kept and vals is
+//the npts x aoIndex.size() x nkpts block of their values in column major order
+template<typename T>
+struct LeafAoBlock {
+  int npts;
+  vector<int> aoIndex;
+  vector<T> vals;
+};
+
+const double AoScreenTol = 1.e-10;
+
 //#FMM TREE
 pvfmm::ChebFMM_Tree<double>* tree;
 vector<double> LegCoord, LegWts;
-vector<double> AoValsAtLegCoord;
-vector<complex<double>> AoValsAtLegCoordComplex;
+vector<LeafAoBlock<double>> AoValsAtLegLeaves;
+vector<LeafAoBlock<complex<double>>> AoValsAtLegLeavesComplex;
 
 vector<double> ChebCoord;
-vector<double> AoValsAtChebCoord;
-vector<complex<double>> AoValsAtChebCoordComplex;
+vector<LeafAoBlock<double>> AoValsAtChebLeaves;
+vector<LeafAoBlock<complex<double>>> AoValsAtChebLeavesComplex;
 vector<double> density;
 
 template<typename T>
@@ -30,75 +42,70 @@ void writeNorm(T* mat, size_t size) {
 }
 
 
+vector<pvfmm::ChebFMM_Node<double>*> getLeafNodes() {
+  auto nodes = tree->GetNodeList();
+  vector<pvfmm::ChebFMM_Node<double>*> leaves;
+  for (int i=0; i<nodes.size(); i++)
+    if (nodes[i]->IsLeaf())
+      leaves.push_back(nodes[i]);
+  return leaves;
+}
+
 void populateChebyshevCoordinates(int leafNodes, int cheb_deg) {
   size_t nCheb = (cheb_deg+1)*(cheb_deg+1)*(cheb_deg+1);
-  size_t index = 0;
-  double volume = 0.0;
-  auto nodes = tree->GetNodeList();
+  auto leaves = getLeafNodes();
   
   //chebyshev coord
-  ChebCoord.resize(leafNodes*nCheb*3, 0.0);
-  std::vector<double> Chebcoord=pvfmm::cheb_nodes<double>(cheb_deg,nodes[0]->Dim());
-  for (int i=0; i<nodes.size(); i++)
-    if (nodes[i]->IsLeaf()) {
-      double s=pvfmm::pow<double>(0.5,nodes[i]->Depth());
-      for (int j=0; j<nCheb; j++) {
-        ChebCoord[index*3+0] = Chebcoord[j*3+0]*s+nodes[i]->Coord()[0];
-        ChebCoord[index*3+1] = Chebcoord[j*3+1]*s+nodes[i]->Coord()[1];
-        ChebCoord[index*3+2] = Chebcoord[j*3+2]*s+nodes[i]->Coord()[2];
-        index++;
-      }
+  ChebCoord.resize(leaves.size()*nCheb*3, 0.0);
+  std::vector<double> Chebcoord=pvfmm::cheb_nodes<double>(cheb_deg,leaves[0]->Dim());
+#pragma omp parallel for
+  for (int i=0; i<leaves.size(); i++) {
+    double s=pvfmm::pow<double>(0.5,leaves[i]->Depth());
+    for (int j=0; j<nCheb; j++) {
+      size_t index = i*nCheb + j;
+      ChebCoord[index*3+0] = Chebcoord[j*3+0]*s+leaves[i]->Coord()[0];
+      ChebCoord[index*3+1] = Chebcoord[j*3+1]*s+leaves[i]->Coord()[1];
+      ChebCoord[index*3+2] = Chebcoord[j*3+2]*s+leaves[i]->Coord()[2];
     }
+  }
 
 }
 
 
 void populateLegendreCoordinates(int leafNodes) {
   
-  auto nodes = tree->GetNodeList();
+  auto leaves = getLeafNodes();
   const int legdeg = 11;
   size_t nLeg  = legdeg * legdeg * legdeg;
-  size_t numCoords = leafNodes * nLeg;
-  size_t index = 0;
-  double volume = 0.0;
+  size_t numCoords = leaves.size() * nLeg;
   
   vector<double> Legcoord, Legwts;
-  getLegCoords<legdeg>(nodes[0]->Dim(), Legcoord, Legwts);
+  getLegCoords<legdeg>(leaves[0]->Dim(), Legcoord, Legwts);
   
   LegCoord.resize(numCoords*3, 0.0); LegWts.resize(numCoords, 0.0);
   
-  vector<double> nodeTrgCoords(nLeg*3, 0.0);
-
   //legendre coord for each leaf node and make them also the target coords
   //so that the potential is calculated at those points
-  for (int i=0; i<nodes.size(); i++)
-    if (nodes[i]->IsLeaf()) {
-      double s=pvfmm::pow<double>(0.5,nodes[i]->Depth());
-      double wt = s*s*s/8;
-      volume += wt;
-      for (int j=0; j<nLeg; j++) {
-        LegCoord[index*3+0] = Legcoord[j*3+0]*s+nodes[i]->Coord()[0];
-        LegCoord[index*3+1] = Legcoord[j*3+1]*s+nodes[i]->Coord()[1];
-        LegCoord[index*3+2] = Legcoord[j*3+2]*s+nodes[i]->Coord()[2];
-        
-        LegWts[index] = Legwts[j] * wt;//j == 0 ? wt: 0.0;//wt;//s*s*s * scal;
-        
-        nodeTrgCoords[j*3+0] = LegCoord[index*3+0];
-        nodeTrgCoords[j*3+1] = LegCoord[index*3+1];
-        nodeTrgCoords[j*3+2] = LegCoord[index*3+2];
-        
-        nodes[i]->trg_coord = nodeTrgCoords;
-        
-        
-        index++;
-      }
+#pragma omp parallel for
+  for (int i=0; i<leaves.size(); i++) {
+    double s=pvfmm::pow<double>(0.5,leaves[i]->Depth());
+    double wt = s*s*s/8;
+    for (int j=0; j<nLeg; j++) {
+      size_t index = i*nLeg + j;
+      LegCoord[index*3+0] = Legcoord[j*3+0]*s+leaves[i]->Coord()[0];
+      LegCoord[index*3+1] = Legcoord[j*3+1]*s+leaves[i]->Coord()[1];
+      LegCoord[index*3+2] = Legcoord[j*3+2]*s+leaves[i]->Coord()[2];
+      
+      LegWts[index] = Legwts[j] * wt;//j == 0 ? wt: 0.0;//wt;//s*s*s * scal;
     }
+    leaves[i]->trg_coord = vector<double>(&LegCoord[i*nLeg*3], &LegCoord[(i+1)*nLeg*3]);
+  }
 
 }
 
 int printTreeStats() {
   auto nodes = tree->GetNodeList();
-  int leafNodes;
+  int leafNodes = 0;
   MPI_Comm comm = MPI_COMM_WORLD;
   {
     int myrank;
@@ -135,6 +142,245 @@ int printTreeStats() {
   return leafNodes;
 }
 
+//getAoValuesAtGrid with per thread scratch so that it can be called from
+//inside a parallel region
+void getAoValuesAtGridLocal(const double* grid_cformat, int ngrid, double* aovals) {
+  thread_local vector<double> grid_fformat;
+  thread_local vector<char> non0tab;
+  if (grid_fformat.size() < 3*ngrid)
+    grid_fformat.resize(ngrid*3);
+
+  for (int i=0; i<ngrid; i++)
+    for (int j=0; j<3; j++)
+      grid_fformat[i + j*ngrid] = (grid_cformat[j + i*3]-0.5)*coordScale + centroid[j];
+
+  int tabSize = (((ngrid + BLKSIZE-1)/BLKSIZE) * nbas)*10;
+  if (non0tab.size() < tabSize)
+    non0tab.resize(tabSize, 1);
+
+  GTOval_cart(ngrid, shls, ao_loc, &aovals[0], &grid_fformat[0],
+              &non0tab[0], atm, natm, bas, nbas, env);
+}
+
+//density at the grid points, same as getValuesAtGrid but safe to call from
+//the threads that pvfmm uses to refine the tree
+void getValuesAtGridLocal(const double* grid_cformat, int ngrid, double* out) {
+  int nao = ao_loc[shls[1]] - ao_loc[shls[0]];
+  thread_local vector<double> aovals, intermediate;
+  if (aovals.size() < nao*ngrid) {
+    aovals.resize(nao*ngrid, 0.0);
+    intermediate.resize(nao*ngrid, 0.0);
+  }
+
+  getAoValuesAtGridLocal(grid_cformat, ngrid, &aovals[0]);
+
+  double alpha = 1.0, beta = 0.0;
+  cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
+              ngrid, nao, nao, alpha, &aovals[0], ngrid, &dm[0], nao, beta,
+              &intermediate[0], ngrid);
+
+  std::fill(out, out+ngrid, 0.);
+  for (int p = 0; p<nao; p++)
+  for (int g = 0; g<ngrid; g++)
+    out[g] += intermediate[p*ngrid + g] * aovals[p*ngrid + g];
+
+#pragma omp atomic
+  ncalls += ngrid;
+}
+
+//the periodic evaluator keeps its scratch in globals, so the calls from
+//different threads are serialised
+void getValuesAtGridPeriodicSerial(const double* grid_cformat, int ngrid, double* out) {
+#pragma omp critical (fmmPeriodicDensity)
+  getValuesAtGridPeriodic(grid_cformat, ngrid, out);
+}
+
+//keep the columns of the AOs that are significant on the npts points starting
+//at offset of the ngrid x nao x nk array aovals
+template<typename T>
+void compressLeaf(const T* aovals, size_t ngrid, size_t offset, int npts,
+                  int nao, int nk, LeafAoBlock<T>& leaf) {
+  leaf.npts = npts;
+  leaf.aoIndex.clear();
+  for (int p=0; p<nao; p++) {
+    double maxval = 0.0;
+    for (int k=0; k<nk; k++)
+      for (int g=0; g<npts; g++)
+        maxval = max(maxval, (double)abs(aovals[(k*nao + p)*ngrid + offset + g]));
+    if (maxval > AoScreenTol) leaf.aoIndex.push_back(p);
+  }
+
+  int nsig = leaf.aoIndex.size();
+  leaf.vals.resize((size_t)npts * nsig * nk);
+  for (int k=0; k<nk; k++)
+    for (int s=0; s<nsig; s++)
+      std::copy(&aovals[(k*nao + leaf.aoIndex[s])*ngrid + offset],
+                &aovals[(k*nao + leaf.aoIndex[s])*ngrid + offset] + npts,
+                &leaf.vals[(k*nsig + s)*npts]);
+}
+
+//every leaf has npts consecutive points in coords
+void storeAoValuesOnLeaves(vector<double>& coords, int npts,
+                           vector<LeafAoBlock<double>>& leaves) {
+  int nao = ao_loc[shls[1]] - ao_loc[shls[0]];
+  int nleaves = coords.size()/3/npts;
+  leaves.resize(nleaves);
+
+#pragma omp parallel
+  {
+    vector<double> aovals((size_t)npts * nao);
+#pragma omp for schedule(dynamic)
+    for (int i=0; i<nleaves; i++) {
+      getAoValuesAtGridLocal(&coords[3*i*npts], npts, &aovals[0]);
+      compressLeaf(&aovals[0], npts, 0, npts, nao, 1, leaves[i]);
+    }
+  }
+}
+
+//the periodic AO values are evaluated for a few leaves at a time so that the
+//dense scratch stays small, and then compressed in parallel
+void storeAoValuesOnLeaves(vector<double>& coords, int npts,
+                           vector<LeafAoBlock<complex<double>>>& leaves) {
+  int nao = ao_loc[shls[1]] - ao_loc[shls[0]];
+  int nleaves = coords.size()/3/npts;
+  const int leafBatch = 8;
+  leaves.resize(nleaves);
+
+  vector<complex<double>> aovals((size_t)leafBatch * npts * nao * nkpts);
+  for (int i0=0; i0<nleaves; i0+=leafBatch) {
+    int nb = min(leafBatch, nleaves - i0);
+    getAoValuesAtGridPeriodic(&coords[3*i0*npts], nb*npts, &aovals[0]);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i=0; i<nb; i++)
+      compressLeaf(&aovals[0], (size_t)nb*npts, (size_t)i*npts, npts, nao, nkpts, leaves[i0+i]);
+  }
+}
+
+//rho_k(g) = A(g,s) D_k(s,t) A*(g,t) with the density matrix restricted to the
+//AOs of the leaf, summed over the k-points
+void leafDensity(LeafAoBlock<double>& leaf, const double* pdm, int nao, int nk,
+                 vector<double>& dmSub, vector<double>& intermediate, double* rho) {
+  int npts = leaf.npts, nsig = leaf.aoIndex.size();
+  if (nsig == 0) return;
+  if (dmSub.size() < nsig*nsig) dmSub.resize(nsig*nsig);
+  if (intermediate.size() < npts*nsig) intermediate.resize(npts*nsig);
+
+  for (int t=0; t<nsig; t++)
+    for (int s=0; s<nsig; s++)
+      dmSub[s + t*nsig] = pdm[leaf.aoIndex[s] + leaf.aoIndex[t]*nao];
+
+  cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
+              npts, nsig, nsig, 1.0, &leaf.vals[0], npts, &dmSub[0], nsig, 0.0,
+              &intermediate[0], npts);
+
+  for (int t=0; t<nsig; t++)
+    for (int g=0; g<npts; g++)
+      rho[g] += intermediate[t*npts + g] * leaf.vals[t*npts + g];
+}
+
+void leafDensity(LeafAoBlock<complex<double>>& leaf, const complex<double>* pdm, int nao, int nk,
+                 vector<complex<double>>& dmSub, vector<complex<double>>& intermediate, double* rho) {
+  int npts = leaf.npts, nsig = leaf.aoIndex.size();
+  if (nsig == 0) return;
+  if (dmSub.size() < nsig*nsig) dmSub.resize(nsig*nsig);
+  if (intermediate.size() < npts*nsig) intermediate.resize(npts*nsig);
+
+  complex<double> alpha = 1.0, beta = 0.0;
+  for (int k=0; k<nk; k++) {
+    const complex<double>* dmk = pdm + (size_t)k*nao*nao;
+    const complex<double>* ao = &leaf.vals[(size_t)k*nsig*npts];
+    for (int t=0; t<nsig; t++)
+      for (int s=0; s<nsig; s++)
+        dmSub[s + t*nsig] = dmk[leaf.aoIndex[s] + leaf.aoIndex[t]*nao];
+
+    cblas_zgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
+                npts, nsig, nsig, &alpha, ao, npts, &dmSub[0], nsig, &beta,
+                &intermediate[0], npts);
+
+    for (int t=0; t<nsig; t++)
+      for (int g=0; g<npts; g++)
+        rho[g] += (intermediate[t*npts + g] * std::conj(ao[t*npts + g])).real();
+  }
+}
+
+//density on all the points of the leaves, the leaves are independent and
+//are done in parallel
+template<typename T>
+void getDensityOnLeaves(vector<double>& density, vector<LeafAoBlock<T>>& leaves,
+                        const T* pdm, int nk) {
+  int nao = ao_loc[shls[1]] - ao_loc[shls[0]];
+  size_t ngrid = leaves.size() * leaves[0].npts;
+  if (density.size() < ngrid) density.resize(ngrid, 0.0);
+  std::fill(&density[0], &density[0]+ngrid, 0.0);
+
+#pragma omp parallel
+  {
+    vector<T> dmSub, intermediate;
+#pragma omp for schedule(dynamic)
+    for (int i=0; i<leaves.size(); i++)
+      leafDensity(leaves[i], pdm, nao, nk, dmSub, intermediate, &density[(size_t)i*leaves[i].npts]);
+  }
+}
+
+//fockSub = A^H W for the npts x nsig blocks A and W = v A of one leaf
+void leafFock(int npts, int nsig, const double* ao, const double* weighted, double* fockSub) {
+  cblas_dgemm(CblasColMajor, CblasTrans, CblasNoTrans,
+              nsig, nsig, npts, 1.0, ao, npts, weighted, npts, 0.0,
+              fockSub, nsig);
+}
+
+void leafFock(int npts, int nsig, const complex<double>* ao, const complex<double>* weighted,
+              complex<double>* fockSub) {
+  complex<double> alpha = 1.0, beta = 0.0;
+  cblas_zgemm(CblasColMajor, CblasConjTrans, CblasNoTrans,
+              nsig, nsig, npts, &alpha, ao, npts, weighted, npts, &beta,
+              fockSub, nsig);
+}
+
+//F_k(p,q) = sum_g A*_k(g,p) v(g) A_k(g,q), where v already includes the
+//quadrature weights. Every thread accumulates the leaves it does in its own
+//copy of the fock matrix and these are added at the end
+template<typename T>
+void getFockOnLeaves(const vector<double>& potential, vector<LeafAoBlock<T>>& leaves,
+                     T* fock, int nk) {
+  int nao = ao_loc[shls[1]] - ao_loc[shls[0]];
+  size_t fockSize = (size_t)nk*nao*nao;
+  std::fill(fock, fock+fockSize, T(0.0));
+
+#pragma omp parallel
+  {
+    vector<T> fockLocal(fockSize, T(0.0)), weighted, fockSub;
+#pragma omp for schedule(dynamic)
+    for (int i=0; i<leaves.size(); i++) {
+      LeafAoBlock<T>& leaf = leaves[i];
+      int npts = leaf.npts, nsig = leaf.aoIndex.size();
+      if (nsig == 0) continue;
+      const double* v = &potential[(size_t)i*npts];
+      if (weighted.size() < npts*nsig) weighted.resize(npts*nsig);
+      if (fockSub.size() < nsig*nsig) fockSub.resize(nsig*nsig);
+
+      for (int k=0; k<nk; k++) {
+        const T* ao = &leaf.vals[(size_t)k*nsig*npts];
+        for (int t=0; t<nsig; t++)
+          for (int g=0; g<npts; g++)
+            weighted[t*npts + g] = ao[t*npts + g] * v[g];
+
+        leafFock(npts, nsig, ao, &weighted[0], &fockSub[0]);
+
+        T* fockk = &fockLocal[(size_t)k*nao*nao];
+        for (int t=0; t<nsig; t++)
+          for (int s=0; s<nsig; s++)
+            fockk[leaf.aoIndex[s] + leaf.aoIndex[t]*nao] += fockSub[s + t*nsig];
+      }
+    }
+
+#pragma omp critical (fmmFockReduce)
+    for (size_t i=0; i<fockSize; i++)
+      fock[i] += fockLocal[i];
+  }
+}
+
 void initFMMGridAndTree(double* pdm, double* pcentroid, double pscale, double tol,
                         double eta, int Periodic) {
   
@@ -152,7 +398,7 @@ void initFMMGridAndTree(double* pdm, double* pcentroid, double pscale, double to
 
 
   //auto getDensity = getValuesAtGrid;
-  auto getDensity  = Periodic == 0 ? getValuesAtGrid : getValuesAtGridPeriodic;
+  auto getDensity  = Periodic == 0 ? getValuesAtGridLocal : getValuesAtGridPeriodicSerial;
   
   time_t Initcurrent_time, current_time;
   Initcurrent_time = time(NULL);
@@ -164,9 +410,6 @@ void initFMMGridAndTree(double* pdm, double* pcentroid, double pscale, double to
       pvfmm::LaplaceKernel<double>::potential() :
       pvfmm::ShortRangeCoulomb<double,1>::potential();
   
-  int nt = omp_get_max_threads();
-  omp_set_num_threads(1);
-  
   vector<double> dummy(3,0.0);
   tree=ChebFMM_CreateTree(cheb_deg, kernel_fn.ker_dim[0],
                           getDensity,
@@ -177,31 +420,28 @@ void initFMMGridAndTree(double* pdm, double* pcentroid, double pscale, double to
   cout << "time to make tree "<<current_time - Initcurrent_time<<endl;
   
   int leafNodes = printTreeStats();  
-  omp_set_num_threads(nt);
 
   
   populateLegendreCoordinates(leafNodes);
   populateChebyshevCoordinates(leafNodes, cheb_deg);
 
-  //calculate the ao values at the legendre coordinates
+  //calculate the ao values at the legendre and chebyshev coordinates of
+  //each leaf and keep only the ones that are significant on the leaf
+  int nLeg = LegCoord.size()/3/leafNodes, nCheb = ChebCoord.size()/3/leafNodes;
   if (Periodic) {
-    AoValsAtLegCoordComplex.resize(LegCoord.size() * nao/3 * nkpts, 0.0);
-    getAoValuesAtGridPeriodic(&LegCoord[0], LegCoord.size()/3, &AoValsAtLegCoordComplex[0]);
+    storeAoValuesOnLeaves(LegCoord, nLeg, AoValsAtLegLeavesComplex);
 
     current_time = time(NULL);
     cout << "legendre coordinates "<<current_time - Initcurrent_time<<"  "<<LegCoord.size()/3<<endl;
 
-    AoValsAtChebCoordComplex.resize(ChebCoord.size() * nao/3 * nkpts, 0.0);
-    getAoValuesAtGridPeriodic(&ChebCoord[0], ChebCoord.size()/3, &AoValsAtChebCoordComplex[0]);
+    storeAoValuesOnLeaves(ChebCoord, nCheb, AoValsAtChebLeavesComplex);
 
     current_time = time(NULL);
     cout << "chebyshev coordinates "<<current_time - Initcurrent_time<<"  "<<ChebCoord.size()/3<<endl;
   }
   else {
-    AoValsAtLegCoord.resize(LegCoord.size() * nao/3, 0.0);
-    getAoValuesAtGrid(&LegCoord[0], LegCoord.size()/3, &AoValsAtLegCoord[0]);
-    AoValsAtChebCoord.resize(ChebCoord.size() * nao/3, 0.0);
-    getAoValuesAtGrid(&ChebCoord[0], ChebCoord.size()/3, &AoValsAtChebCoord[0]);
+    storeAoValuesOnLeaves(LegCoord, nLeg, AoValsAtLegLeaves);
+    storeAoValuesOnLeaves(ChebCoord, nCheb, AoValsAtChebLeaves);
   }
   cout << "calculated density"<<endl;
   
@@ -215,12 +455,15 @@ void getFockFMMPeriodic(double* pdm, complex<double>* fock, double tol) {
     dmComplex[i] = pdm[i];
 
 
-  getDensity(density, AoValsAtLegCoordComplex);
+  getDensityOnLeaves(density, AoValsAtLegLeavesComplex, &dmComplex[0], nkpts);
   vector<double> potential(density.size(), 0.0);
   getElectronicFFTPeriodic(&LegCoord[0], &LegWts[0], LegWts.size(), &density[0], &potential[0],
                            RLattice, 0.0, 80, 80, 80, tol);
 
-  getFock(potential, AoValsAtLegCoordComplex, fock);
+  vector<double> weightedPotential(LegWts.size());
+  for (int g = 0; g<LegWts.size(); g++)
+    weightedPotential[g] = potential[g] * LegWts[g];
+  getFockOnLeaves(weightedPotential, AoValsAtLegLeavesComplex, fock, nkpts);
   
   getElectronicFFTPeriodicUniform(RLattice, potential, 0.0, 100, 100, 100);
   
@@ -237,37 +480,18 @@ void getFockFMMPeriodic(double* pdm, complex<double>* fock, double tol) {
   //construct the density from density matrix and ao values stored on chebyshev grid
   int cheb_deg = 10, mult_order = 10;
 
-  {
-    int ngrid = ChebCoord.size()/3;
-    if (intermediateComplex.size() < nao*ngrid) {
-      intermediateComplex.resize(nao*ngrid, 0.0);
-    }
-
-    complex<double> alpha = 1.0, beta = 0.0;
-    cblas_zgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                ngrid, nao, nao, &alpha, &AoValsAtChebCoordComplex[0], ngrid, &dmComplex[0], nao,&beta,
-                &intermediateComplex[0], ngrid);
-    
-    if (density.size() < ngrid) density.resize(ngrid, 0.0);
-    std::fill(&density[0], &density[0]+ngrid, 0.0);
-    
-    for (int p = 0; p<nao; p++)
-      for (int g = 0; g<ngrid; g++)
-        density[g] += (intermediateComplex[p*ngrid + g] * std::conj(AoValsAtChebCoordComplex[p*ngrid + g])).real();
-
-  }
+  getDensityOnLeaves(density, AoValsAtChebLeavesComplex, &dmComplex[0], nkpts);
 
 
   //use the density on the chebyshev grid points to fit the
   //chebyshev polynomials of the leaf nodes
-  int index = 0, nCheb = (cheb_deg+1)*(cheb_deg+1)*(cheb_deg+1);;
-  auto nodes = tree->GetNodeList();
-  for (int i=0; i<nodes.size(); i++)
-    if (nodes[i]->IsLeaf()) {
-      nodes[i]->ChebData().SetZero();
-      pvfmm::cheb_approx<double,double>(&density[nCheb*index], cheb_deg, nodes[i]->DataDOF(), &(nodes[i]->ChebData()[0]));
-      index++;
-    }
+  int nCheb = (cheb_deg+1)*(cheb_deg+1)*(cheb_deg+1);
+  auto leaves = getLeafNodes();
+#pragma omp parallel for schedule(dynamic)
+  for (int i=0; i<leaves.size(); i++) {
+    leaves[i]->ChebData().SetZero();
+    pvfmm::cheb_approx<double,double>(&density[nCheb*i], cheb_deg, leaves[i]->DataDOF(), &(leaves[i]->ChebData()[0]));
+  }
 
   pvfmm::ChebFMM<double> matrices;
   matrices.Initialize(mult_order, cheb_deg, comm, &kernel_fn);
@@ -279,24 +503,11 @@ void getFockFMMPeriodic(double* pdm, complex<double>* fock, double tol) {
   //construct the fock matrix using potential and AOvals on the legendre grid
   {
     int ngrid = LegCoord.size()/3;
-    if (intermediateComplex.size() < nao*ngrid) 
-      intermediateComplex.resize(nao*ngrid, 0.0);
-
-    vector<complex<double>>& aovals = AoValsAtLegCoordComplex;
-
-    cout << "before intermediate"<<endl;
-    cout << aovals.size()<<"  "<<trg_value.size()<<"  "<<LegWts.size()<<"  "<<nao<<"  "<<ngrid<<endl;
     double scale = pow(coordScale, 5);
-    for (int p = 0; p<nao; p++)
     for (int g = 0; g<ngrid; g++)
-      intermediateComplex[p*ngrid + g] =  aovals[p*ngrid + g] * trg_value[g] * LegWts[g] * scale * 4 * M_PI;
-
-    cout << "before zgemm"<<endl;
-    complex<double> alpha = 1.0, beta = 0.0;
-    cblas_zgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-                nao, nao, ngrid, &alpha, &intermediateComplex[0], ngrid, &aovals[0], ngrid, &beta,
-                &fock[0], nao);
-    cout << "after zgemm"<<endl;
+      trg_value[g] *= LegWts[g] * scale * 4 * M_PI;
+
+    getFockOnLeaves(trg_value, AoValsAtLegLeavesComplex, fock, nkpts);
   }
   
   return;
@@ -315,37 +526,18 @@ void getFockFMM(double* pdm, double* fock, double tol) {
   int cheb_deg = 10, mult_order = 10;
   int nao = ao_loc[shls[1]] - ao_loc[shls[0]];
 
-  {
-    int ngrid = ChebCoord.size()/3;
-    if (intermediate.size() < nao*ngrid) {
-      intermediate.resize(nao*ngrid, 0.0);
-    }
-
-    double alpha = 1.0, beta = 0.0;
-    cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans,
-                ngrid, nao, nao, alpha, &AoValsAtChebCoord[0], ngrid, &pdm[0], nao, beta,
-                &intermediate[0], ngrid);
-    
-    if (density.size() < ngrid) density.resize(ngrid, 0.0);
-    std::fill(&density[0], &density[0]+ngrid, 0.0);
-    
-    for (int p = 0; p<nao; p++)
-      for (int g = 0; g<ngrid; g++)
-        density[g] += intermediate[p*ngrid + g] * AoValsAtChebCoord[p*ngrid + g];
-
-  }
+  getDensityOnLeaves(density, AoValsAtChebLeaves, pdm, 1);
 
 
   //use the density on the chebyshev grid points to fit the
   //chebyshev polynomials of the leaf nodes
-  int index = 0, nCheb = (cheb_deg+1)*(cheb_deg+1)*(cheb_deg+1);;
-  auto nodes = tree->GetNodeList();
-  for (int i=0; i<nodes.size(); i++)
-    if (nodes[i]->IsLeaf()) {
-      nodes[i]->ChebData().SetZero();
-      pvfmm::cheb_approx<double,double>(&density[nCheb*index], cheb_deg, nodes[i]->DataDOF(), &(nodes[i]->ChebData()[0]));
-      index++;
-    }
+  int nCheb = (cheb_deg+1)*(cheb_deg+1)*(cheb_deg+1);
+  auto leaves = getLeafNodes();
+#pragma omp parallel for schedule(dynamic)
+  for (int i=0; i<leaves.size(); i++) {
+    leaves[i]->ChebData().SetZero();
+    pvfmm::cheb_approx<double,double>(&density[nCheb*i], cheb_deg, leaves[i]->DataDOF(), &(leaves[i]->ChebData()[0]));
+  }
 
   pvfmm::ChebFMM<double> matrices;
   matrices.Initialize(mult_order, cheb_deg, comm, &kernel_fn);
@@ -357,21 +549,11 @@ void getFockFMM(double* pdm, double* fock, double tol) {
   //construct the fock matrix using potential and AOvals on the legendre grid
   {
     int ngrid = LegCoord.size()/3;
-    if (intermediate.size() < nao*ngrid) 
-      intermediate.resize(nao*ngrid, 0.0);
-
-    vector<double>& aovals = AoValsAtLegCoord;
-
     double scale = pow(coordScale, 5);
-    for (int p = 0; p<nao; p++)
     for (int g = 0; g<ngrid; g++)
-      intermediate[p*ngrid + g] =  aovals[p*ngrid + g] * trg_value[g] * LegWts[g] * scale * 4 * M_PI;
-
-    double alpha = 1.0, beta = 0.0;
-    cblas_dgemm(CblasColMajor, CblasTrans, CblasNoTrans,
-                nao, nao, ngrid, alpha, &intermediate[0], ngrid, &aovals[0], ngrid, beta,
-                &fock[0], nao);
+      trg_value[g] *= LegWts[g] * scale * 4 * M_PI;
 
+    getFockOnLeaves(trg_value, AoValsAtLegLeaves, fock, 1);
   }
   
   return;
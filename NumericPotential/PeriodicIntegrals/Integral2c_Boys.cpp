@@ -5,6 +5,7 @@
 #include <string.h>
 #include <algorithm>
 #include <numeric> 
+#include <limits>
 #include <complex>
 #include "boost/format.hpp"
 
@@ -25,12 +26,15 @@ using namespace boost;
 
 
 // output: contracted kernels Fm(rho,T), format: (TotalL+1) x nCoA x nCoC
+// pCutoffT (optional, nFnA x nFnC) holds the distance^2 beyond which a
+// primitive pair is known to be screened; it is updated as pairs drop out.
 void Int2e2c_EvalCoKernels(double *pCoFmT, uint TotalL,
                            BasisShell *pA, BasisShell *pC,
                            double Tx, double Ty, double Tz,
                            double PrefactorExt, double* pInv2Alpha, double* pInv2Gamma,
                            Kernel* kernel,
-                           LatticeSum& latsum, ct::FMemoryStack &Mem)
+                           LatticeSum& latsum, ct::FMemoryStack &Mem,
+                           double *pCutoffT)
 {  
   double t = Tx*Tx + Ty*Ty + Tz*Tz;
   double *pFmT;
@@ -48,6 +52,9 @@ void Int2e2c_EvalCoKernels(double *pCoFmT, uint TotalL,
 
       for (uint iExpA = 0; iExpA < pA->nFn; ++ iExpA)
       {
+        double *pCutoff = pCutoffT ? &pCutoffT[iExpA + pA->nFn*iExpC] : 0;
+        if (pCutoff && t >= *pCutoff) continue;
+
         double maxContracA = 0.0;
         for (uint iCoA = 0; iCoA < pA->nCo; ++ iCoA) 
           maxContracA = max(maxContracA, fabs(pA->contractions(iExpA, iCoA)));
@@ -86,7 +93,12 @@ void Int2e2c_EvalCoKernels(double *pCoFmT, uint TotalL,
             if (maxVal < abs(pFmT[i])) maxVal = abs(pFmT[i]);
           }
           
-          if (polynomial*maxVal*maxContracA*maxContracC < latsum.Rscreen) continue;
+          if (polynomial*maxVal*maxContracA*maxContracC < latsum.Rscreen) {
+            //past the maximum of t^((L+1)/2) exp(-eta^2 rho t) the bound only
+            //decreases, so the pair stays screened at all larger distances
+            if (pCutoff && 2*eta*eta*Rho*t >= TotalL+1) *pCutoff = t;
+            continue;
+          }
           
           // contract (lamely). However, normally either nCo
           // or nFn, or TotalL (or even all of them at the same time)
@@ -128,6 +140,12 @@ void makeRealSummation(double *&pOutR, unsigned &TotalCo, BasisShell *pA, BasisS
   double sign = T1 >= T2 ? 1. : -1.; 
   vector<size_t>& Tidx = latsum.ROrderedIdx[T];
 
+  //cutoff radii of the primitive pairs, filled in as the sum moves outwards
+  double *pCutoffT;
+  Mem.Alloc(pCutoffT, pA->nFn * pC->nFn);
+  for (uint i = 0; i < pA->nFn * pC->nFn; i++)
+    pCutoffT[i] = std::numeric_limits<double>::max();
+
   for (int r = 0; r<latsum.Rdist.size(); r++) {
 
     double Tx_r = Tx + sign*latsum.Rcoord[3*Tidx[r]+0],
@@ -136,7 +154,7 @@ void makeRealSummation(double *&pOutR, unsigned &TotalCo, BasisShell *pA, BasisS
 
     Mem.ClearAlloc(pCoFmT, (L+1) * TotalCo);
     Int2e2c_EvalCoKernels(pCoFmT, L, pA, pC, Tx_r, Ty_r, Tz_r, Prefactor,
-                          pInv2Alpha, pInv2Gamma, kernel, latsum, Mem);
+                          pInv2Alpha, pInv2Gamma, kernel, latsum, Mem, pCutoffT);
 
 
     //go from [0]^m -> [r]^0 using mcmurchie-davidson
@@ -168,6 +186,7 @@ void makeRealSummation(double *&pOutR, unsigned &TotalCo, BasisShell *pA, BasisS
       break;
     }
   }
+  Mem.Free(pCutoffT);
 }
 
 void makeReciprocalSummation(double *&pOutR, unsigned &TotalCo, BasisShell *pA, BasisShell *pC, double Tx, double Ty, double Tz, double Prefactor,   unsigned TotalLab, double* pInv2Alpha, double* pInv2Gamma, Kernel* kernel, LatticeSum& latsum, ct::FMemoryStack& Mem)
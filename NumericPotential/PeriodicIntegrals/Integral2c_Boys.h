@@ -19,7 +19,8 @@ void Int2e2c_EvalCoKernels(double *pCoFmT, uint TotalL,
                            double Tx, double Ty, double Tz,
                            double PrefactorExt, double* pInv2Alpha, double* pInv2Gamma,
                            Kernel* kernel,
-                           LatticeSum& latsum, ct::FMemoryStack &Mem);
+                           LatticeSum& latsum, ct::FMemoryStack &Mem,
+                           double *pCutoffT = 0);
 
 void Int2e2c_EvalCoShY(double *&pOutR, double *&pOutK, unsigned &TotalCo, BasisShell *pA,
                        BasisShell *pC, double Tx, double Ty, double Tz,
@@ -19,6 +19,10 @@
 #include "CxAlgebra.h"
 #include "timer.h"
 
+#ifndef SERIAL
+#include "mpi.h"
+#endif
+
 using namespace std;
 using namespace std::chrono;
 using namespace ir;
@@ -167,12 +171,23 @@ void EvalInt2e3c(double *pOut, size_t *Strides,
    vector<double>& KLattice = latsum.KLattice;
    vector<double>& RLattice = latsum.RLattice;
 
+   //the most diffuse AB product sets the cutoff radius of the shell pair,
+   //beyond it every primitive pair fails the overlap screen below
+   double ExpMin = -1.;
+   for (uint iExpB = 0; iExpB < pB->nFn; ++ iExpB)
+   for (uint iExpA = 0; iExpA < pA->nFn; ++ iExpA) {
+     double a = pA->exponents[iExpA], b = pB->exponents[iExpB];
+     if (a + b <= Eta2Rho) continue;
+     if (ExpMin < 0 || a*b/(a+b) < ExpMin) ExpMin = a*b/(a+b);
+   }
+
    int nQ = latsum.Rdist.size();
    for (int Q = 0; Q<nQ; Q++) {
      double Ax = Ax0 + latsum.Rcoord[3*Tidx[Q]+0];
      double Ay = Ay0 + latsum.Rcoord[3*Tidx[Q]+1];
      double Az = Az0 + latsum.Rcoord[3*Tidx[Q]+2];
      Tx = Ax-Bx; Ty = Ay-By; Tz = Az-Bz;
+     if (ExpMin < 0 || -ExpMin*(Tx*Tx+Ty*Ty+Tz*Tz) < logscreen) continue;
 
      bool FoundNonZero = false;
      
@@ -435,7 +450,15 @@ void PopulatePairGMatrixKspace(double* pOutCos, double* pOutSin,
       pReciprocalSumSin[i] = 0.0;
     }
 
-    for (int f=0; f<latsum.Kdist.size(); f++) {
+    //expArgF = -|F + b/(a+b) G|^2/(4 alpha) and F = F0 + K_f, so only the K_f
+    //within |F0 + b/(a+b) G| + sqrt(4 alpha (expArgG - logscreen)) of the
+    //origin can pass the screen; Kdist is sorted so the rest are skipped
+    double dx = Fx0 + b/(a+b)*Gx, dy = Fy0 + b/(a+b)*Gy, dz = Fz0 + b/(a+b)*Gz;
+    double Kcut = sqrt(dx*dx + dy*dy + dz*dz) + sqrt(4*alpha*(expArgG - logscreen));
+    int nF = std::upper_bound(latsum.Kdist.begin(), latsum.Kdist.end(),
+                              Kcut*Kcut*(1.+1.e-12)) - latsum.Kdist.begin();
+
+    for (int f=0; f<nF; f++) {
       double Fx=Fx0+latsum.Kcoord[3*f+0],
 	Fy=Fy0+latsum.Kcoord[3*f+1],
 	Fz=Fz0+latsum.Kcoord[3*f+2];
@@ -752,6 +775,65 @@ void premakeHighRhoIntegrals(double* preMadeIntegrals,  double* OrbPairGMatrixco
 
 }
 
+static void GetRankAndSize(int& rank, int& size) {
+  rank = 0; size = 1;
+#ifndef SERIAL
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+#endif
+}
+
+//a shell pair (A,B) with B <= A, the offsets of its block in the output
+//and an estimate of the work needed for it
+struct FShellPair {
+  int shla, shlb;
+  size_t aoffset, boffset;
+  double cost;
+};
+
+//Makes the shell pairs this rank is responsible for, most expensive first.
+//The pairs are dealt out in order of decreasing cost, each one to the rank
+//with the least work so far, so all ranks end up with about the same load.
+static void MakeShellPairs(vector<FShellPair>& pairs, vector<int>& shls, BasisSet& basis) {
+  int rank, size;
+  GetRankAndSize(rank, size);
+
+  vector<FShellPair> allPairs;
+  size_t aoffset = 0;
+  for (int shla = shls[0]; shla < shls[1]; shla++) {
+    BasisShell *pA = &basis.BasisShells[shla];
+    size_t boffset = 0;
+    for (int shlb = shls[2]; shlb <= shla && shlb < shls[3]; shlb++) {
+      BasisShell *pB = &basis.BasisShells[shlb];
+      //the lattice sums are done for each pair of primitives and angular components
+      FShellPair pair = {shla, shlb, aoffset, boffset,
+                         double(pA->nFn * pB->nFn * (2*pA->l+1) * (2*pB->l+1))};
+      allPairs.push_back(pair);
+      boffset += pB->numFuns();
+    }
+    aoffset += pA->numFuns();
+  }
+  std::stable_sort(allPairs.begin(), allPairs.end(),
+                   [](const FShellPair& x, const FShellPair& y) { return x.cost > y.cost; });
+
+  vector<double> load(size, 0.);
+  pairs.clear();
+  for (size_t i = 0; i < allPairs.size(); i++) {
+    int owner = std::min_element(load.begin(), load.end()) - load.begin();
+    load[owner] += allPairs[i].cost;
+    if (owner == rank) pairs.push_back(allPairs[i]);
+  }
+}
+
+void SumOverRanks(double *pData, size_t n) {
+#ifndef SERIAL
+  size_t chunk = size_t(1) << 27;
+  for (size_t i = 0; i < n; i += chunk)
+    MPI_Allreduce(MPI_IN_PLACE, pData + i, int(std::min(chunk, n - i)),
+                  MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+}
+
 void ThreeCenterIntegrals(std::vector<int>& shls, BasisSet& basis, std::vector<double>& Lattice, ct::FMemoryStack2& Mem) {
 
   //10 along R and G directions
@@ -775,6 +857,11 @@ void ThreeCenterIntegrals(std::vector<int>& shls, BasisSet& basis, std::vector<d
   cout <<"after k "<< Integral3c[0]<<endl;
   Int2e3cRR(&Integral3c[0], shls, basis, latsum, Mem);
   cout <<"after r "<< Integral3c[0]<<endl;
+  SumOverRanks(&Integral3c[0], Integral3c.size());
+
+  int rank, size;
+  GetRankAndSize(rank, size);
+  if (rank != 0) return;
 
   vector<double> test(nbas*(nbas+1)/2*nAuxbas);
   for (int k=0; k<nAuxbas; k++)
@@ -788,130 +875,140 @@ void ThreeCenterIntegrals(std::vector<int>& shls, BasisSet& basis, std::vector<d
   file.close();
 }
 
-void Int2e3cRK(double *pOut, vector<int>& shls, BasisSet& basis, LatticeSum& latsum,
-	       ct::FMemoryStack2 &Mem) {
-
+//the reciprocal space part of the integrals of one shell pair with all auxiliary shells
+static void Int2e3cRKPair(double *pOut, const FShellPair& pair, size_t nbas, int maxAuxShell,
+                          vector<int>& shls, BasisSet& basis, LatticeSum& latsum,
+                          ct::FMemoryStack2 &Mem) {
   int nG = latsum.Kcoord.size();
+  int aoffset = pair.aoffset, boffset = pair.boffset;
 
-  size_t nAuxbas = basis.getNbas(shls[5]) - basis.getNbas(shls[4]);
-  size_t nbas = basis.getNbas(shls[1]) - basis.getNbas(shls[0]);
-
-  int maxAuxShell = 0;
-  for (int shlc =shls[4]; shlc < shls[5]; shlc++) {
-    int nfn = basis.BasisShells[shlc].numFuns();
-    if (maxAuxShell < nfn)
-      maxAuxShell = nfn;
-  }
-  
-  auto start = high_resolution_clock::now();
+  BasisShell *pA = &basis.BasisShells[pair.shla];
+  int la = pA->l;
+  int ntermsa = (2*la+1);
 
-  //loop over basis shells
-  int aoffset = 0;
-  for (int shla = shls[0]; shla < shls[1]; shla++) {
-    BasisShell *pA = &basis.BasisShells[shla];
-    int la = pA->l;
-    int ntermsa = (2*la+1);
-  
-    int boffset = 0;
-    for (int shlb = shls[2]; shlb <= shla; shlb++) {
-      BasisShell *pB = &basis.BasisShells[shlb];    
+  BasisShell *pB = &basis.BasisShells[pair.shlb];    
       
-      int lb = pB->l;
-      int ntermsb = (2*lb+1), ntermsab = (2*la+1)*(2*lb+1);
-      double* OrbPairGMatrixCos; Mem.Alloc(OrbPairGMatrixCos, nG*ntermsab);
-      double* OrbPairGMatrixSin; Mem.Alloc(OrbPairGMatrixSin, nG*ntermsab);
-
-      size_t worklen = maxAuxShell*(2*la+1)*(2*lb+1);
-      double* KspaceSum; Mem.ClearAlloc(KspaceSum, worklen);
-      double* RspaceSum; Mem.ClearAlloc(RspaceSum, worklen);
-
-      //cout << worklen<<endl;
-      //loop over individual basis functions
-      for (uint iExpA = 0; iExpA < pA->nFn; ++ iExpA) 
-      for (uint iExpB = 0; iExpB < pB->nFn; ++ iExpB) {
-	double a = pA->exponents[iExpA], b = pB->exponents[iExpB];
+  int lb = pB->l;
+  int ntermsb = (2*lb+1), ntermsab = (2*la+1)*(2*lb+1);
+  double* OrbPairGMatrixCos; Mem.Alloc(OrbPairGMatrixCos, nG*ntermsab);
+  double* OrbPairGMatrixSin; Mem.Alloc(OrbPairGMatrixSin, nG*ntermsab);
+
+  size_t worklen = maxAuxShell*(2*la+1)*(2*lb+1);
+  double* KspaceSum; Mem.ClearAlloc(KspaceSum, worklen);
+  double* RspaceSum; Mem.ClearAlloc(RspaceSum, worklen);
+
+  //cout << worklen<<endl;
+  //loop over individual basis functions
+  for (uint iExpA = 0; iExpA < pA->nFn; ++ iExpA) 
+  for (uint iExpB = 0; iExpB < pB->nFn; ++ iExpB) {
+    double a = pA->exponents[iExpA], b = pB->exponents[iExpB];
 	
         
-	for (int g=0; g<nG*ntermsab; g++){
-	  OrbPairGMatrixCos[g] = 0.0;
-	  OrbPairGMatrixSin[g] = 0.0;
-	}
+    for (int g=0; g<nG*ntermsab; g++){
+      OrbPairGMatrixCos[g] = 0.0;
+      OrbPairGMatrixSin[g] = 0.0;
+    }
 	
-	double alpha = a*b/(a+b);
-	if (alpha < latsum.Eta2RhoOvlp) {
-	  PopulatePairGMatrixKspace(OrbPairGMatrixCos, OrbPairGMatrixSin,
-				    pA, pB, iExpA, iExpB, latsum, Mem);
-	}
-	else {
-	  PopulatePairGMatrixRspace(OrbPairGMatrixCos, OrbPairGMatrixSin,
-				    pA, pB, iExpA, iExpB, latsum, Mem);
-	}
-
-        double *preMadeIntegrals;
-        int natom = latsum.atomCenters.size()/3;
-        Mem.ClearAlloc(preMadeIntegrals , ntermsab*49*natom);
-        premakeHighRhoIntegrals(preMadeIntegrals, OrbPairGMatrixCos, OrbPairGMatrixSin,
-                                pA, pB, iExpA, iExpB, latsum, Mem, basis, shls);
+    double alpha = a*b/(a+b);
+    if (alpha < latsum.Eta2RhoOvlp) {
+      PopulatePairGMatrixKspace(OrbPairGMatrixCos, OrbPairGMatrixSin,
+                                pA, pB, iExpA, iExpB, latsum, Mem);
+    }
+    else {
+      PopulatePairGMatrixRspace(OrbPairGMatrixCos, OrbPairGMatrixSin,
+                                pA, pB, iExpA, iExpB, latsum, Mem);
+    }
+
+    double *preMadeIntegrals;
+    int natom = latsum.atomCenters.size()/3;
+    Mem.ClearAlloc(preMadeIntegrals , ntermsab*49*natom);
+    premakeHighRhoIntegrals(preMadeIntegrals, OrbPairGMatrixCos, OrbPairGMatrixSin,
+                            pA, pB, iExpA, iExpB, latsum, Mem, basis, shls);
         
-	int coffset = 0;
-	for (int shlc = shls[4]; shlc <shls[5]; shlc++) {
+    int coffset = 0;
+    for (int shlc = shls[4]; shlc <shls[5]; shlc++) {
 
-	  BasisShell *pC = & basis.BasisShells[shlc];
-	  size_t worklen = pC->numFuns()*(2*la+1)*(2*lb+1);
-	  for (int i=0; i<worklen; i++) KspaceSum[i] = 0.;
+      BasisShell *pC = & basis.BasisShells[shlc];
+      size_t worklen = pC->numFuns()*(2*la+1)*(2*lb+1);
+      for (int i=0; i<worklen; i++) KspaceSum[i] = 0.;
 	  	  
-	  contractCoulombKernel(KspaceSum, OrbPairGMatrixCos,
-				OrbPairGMatrixSin, preMadeIntegrals,
-				latsum, pA, pB, iExpA, iExpB,
-				pC, coffset, Mem);
+      contractCoulombKernel(KspaceSum, OrbPairGMatrixCos,
+                            OrbPairGMatrixSin, preMadeIntegrals,
+                            latsum, pA, pB, iExpA, iExpB,
+                            pC, coffset, Mem);
 
-	  int bstride = nbas     , bstrideInter = pA->numFuns();
-	  int cstride = nbas*nbas, cstrideInter = bstrideInter * (2*lb+1);
+      int bstride = nbas     , bstrideInter = pA->numFuns();
+      int cstride = nbas*nbas, cstrideInter = bstrideInter * (2*lb+1);
 
 	  
-	  double* Inter1;
-	  Mem.ClearAlloc(Inter1, pA->numFuns() * (2*lb+1) * pC->numFuns());
+      double* Inter1;
+      Mem.ClearAlloc(Inter1, pA->numFuns() * (2*lb+1) * pC->numFuns());
 	  
-	  int ntermsbc = (2*lb+1)*pC->numFuns();
-	  for (int bc = 0; bc<ntermsbc; bc++)
-	  for (int iCoA = 0; iCoA < pA->nCo; iCoA++) {
-	    double CoA = pA->contractions(iExpA, iCoA);
-	    for (int a = 0; a<ntermsa; a++)
-	      Inter1[iCoA*ntermsa+a + bc * bstrideInter] +=
-		CoA * KspaceSum[a + bc * ntermsa];
-	  }
+      int ntermsbc = (2*lb+1)*pC->numFuns();
+      for (int bc = 0; bc<ntermsbc; bc++)
+      for (int iCoA = 0; iCoA < pA->nCo; iCoA++) {
+        double CoA = pA->contractions(iExpA, iCoA);
+        for (int a = 0; a<ntermsa; a++)
+          Inter1[iCoA*ntermsa+a + bc * bstrideInter] +=
+              CoA * KspaceSum[a + bc * ntermsa];
+      }
 
-	  //cout << pA->numFuns()*(2*lb+1)*pC->numFuns()<<"  Inter size"<<endl;
-	  for (int iCoB = 0; iCoB < pB->nCo; iCoB++) {
-	    double CoB = pB->contractions(iExpB, iCoB);
-	    for (int b = 0; b<ntermsb ; b++) 
-	      for (int ic = 0; ic < pC->numFuns(); ic++) {
-		for (int ia = 0; ia < pA->numFuns(); ia++) {
-		  pOut[ ia + aoffset
-			+ (iCoB*ntermsb + b + boffset) * bstride
-			+ (ic + coffset) * cstride]
-		    += CoB * Inter1[ia + b * bstrideInter
-				    + ic * cstrideInter];
-		}
-	      }
-	  }
+      //cout << pA->numFuns()*(2*lb+1)*pC->numFuns()<<"  Inter size"<<endl;
+      for (int iCoB = 0; iCoB < pB->nCo; iCoB++) {
+        double CoB = pB->contractions(iExpB, iCoB);
+        for (int b = 0; b<ntermsb ; b++) 
+          for (int ic = 0; ic < pC->numFuns(); ic++) {
+            for (int ia = 0; ia < pA->numFuns(); ia++) {
+              pOut[ ia + aoffset
+                    + (iCoB*ntermsb + b + boffset) * bstride
+                    + (ic + coffset) * cstride]
+                  += CoB * Inter1[ia + b * bstrideInter
+                                  + ic * cstrideInter];
+            }
+          }
+      }
 
-	  //cout << "inter "<<pA->contractions(0,0)<<"  "<<pA->contractions(1,0)<<endl;
-	  //cout <<pA->contractions(iExpA,0)<<"  "<<pB->contractions(iExpB,0)<<" "<<iExpA<<"  "<<iExpB<<"  "<<shlc<<"  "<< pOut[3]<<endl;
-	  Mem.Free(Inter1);
+      //cout << "inter "<<pA->contractions(0,0)<<"  "<<pA->contractions(1,0)<<endl;
+      //cout <<pA->contractions(iExpA,0)<<"  "<<pB->contractions(iExpB,0)<<" "<<iExpA<<"  "<<iExpB<<"  "<<shlc<<"  "<< pOut[3]<<endl;
+      Mem.Free(Inter1);
 
-	  coffset += pC->numFuns();
-	}
-        Mem.Free(preMadeIntegrals);
+      coffset += pC->numFuns();
+    }
+    Mem.Free(preMadeIntegrals);
 
-      }
+  }
 
-      Mem.Free(OrbPairGMatrixCos);
-      boffset += pB->numFuns();
-    }
-    aoffset += pA->numFuns();
+  Mem.Free(OrbPairGMatrixCos);
+}
+
+//Each shell pair writes its own block of pOut, so the pairs are distributed
+//over the threads, each working on its own part of the memory stack, and
+//over the MPI ranks. With several ranks every rank only adds its own blocks
+//and the caller has to SumOverRanks.
+void Int2e3cRK(double *pOut, vector<int>& shls, BasisSet& basis, LatticeSum& latsum,
+	       ct::FMemoryStack2 &Mem) {
 
+  size_t nAuxbas = basis.getNbas(shls[5]) - basis.getNbas(shls[4]);
+  size_t nbas = basis.getNbas(shls[1]) - basis.getNbas(shls[0]);
+
+  int maxAuxShell = 0;
+  for (int shlc =shls[4]; shlc < shls[5]; shlc++) {
+    int nfn = basis.BasisShells[shlc].numFuns();
+    if (maxAuxShell < nfn)
+      maxAuxShell = nfn;
   }
+  
+  auto start = high_resolution_clock::now();
+
+  vector<FShellPair> pairs;
+  MakeShellPairs(pairs, shls, basis);
+
+  ct::FMemoryStackArray MemStacks(Mem);
+#pragma omp parallel for schedule(dynamic)
+  for (size_t i = 0; i < pairs.size(); i++)
+    Int2e3cRKPair(pOut, pairs[i], nbas, maxAuxShell, shls, basis, latsum,
+                  MemStacks.GetStackOfThread());
+  MemStacks.Release();
 
   auto stop = high_resolution_clock::now();
   auto duration = duration_cast<microseconds>(stop - start);
@@ -921,66 +1018,63 @@ void Int2e3cRK(double *pOut, vector<int>& shls, BasisSet& basis, LatticeSum& lat
 }
 
 
+//Distributed like Int2e3cRK.
 void Int2e3cRR(double *pIntFai, vector<int>& shls, BasisSet &basis, LatticeSum& latsum, ct::FMemoryStack2 &Mem)
 {
-  CoulombKernel IntKernel;
-
   auto start = high_resolution_clock::now();
 
-  void
-      *pBaseOfMemory = Mem.Alloc(0);
    size_t
        nAo1 = basis.getNbas(shls[1]) - basis.getNbas(shls[0]),
        nAo2 = basis.getNbas(shls[3]) - basis.getNbas(shls[2]),
        nFit = basis.getNbas(shls[5]) - basis.getNbas(shls[4]);
 
-
-   //double
-   //*pDF_NFi;
-   //Mem.Alloc(pDF_NFi, nAo1 * nFit * nAo2);
-   int iabas = 0, ibbas = 0, ifbas = 0;
-   for ( size_t iShF = shls[4]; iShF != shls[5]; ++ iShF ){
-      BasisShell &ShF = basis.BasisShells[iShF];
-      size_t nFnF = ShF.numFuns();
-
-      ibbas = 0;
-      for ( size_t iShB = shls[2]; iShB < shls[3]; ++ iShB ){
-         BasisShell &ShB = basis.BasisShells[iShB];
-         size_t nFnB = ShB.numFuns();
-                  
-         iabas = 0;
-         for ( size_t iShA = shls[0]; iShA < shls[1]; ++ iShA ) {
-           BasisShell &ShA = basis.BasisShells[iShA];
-           size_t nFnA = ShA.numFuns(),
-               Strides[3] = {1, nFnA, nFnA * nFnB};
-           if (iShB <= iShA) {
-             
-             double
-                 *pIntData;
-             Mem.ClearAlloc(pIntData, nFnA * nFnB * nFnF );
+   vector<FShellPair> pairs;
+   MakeShellPairs(pairs, shls, basis);
+
+   ct::FMemoryStackArray MemStacks(Mem);
+#pragma omp parallel
+   {
+   CoulombKernel IntKernel;
+   ct::FMemoryStack2 &ThreadMem = MemStacks.GetStackOfThread();
+#pragma omp for schedule(dynamic)
+   for (size_t iPair = 0; iPair < pairs.size(); ++ iPair) {
+     BasisShell &ShA = basis.BasisShells[pairs[iPair].shla];
+     BasisShell &ShB = basis.BasisShells[pairs[iPair].shlb];
+     size_t
+         nFnA = ShA.numFuns(),
+         nFnB = ShB.numFuns(),
+         iabas = pairs[iPair].aoffset,
+         ibbas = pairs[iPair].boffset,
+         ifbas = 0;
+
+     for ( size_t iShF = shls[4]; iShF != shls[5]; ++ iShF ){
+       BasisShell &ShF = basis.BasisShells[iShF];
+       size_t nFnF = ShF.numFuns(),
+           Strides[3] = {1, nFnA, nFnA * nFnB};
+
+       void
+           *pBaseOfMemory = ThreadMem.Alloc(0);
+       double
+           *pIntData;
+       ThreadMem.ClearAlloc(pIntData, nFnA * nFnB * nFnF );
              
-             EvalInt2e3c(pIntData, Strides, &ShA, &ShB, &ShF,1, 1.0, &IntKernel, latsum, Mem);
+       EvalInt2e3c(pIntData, Strides, &ShA, &ShB, &ShF,1, 1.0, &IntKernel, latsum, ThreadMem);
              
-             for ( size_t iF = 0; iF < nFnF; ++ iF )
-               for ( size_t iB = 0; iB < nFnB; ++ iB )
-                 for ( size_t iA = 0; iA < nFnA; ++ iA ) {
-                   double
-                       f = pIntData[iA + nFnA * (iB + nFnB * iF)];
-                   pIntFai[ (iabas+iA) + nAo1 * ( (ibbas+iB) + (ifbas+iF) * nAo2)] += f;
-                 }
-             //exit(0);
+       for ( size_t iF = 0; iF < nFnF; ++ iF )
+         for ( size_t iB = 0; iB < nFnB; ++ iB )
+           for ( size_t iA = 0; iA < nFnA; ++ iA ) {
+             double
+                 f = pIntData[iA + nFnA * (iB + nFnB * iF)];
+             pIntFai[ (iabas+iA) + nAo1 * ( (ibbas+iB) + (ifbas+iF) * nAo2)] += f;
            }
-           iabas += nFnA;
-         }
-         ibbas += nFnB;
-      }
-      ifbas += nFnF;
+       ThreadMem.Free(pBaseOfMemory);
+       ifbas += nFnF;
+     }
    }
-   Mem.Free(pBaseOfMemory);
+   }
+   MemStacks.Release();
 
    auto stop = high_resolution_clock::now();
    auto duration = duration_cast<microseconds>(stop - start);
    cout <<"rspace "<< duration.count()/1e6<<endl;
 }
-
-
@@ -31,7 +31,10 @@ void PopulateAuxGMatrix(double* pOut, BasisShell* pC, size_t offset,
 void PopulatePairGMatrix(double* pOut, BasisShell* pA, BasisShell* pB, 
 			 size_t nFnPair, LatticeSum& latsum, ct::FMemoryStack2 &Mem) ;
 
+//on several MPI ranks each rank adds only the blocks of its own shell pairs
 void Int2e3cRK(double *pOut, vector<int>& shls, BasisSet& basis, LatticeSum& latsum,
 	       ct::FMemoryStack2 &Mem) ;
 void Int2e3cRR(double *pIntFai, vector<int>& shls, BasisSet &basis, LatticeSum& latsum,
                ct::FMemoryStack2 &Mem);
+//sum the blocks computed on the individual ranks
+void SumOverRanks(double *pData, size_t n);
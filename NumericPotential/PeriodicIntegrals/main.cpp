@@ -15,6 +15,10 @@
 #include "timer.h"
 #include <boost/format.hpp>
 
+#ifndef SERIAL
+#include "mpi.h"
+#endif
+
 using namespace std;
 using namespace std::chrono;
 using namespace boost;
@@ -51,6 +55,9 @@ void readFile(vector<T>& vec, string fname) {
 
 
 int main(int argc, char** argv) {
+#ifndef SERIAL
+  MPI_Init(&argc, &argv);
+#endif
   cout.precision(12);
   size_t RequiredMem = 1e10;
   ct::FMemoryStack2
@@ -80,6 +87,9 @@ int main(int argc, char** argv) {
   cout <<format("Real space summation : %10.5f\n") % (realSumTime);
   cout <<format("K    space summation : %10.5f\n") % (kSumTime);
   cout <<format("lattice summation    : %10.5f\n") % (latticeSumTime);
+#ifndef SERIAL
+  MPI_Finalize();
+#endif
   exit(0);
   OverlapKernel okernel;
   KineticKernel kkernel;
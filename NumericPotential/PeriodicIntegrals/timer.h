@@ -17,7 +17,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <omp.h>
 
+//only the master thread records time, the others would overwrite its start
 class cumulTimer
 {
  private:
@@ -31,6 +33,7 @@ class cumulTimer
   void reset() {localStart = -1.0; cumulativeSum = 0.;}
 
   void start() {
+    if (omp_get_thread_num() != 0) return;
     struct timeval start;
     gettimeofday(&start, NULL);
     localStart = start.tv_sec + 1.e-6*start.tv_usec;
@@ -40,6 +43,7 @@ class cumulTimer
 
   void stop() 
   {
+    if (omp_get_thread_num() != 0) return;
 
     struct timeval start;
     gettimeofday(&start, NULL);
@@ -350,11 +350,15 @@ void calcIntegral_2c(char* Name, double* integrals, int* shls, int* ao_loc,
     if (ao_loc[i+1] - ao_loc[i] > dim)
       dim = ao_loc[i+1] - ao_loc[i];
   
-  tensor teri( {dim, dim});
-
   int n1 = ao_loc[shls[1]] - ao_loc[shls[0]],
       n2 = ao_loc[shls[3]] - ao_loc[shls[2]];
   
+  //shell pairs are independent and the work arrays are thread local
+  #pragma omp parallel
+  {
+  tensor teri( {dim, dim});
+
+  #pragma omp for collapse(2) schedule(dynamic)
   for(int sh1 = shls[0]; sh1 < shls[1]; sh1++) 
   for(int sh2 = shls[2]; sh2 < shls[3]; sh2++) {
 
@@ -370,6 +374,7 @@ void calcIntegral_2c(char* Name, double* integrals, int* shls, int* ao_loc,
 
     
   }//sh2
+  }
 
 }
 
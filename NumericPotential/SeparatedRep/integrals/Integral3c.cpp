@@ -24,7 +24,7 @@ void initArraySize(vector<int> coeffSize, vector<int> S2size,
 
 void generateCoefficientMatrix(int LA, int LB, double expA, double expB,
                                double ABx, double p, tensor& Coeff_3d) {
-
+  vector<double> &expaPow = ::expaPow, &expbPow = ::expbPow;
   expaPow[0] = 1.;
   for (int i=1; i<= LB; i++)
     expaPow[i] = expaPow[i-1] * expA * ABx/p;
@@ -55,7 +55,11 @@ double calc1DOvlpPeriodicSumB(int LA, double Ax, double expA,
                               double Lx, tensor& Sx_3d, tensor& Sx2_3d,
                               tensor& powPIOverLx) 
 {
-
+  //the work arrays are thread local, bind them once rather than on every access
+  tensor &Coeffx_3d = ::Coeffx_3d, &Sx_2d = ::Sx_2d, &Sx2_2d = ::Sx2_2d,
+      &powExpA = ::powExpA, &powExpB = ::powExpB, &powExpC = ::powExpC,
+      &powExpAPlusExpB = ::powExpAPlusExpB;
+  vector<double>& workArray = ::workArray;
 
   //THREE CASES
   if ( expA > 0.3/Lx/Lx && expB > 0.3/Lx/Lx) { //then explicit sums have to be performed
@@ -74,8 +78,7 @@ double calc1DOvlpPeriodicSumB(int LA, double Ax, double expA,
         calc1DOvlpPeriodic(LA+LB, Px, p, LC, Cx, expC, t, 0, Lx, Sx_2d, &workArray[0], powPIOverLx, powExpAPlusExpB, powExpC);
         calc1DOvlpPeriodic(LA+LB, Px, p, LC, Cx, expC, 0, 0, Lx, Sx2_2d, &workArray[0], powPIOverLx, powExpAPlusExpB, powExpC);
         
-        contract_IJK_IJL_LK( &Sx_3d, &Coeffx_3d,  &Sx_2d, productfactor, beta); 
-        contract_IJK_IJL_LK(&Sx2_3d, &Coeffx_3d, &Sx2_2d, productfactor, beta);
+        contract_IJK_IJL_LK(&Sx_3d, &Sx2_3d, &Coeffx_3d, &Sx_2d, &Sx2_2d, productfactor, beta);
       }
       
       if (nx != 0)
@@ -88,8 +91,7 @@ double calc1DOvlpPeriodicSumB(int LA, double Ax, double expA,
         calc1DOvlpPeriodic(LA+LB, Px, p, LC, Cx, expC, t, 0, Lx, Sx_2d, &workArray[0], powPIOverLx, powExpAPlusExpB, powExpC);
         calc1DOvlpPeriodic(LA+LB, Px, p, LC, Cx, expC, 0, 0, Lx, Sx2_2d, &workArray[0], powPIOverLx, powExpAPlusExpB, powExpC);
         
-        contract_IJK_IJL_LK(&Sx_3d, &Coeffx_3d, &Sx_2d, productfactor, 1.0); 
-        contract_IJK_IJL_LK(&Sx2_3d, &Coeffx_3d, &Sx2_2d, productfactor, 1.0); 
+        contract_IJK_IJL_LK(&Sx_3d, &Sx2_3d, &Coeffx_3d, &Sx_2d, &Sx2_2d, productfactor, 1.0);
       }
       else 
         beta = 1.0;
@@ -104,10 +106,10 @@ double calc1DOvlpPeriodicSumB(int LA, double Ax, double expA,
     calc1DOvlpPeriodic(LA, Ax, expA, LC, Cx, expC, 0, 0, Lx, Sx2_2d, &workArray[0], powPIOverLx, powExpA, powExpC);
 
     double Bfactor = sqrt(M_PI/(expB*Lx*Lx) * ((expA+expB)/expA));
-    for (int j=0; j<= (LB+1)*(LB+2)/2; j++) {
+    for (int j=0; j<= LB; j++) {
       double factor = DerivativeToPolynomial(j, 0) * powExpB(j/2);
-      for (int i=0; i<= (LA+1)*(LA+2)/2; i++)
-        for (int k=0; k<= (LC+1)*(LC+2)/2; k++) {
+      for (int i=0; i<= LA; i++)
+        for (int k=0; k<= LC; k++) {
           Sx_3d(i,j,k) = Bfactor * factor * Sx_2d(i,k) ;
           Sx2_3d(i,j,k) = Bfactor * factor * Sx2_2d(i,k) ;
         }
@@ -120,10 +122,10 @@ double calc1DOvlpPeriodicSumB(int LA, double Ax, double expA,
     calc1DOvlpPeriodic(LB, Bx, expB, LC, Cx, expC, 0, 0, Lx, Sx2_2d, &workArray[0], powPIOverLx, powExpB, powExpC);
 
     double Afactor = sqrt( (M_PI/expA/Lx/Lx) * ((expA+expB)/expB) );
-    for (int i=0; i<= (LA+1)*(LA+2)/2; i++) {
+    for (int i=0; i<= LA; i++) {
       double factor = DerivativeToPolynomial(i, 0)  * powExpA(i/2);
-      for (int j=0; j<= (LB+1)*(LB+2)/2; j++) 
-        for (int k=0; k<= (LC+1)*(LC+2)/2; k++) {
+      for (int j=0; j<= LB; j++) 
+        for (int k=0; k<= LC; k++) {
           Sx_3d(i,j,k)  = Afactor * factor * Sx_2d(j,k) ;
           Sx2_3d(i,j,k) = Afactor * factor * Sx2_2d(j,k) ;
         }
@@ -176,7 +178,7 @@ void calcCoulombIntegralPeriodic_noTranslations(
   generateCoefficientMatrix(LA, LB, expA, expB, ABz, p, Coeffz_3d);
 
   powExpAPlusExpB.dimensions = {LA+LB+1}; powExpC.dimensions = {LC+1}; powExpA.dimensions = {LA+1}; powExpB.dimensions = {LB+1};
-  powPIOverLx.dimensions = {LA+LB+1}; powPIOverLy.dimensions = {LA+LB+1}; powPIOverLz.dimensions = {LA+LB+1};
+  powPIOverLx.dimensions = {LA+LB+LC+1}; powPIOverLy.dimensions = {LA+LB+LC+1}; powPIOverLz.dimensions = {LA+LB+LC+1};
   for (int i=0; i<=LA+LB; i++)
     powExpAPlusExpB(i) = pow(1./p, i);
   for (int i=0; i<=LA; i++)
@@ -185,7 +187,8 @@ void calcCoulombIntegralPeriodic_noTranslations(
     powExpB(i) = pow(1./expB, i);
   for (int j=0; j<=LC; j++)
     powExpC(j) = pow(1./expC, j);
-  for (int k=0; k<=LA+LB; k++) {
+  //calc1DOvlpPeriodic needs the powers up to the total angular momentum
+  for (int k=0; k<=LA+LB+LC; k++) {
     powPIOverLx(k) = pow(M_PI/Lx, k);
     powPIOverLy(k) = pow(M_PI/Ly, k);
     powPIOverLz(k) = pow(M_PI/Lz, k);
@@ -217,13 +220,9 @@ void calcCoulombIntegralPeriodic_noTranslations(
     }
     prevt = t;
     
-    contract_IJK_IJL_LK(&Sx_3d, &Coeffx_3d, &Sx_2d); 
-    contract_IJK_IJL_LK(&Sy_3d, &Coeffy_3d, &Sy_2d); 
-    contract_IJK_IJL_LK(&Sz_3d, &Coeffz_3d, &Sz_2d);
-
-    contract_IJK_IJL_LK(&Sx2_3d, &Coeffx_3d, &Sx2_2d); 
-    contract_IJK_IJL_LK(&Sy2_3d, &Coeffy_3d, &Sy2_2d); 
-    contract_IJK_IJL_LK(&Sz2_3d, &Coeffz_3d, &Sz2_2d);
+    contract_IJK_IJL_LK(&Sx_3d, &Sx2_3d, &Coeffx_3d, &Sx_2d, &Sx2_2d);
+    contract_IJK_IJL_LK(&Sy_3d, &Sy2_3d, &Coeffy_3d, &Sy_2d, &Sy2_2d);
+    contract_IJK_IJL_LK(&Sz_3d, &Sz2_3d, &Coeffz_3d, &Sz_2d, &Sz2_2d);
 
     for (int a = 0; a< (LA+1)*(LA+2)/2; a++)
     for (int b = 0; b< (LB+1)*(LB+2)/2; b++)
@@ -270,7 +269,7 @@ void calcCoulombIntegralPeriodic_BTranslations(
   }
 
   powExpAPlusExpB.dimensions = {LA+LB+1}; powExpC.dimensions = {LC+1}; powExpA.dimensions = {LA+1}; powExpB.dimensions = {LB+1};
-  powPIOverLx.dimensions = {LA+LB+1}; powPIOverLy.dimensions = {LA+LB+1}; powPIOverLz.dimensions = {LA+LB+1};
+  powPIOverLx.dimensions = {LA+LB+LC+1}; powPIOverLy.dimensions = {LA+LB+LC+1}; powPIOverLz.dimensions = {LA+LB+LC+1};
   for (int i=0; i<=LA+LB; i++)
     powExpAPlusExpB(i) = pow(1./(expA+expB), i);
   for (int j=0; j<=LC; j++)
@@ -279,13 +278,17 @@ void calcCoulombIntegralPeriodic_BTranslations(
     powExpA(j) = pow(1./expA, j);
   for (int j=0; j<=LB; j++)
     powExpB(j) = pow(1./expB, j);
-  for (int k=0; k<=LA+LB; k++) {
+  //calc1DOvlpPeriodic needs the powers up to the total angular momentum
+  for (int k=0; k<=LA+LB+LC; k++) {
     powPIOverLx(k) = pow(M_PI/Lx, k);
     powPIOverLy(k) = pow(M_PI/Ly, k);
     powPIOverLz(k) = pow(M_PI/Lz, k);
   }
 
   initArraySize({LA+1, LB+1, LA+LB+1}, {LA+1, LB+1, LC+1}, {LA+LB+1, LC+1});
+  //the work arrays are thread local, bind them once rather than on every access
+  tensor &Sx_3d = ::Sx_3d, &Sy_3d = ::Sy_3d, &Sz_3d = ::Sz_3d,
+      &Sx2_3d = ::Sx2_3d, &Sy2_3d = ::Sy2_3d, &Sz2_3d = ::Sz2_3d;
   Sx_3d.setZero(); Sy_3d.setZero(); Sz_3d.setZero();
 
   //cout << (LA+1)*(LA+2)/2<<"  "<< (LB+1)*(LB+2)/2<<"  "<< (LC+1)*(LC+2)/2<<"  "<<(LA+1)*(LA+2)*(LB+1)*(LB+2) * (LC+1)*(LC+2)/8<<"  "<<endl;
@@ -428,15 +431,17 @@ void calcIntegral_3c(double* integrals, int* shls, int* ao_loc,
     if (ao_loc[i+1] - ao_loc[i] > dim)
       dim = ao_loc[i+1] - ao_loc[i];
   
-  tensor teri( {dim, dim, dim});
-
   int n1 = ao_loc[shls[1]] - ao_loc[shls[0]],
       n2 = ao_loc[shls[3]] - ao_loc[shls[2]],
       n3 = ao_loc[shls[5]] - ao_loc[shls[4]];
 
-  
+  //shell triplets are independent and the work arrays are thread local
+  #pragma omp parallel
+  {
+  tensor teri( {dim, dim, dim});
+
+  #pragma omp for schedule(dynamic)
   for(int sh1 = shls[0]; sh1 < shls[1]; sh1++) {
-    cout << sh1<<"  "<<shls[1]<<endl;
   for(int sh2 = shls[2]; sh2 <= sh1; sh2++) 
 
     //for(int sh2 = shls[2]; sh2 < shls[3]; sh2++) 
@@ -457,6 +462,7 @@ void calcIntegral_3c(double* integrals, int* shls, int* ao_loc,
       }
     }//sh
   }
+  }
 }
 
 
@@ -549,11 +555,14 @@ void calcNuclearIntegral(double* integrals, int* shls, int* ao_loc,
     if (ao_loc[i+1] - ao_loc[i] > dim)
       dim = ao_loc[i+1] - ao_loc[i];
   
-  tensor teri( {dim, dim, 1});
-
   int n1 = ao_loc[shls[1]] - ao_loc[shls[0]],
       n2 = ao_loc[shls[3]] - ao_loc[shls[2]];
 
+  #pragma omp parallel
+  {
+  tensor teri( {dim, dim, 1});
+
+  #pragma omp for collapse(2) schedule(dynamic)
   for(int sh1 = shls[0]; sh1 < shls[1]; sh1++) 
   for(int sh2 = shls[2]; sh2 < shls[3]; sh2++) {
 
@@ -569,6 +578,7 @@ void calcNuclearIntegral(double* integrals, int* shls, int* ao_loc,
 
     
   }//sh2
+  }
 
 }
 
@@ -1,48 +1,69 @@
-//#include "mkl.h"
 #include "tensor.h"
 
+//O(ij,k) = beta O(ij,k) + scale C(ij,l) S(l,k) is a GEMM, but with l, k <=
+//2*Lmax+1 the operands are far too small for a BLAS call to pay off. The rows
+//are done with a contiguous inner k loop instead, and the zeros of C (the
+//binomial coefficients vanish for l > i+j) are skipped.
+static void contractRow(double* O_row, const double* C_row, const double* S_vals,
+                        int S1_dimension, int S2_dimension, double scale) {
+  for (int l = 0; l < S1_dimension; l++) {
+    double c = scale * C_row[l];
+    if (c == 0.0) continue;
+    const double* S_row = S_vals + l * S2_dimension;
+    for (int k = 0; k < S2_dimension; k++)
+      O_row[k] += c * S_row[k];
+  }
+}
+
+static void scaleTensor(tensor *O, double beta) {
+  int size = O->dimensions[0] * O->dimensions[1] * O->dimensions[2];
+  if (beta == 0.0)
+    std::fill(O->vals, O->vals + size, 0.0);
+  else if (beta != 1.0)
+    for (int pO = 0; pO < size; pO++)
+      O->vals[pO] *= beta;
+}
+
 int contract_IJK_IJL_LK(tensor *O, tensor *C, tensor *S, double scale, double beta) {
-  /*
-  int m = O->dimensions[0]*O->dimensions[1],
-      n = S->dimensions[1],
-      k = S->dimensions[0];
-  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k,
-              scale, C->vals, k, S->vals, n, beta, O->vals, n); 
-  */          
-
-  int O1_dimension = (int)(O->dimensions[0]);
   int O2_dimension = (int)(O->dimensions[1]);
   int O3_dimension = (int)(O->dimensions[2]);
-  double* O_vals = (double*)(O->vals);
   int C1_dimension = (int)(C->dimensions[0]);
   int C2_dimension = (int)(C->dimensions[1]);
   int C3_dimension = (int)(C->dimensions[2]);
-  double* C_vals = (double*)(C->vals);
   int S1_dimension = (int)(S->dimensions[0]);
   int S2_dimension = (int)(S->dimensions[1]);
-  double* S_vals = (double*)(S->vals);
 
-  //#pragma omp parallel for schedule(static)
-  for (int pO = 0; pO < ((O1_dimension * O2_dimension) * O3_dimension); pO++) {
-    O_vals[pO] *= beta;
-  }
+  scaleTensor(O, beta);
 
-  //#pragma omp parallel for schedule(runtime)
-  for (int i = 0; i < C1_dimension; i++) {
+  for (int i = 0; i < C1_dimension; i++)
+    for (int j = 0; j < C2_dimension; j++)
+      contractRow(O->vals + (i * O2_dimension + j) * O3_dimension,
+                  C->vals + (i * C2_dimension + j) * C3_dimension,
+                  S->vals, S1_dimension, S2_dimension, scale);
+
+  return 0;
+}
+
+int contract_IJK_IJL_LK(tensor *O, tensor *O2, tensor *C, tensor *S, tensor *S2,
+                        double scale, double beta) {
+  int O2_dimension = (int)(O->dimensions[1]);
+  int O3_dimension = (int)(O->dimensions[2]);
+  int C1_dimension = (int)(C->dimensions[0]);
+  int C2_dimension = (int)(C->dimensions[1]);
+  int C3_dimension = (int)(C->dimensions[2]);
+  int S1_dimension = (int)(S->dimensions[0]);
+  int S2_dimension = (int)(S->dimensions[1]);
+
+  scaleTensor(O, beta);
+  scaleTensor(O2, beta);
+
+  for (int i = 0; i < C1_dimension; i++)
     for (int j = 0; j < C2_dimension; j++) {
-      int jO = i * O2_dimension + j;
-      int jC = i * C2_dimension + j;
-      for (int l = 0; l < S1_dimension; l++) {
-        int lC = jC * C3_dimension + l;
-        for (int k = 0; k < S2_dimension; k++) {
-          int kO = jO * O3_dimension + k;
-          int kS = l * S2_dimension + k;
-          O_vals[kO] = O_vals[kO] + scale * C_vals[lC] * S_vals[kS];
-        }
-      }
+      int jO = (i * O2_dimension + j) * O3_dimension;
+      const double* C_row = C->vals + (i * C2_dimension + j) * C3_dimension;
+      contractRow(O->vals + jO, C_row, S->vals, S1_dimension, S2_dimension, scale);
+      contractRow(O2->vals + jO, C_row, S2->vals, S1_dimension, S2_dimension, scale);
     }
-  }
 
   return 0;
 }
-
@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 
@@ -72,3 +73,6 @@ struct tensor {
 
 
 int contract_IJK_IJL_LK(tensor *O, tensor *C, tensor *S, double scale=1.0, double beta=0.);
+//the same contraction of one C with two S tensors, sharing the pass over C
+int contract_IJK_IJL_LK(tensor *O, tensor *O2, tensor *C, tensor *S, tensor *S2,
+                        double scale=1.0, double beta=0.);
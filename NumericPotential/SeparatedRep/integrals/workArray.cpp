@@ -2,43 +2,44 @@
 
 
 const int Lmax = 7;
-tensor Sx_2d({Lmax+3,Lmax+3});
-tensor Sy_2d ({Lmax+3,Lmax+3});
-tensor Sz_2d ({Lmax+3,Lmax+3});
-tensor Sx2_2d({Lmax+3,Lmax+3});
-tensor Sy2_2d({Lmax+3,Lmax+3});
-tensor Sz2_2d({Lmax+3,Lmax+3});
-tensor S_2d  ({120,120});
-vector<double> normA(Lmax+3), normB(Lmax+3);
+//the scratch arrays are per thread so that shells can be done concurrently
+thread_local tensor Sx_2d({Lmax+3,Lmax+3});
+thread_local tensor Sy_2d ({Lmax+3,Lmax+3});
+thread_local tensor Sz_2d ({Lmax+3,Lmax+3});
+thread_local tensor Sx2_2d({Lmax+3,Lmax+3});
+thread_local tensor Sy2_2d({Lmax+3,Lmax+3});
+thread_local tensor Sz2_2d({Lmax+3,Lmax+3});
+thread_local tensor S_2d  ({120,120});
+thread_local vector<double> normA(Lmax+3), normB(Lmax+3);
 vector<vector<int>> CartOrder((Lmax+1) * (Lmax+2) * (Lmax+3)/6, vector<int>(3));
 Coulomb_14_8_8 coulomb_14_8_8;
 Coulomb_14_14_8 coulomb_14_14_8;
 
-vector<double> workArray(200); //only need 4*Lmax
+thread_local vector<double> workArray(200); //only need 4*Lmax
 tensor DerivativeToPolynomial({18, 18});
 
-tensor Sx_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Sy_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Sz_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Sx2_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Sy2_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Sz2_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor S_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Coeffx_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Coeffy_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor Coeffz_3d({Lmax+1,Lmax+1,Lmax+1});
-tensor powExpAPlusExpB({100});
-tensor powExpA({2*Lmax+3});
-tensor powExpB({2*Lmax+3});
-tensor powExpC({2*Lmax+3});
-tensor powPIOverLx({2*Lmax+3});
-tensor powPIOverLy({2*Lmax+3});
-tensor powPIOverLz({2*Lmax+3});
-vector<double> expaPow(2*Lmax+3), expbPow(2*Lmax+3);
-tensor Ci({2*Lmax+3});
-tensor Cj({2*Lmax+3});
-tensor Ck({2*Lmax+3});
-tensor teri({2*Lmax+3, 2*Lmax+3, 2*Lmax+3});
+thread_local tensor Sx_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Sy_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Sz_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Sx2_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Sy2_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Sz2_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor S_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Coeffx_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Coeffy_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor Coeffz_3d({Lmax+1,Lmax+1,Lmax+1});
+thread_local tensor powExpAPlusExpB({100});
+thread_local tensor powExpA({2*Lmax+3});
+thread_local tensor powExpB({2*Lmax+3});
+thread_local tensor powExpC({2*Lmax+3});
+thread_local tensor powPIOverLx({3*Lmax+3});
+thread_local tensor powPIOverLy({3*Lmax+3});
+thread_local tensor powPIOverLz({3*Lmax+3});
+thread_local vector<double> expaPow(2*Lmax+3), expbPow(2*Lmax+3);
+thread_local tensor Ci({2*Lmax+3});
+thread_local tensor Cj({2*Lmax+3});
+thread_local tensor Ck({2*Lmax+3});
+thread_local tensor teri({2*Lmax+3, 2*Lmax+3, 2*Lmax+3});
 
 void initWorkArray() {
 
@@ -41,6 +41,8 @@ void initAngularData(int lmax, int lebdevOrder, double* angGrid, double* angWts)
 
 void initDensityRadialGrid(int ia, int rmax, double rm, double* radialGrid, double* radialWts);
 void fitDensity(int ia, int rindex, double* density);
+void fitDensityOfAtom(int ia);
+void getPotentialBeckeOfAtoms(const vector<int>& atoms, int ngrid, double* grid, double* potential);
 //void getDensityOnLebdevGridAtGivenR(int rindex, double* density);
 void solvePoissonsEquation(int ia);
 void fitSplinePotential(int ia);
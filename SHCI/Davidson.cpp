@@ -356,6 +356,245 @@ vector<double> davidson(Hmult2& H, vector<MatrixXx>& x0, MatrixXx& diag, int max
 
 
 
+// Helpers for davidsonDistributed. Vectors are partitioned like the rows of
+// Hmult2: process r owns determinants r, r+commsize, ... and stores them in
+// that order. Blocks of ncol vectors are exchanged in the owner major layout
+// of Hmult2::multiply.
+static void allreduceSum(CItype* data, size_t n) {
+#ifndef SERIAL
+#ifndef Complex
+  MPI_Allreduce(MPI_IN_PLACE, data, n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#else
+  MPI_Allreduce(MPI_IN_PLACE, data, 2*n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+#endif
+}
+
+static inline size_t ownerMajorIndex(int I, int c, int ncol, const vector<int>& counts, const vector<int>& displs) {
+  int r = I % commsize;
+  return (size_t)displs[r]*ncol + (size_t)c*counts[r] + I/commsize;
+}
+
+//scatter the rows of full (only read on commrank 0) to their owners
+static void scatterRows(MatrixXx& full, MatrixXx& local, int ncol, const vector<int>& counts, const vector<int>& displs) {
+  int numDets = displs.back() + counts.back();
+  local = MatrixXx::Zero(counts[commrank], ncol);
+  vector<CItype> buf(commrank == 0 ? (size_t)numDets*ncol : 1);
+  if (commrank == 0) {
+    for (int c=0; c<ncol; c++)
+      for (int I=0; I<numDets; I++)
+        buf[ownerMajorIndex(I, c, ncol, counts, displs)] = full(I, c);
+  }
+#ifndef SERIAL
+  int ncomp = sizeof(CItype)/sizeof(double);
+  vector<int> dcounts(commsize), ddispls(commsize);
+  for (int r=0; r<commsize; r++) {
+    dcounts[r] = ncomp*ncol*counts[r];
+    ddispls[r] = ncomp*ncol*displs[r];
+  }
+  MPI_Scatterv(&buf[0], &dcounts[0], &ddispls[0], MPI_DOUBLE, local.data(), dcounts[commrank], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+#else
+  for (size_t k=0; k<local.size(); k++) local.data()[k] = buf[k];
+#endif
+}
+
+//assemble the full vectors from their owned rows, on every process or only on commrank 0
+static void gatherRows(const MatrixXx& local, MatrixXx& full, const vector<int>& counts, const vector<int>& displs, bool allRanks) {
+  int numDets = displs.back() + counts.back(), ncol = local.cols();
+  vector<CItype> buf((size_t)numDets*ncol);
+#ifndef SERIAL
+  int ncomp = sizeof(CItype)/sizeof(double);
+  vector<int> dcounts(commsize), ddispls(commsize);
+  for (int r=0; r<commsize; r++) {
+    dcounts[r] = ncomp*ncol*counts[r];
+    ddispls[r] = ncomp*ncol*displs[r];
+  }
+  if (allRanks)
+    MPI_Allgatherv(local.data(), dcounts[commrank], MPI_DOUBLE, &buf[0], &dcounts[0], &ddispls[0], MPI_DOUBLE, MPI_COMM_WORLD);
+  else
+    MPI_Gatherv(local.data(), dcounts[commrank], MPI_DOUBLE, &buf[0], &dcounts[0], &ddispls[0], MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  if (!allRanks && commrank != 0) return;
+#else
+  for (size_t k=0; k<local.size(); k++) buf[k] = local.data()[k];
+#endif
+  full.resize(numDets, ncol);
+  for (int c=0; c<ncol; c++)
+    for (int I=0; I<numDets; I++)
+      full(I, c) = buf[ownerMajorIndex(I, c, ncol, counts, displs)];
+}
+
+//orthonormalize v against the first m columns of V (two passes of classical
+//Gram-Schmidt) and store it as column m, returns false if nothing is left
+static bool appendOrthonormal(MatrixXx& V, int m, MatrixXx v) {
+  double norm0 = v.squaredNorm();
+#ifndef SERIAL
+  MPI_Allreduce(MPI_IN_PLACE, &norm0, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+  norm0 = sqrt(norm0);
+  if (norm0 < 1.e-14) return false;
+
+  for (int pass=0; pass<2 && m>0; pass++) {
+    MatrixXx overlap = V.leftCols(m).adjoint()*v;
+    allreduceSum(overlap.data(), overlap.size());
+    v -= V.leftCols(m)*overlap;
+  }
+  double norm = v.squaredNorm();
+#ifndef SERIAL
+  MPI_Allreduce(MPI_IN_PLACE, &norm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+  norm = sqrt(norm);
+  if (norm < 1.e-8*norm0) return false;
+  V.col(m) = v/norm;
+  return true;
+}
+
+//W(:, first:first+n) = H V(:, first:first+n), one sparse multiply for the block
+static void applyH(Hmult2& H, MatrixXx& V, MatrixXx& W, int first, int n, const vector<int>& counts, const vector<int>& displs) {
+  MatrixXx Vfull, Vblock = V.middleCols(first, n);
+  gatherRows(Vblock, Vfull, counts, displs, true);
+  MatrixXx Wblock = MatrixXx::Zero(max(counts[commrank], 1), n);
+  H.multiplyLocal(Vfull.data(), Wblock.data(), n);
+  W.middleCols(first, n) = Wblock.topRows(counts[commrank]);
+}
+
+
+
+//=============================================================================
+vector<double> davidsonDistributed(Hmult2& H, vector<MatrixXx>& x0, MatrixXx& diag, int maxCopies, double tol, int& numIter, bool print) {
+//-----------------------------------------------------------------------------
+    /*!
+    Block Davidson with every vector partitioned over the processes by the
+    rows of Hmult2. Only the small subspace matrices are replicated (and
+    Allreduced), all roots are refined together and the new directions of an
+    iteration are multiplied by H in a single block. x0 and diag are read
+    from commrank 0 at the start and x0 is written back there at the end.
+
+    :Inputs:
+
+        Hmult2& H:
+            The sparse Hamiltonian
+        vector<MatrixXx>& x0:
+            Initial guesses, the eigenvectors on return (on commrank 0)
+        MatrixXx& diag:
+            Diagonal of H used as preconditioner (on commrank 0)
+        int maxCopies:
+            Maximum size of the subspace
+        double tol:
+            Convergence threshold on the residual norm
+        int& numIter:
+            Number of iterations (output)
+        bool print:
+            Print the progress
+
+    :Returns:
+
+        std::vector<double> eroots:
+            The eigenvalues
+    */
+//-----------------------------------------------------------------------------
+  int nroots = x0.size();
+  vector<int> counts, displs;
+  H.rowCounts(counts, displs);
+  int numDets = displs.back() + counts.back(), nloc = counts[commrank];
+  maxCopies = min(max(maxCopies, 2*nroots), numDets);
+
+  MatrixXx X0full, X, d;
+  if (commrank == 0) {
+    X0full = MatrixXx::Zero(numDets, nroots);
+    for (int i=0; i<nroots; i++) X0full.col(i) = x0[i];
+  }
+  scatterRows(X0full, X, nroots, counts, displs);
+  scatterRows(diag, d, 1, counts, displs);
+
+  //orthonormal start vectors, zero or dependent guesses are randomised
+  MatrixXx V = MatrixXx::Zero(nloc, maxCopies), W = MatrixXx::Zero(nloc, maxCopies);
+  int m = 0;
+  for (int i=0; i<nroots; i++) {
+    if (appendOrthonormal(V, m, X.col(i))) { m++; continue; }
+    MatrixXx v = MatrixXx::Random(nloc, 1);
+    if (appendOrthonormal(V, m, v)) m++;
+  }
+  applyH(H, V, W, 0, m, counts, displs);
+
+  vector<double> eroots(nroots);
+  numIter = 0;
+  while (true) {
+    //Rayleigh-Ritz in the subspace
+    MatrixXx hsubspace = V.leftCols(m).adjoint()*W.leftCols(m);
+    allreduceSum(hsubspace.data(), hsubspace.size());
+    hsubspace = 0.5*(hsubspace + hsubspace.adjoint());
+    SelfAdjointEigenSolver<MatrixXx> eigensolver(hsubspace);
+    if (eigensolver.info() != Success) {
+      pout << "Eigenvalue solver unsuccessful."<<endl;
+      abort();
+    }
+    MatrixXx C = eigensolver.eigenvectors().leftCols(nroots);
+    VectorXd theta = eigensolver.eigenvalues().head(nroots);
+    MatrixXx ritz = V.leftCols(m)*C, Hritz = W.leftCols(m)*C;
+    MatrixXx r = Hritz - ritz*theta.cast<CItype>().asDiagonal();
+
+    VectorXd error = r.colwise().squaredNorm().transpose();
+#ifndef SERIAL
+    MPI_Allreduce(MPI_IN_PLACE, error.data(), nroots, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    error = error.cwiseSqrt();
+
+    int convergedRoot = 0;
+    while (convergedRoot < nroots && error(convergedRoot) < tol) convergedRoot++;
+    if (print) {
+      if (numIter == 0) pout << "nIter  Root               Energy                Error" << endl;
+      int root = min(convergedRoot, nroots-1);
+      pout << format("%5i  %4i   %18.10g   %18.10g  %10.2f\n") % numIter % root % theta(root) % error(root) % (getTime()-startofCalc);
+    }
+    numIter++;
+
+    bool done = convergedRoot == nroots || m == numDets;
+    if (!done && numIter > 2000*nroots) {
+      pout << format("Davidson calculation did not converge for root %3d, #iter %5d\n") % (convergedRoot+1) % (numIter);
+      exit(0);
+    }
+
+    //preconditioned residuals of the unconverged roots
+    vector<MatrixXx> newDirections;
+    if (!done) {
+      for (int i=0; i<nroots; i++) {
+        if (error(i) < tol) continue;
+        MatrixXx t = r.col(i);
+        for (int j=0; j<nloc; j++) {
+          if (abs(theta(i)-d(j,0)) > 1e-12)
+            t(j,0) = t(j,0)/(theta(i)-d(j,0));
+          else
+            t(j,0) = t(j,0)/(theta(i)-d(j,0)-1.e-12);
+        }
+        newDirections.push_back(t);
+      }
+      //collapse onto the Ritz vectors if the subspace is full
+      if (m + newDirections.size() > maxCopies) {
+        V.leftCols(nroots) = ritz;
+        W.leftCols(nroots) = Hritz;
+        m = nroots;
+      }
+    }
+
+    int first = m;
+    for (int i=0; i<newDirections.size() && m<maxCopies; i++)
+      if (appendOrthonormal(V, m, newDirections[i])) m++;
+
+    if (done || m == first) {
+      for (int i=0; i<nroots; i++) eroots[i] = theta(i);
+      MatrixXx ritzFull;
+      gatherRows(ritz, ritzFull, counts, displs, false);
+      if (commrank == 0)
+        for (int i=0; i<nroots; i++) x0[i] = ritzFull.col(i);
+      return eroots;
+    }
+
+    applyH(H, V, W, first, m-first, counts, displs);
+  } // while
+} // end davidsonDistributed
+
+
+
 //=============================================================================
 vector<double> davidsonDirect(HmultDirect& H, vector<MatrixXx>& x0, MatrixXx& diag, int maxCopies, double tol, int& numIter, bool print) {
 //-----------------------------------------------------------------------------
@@ -37,6 +37,10 @@ void precondition(MatrixXx& r, MatrixXx& diag, double& e);
 vector<double> davidson(Hmult2& H, vector<MatrixXx>& x0, MatrixXx& diag,
                         int maxCopies, double tol, int& numIter, bool print);
 
+vector<double> davidsonDistributed(Hmult2& H, vector<MatrixXx>& x0,
+                                   MatrixXx& diag, int maxCopies, double tol,
+                                   int& numIter, bool print);
+
 vector<double> davidsonDirect(HmultDirect& Hdirect, vector<MatrixXx>& x0,
                               MatrixXx& diag, int maxCopies, double tol,
                               int& numIter, bool print);
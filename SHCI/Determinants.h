@@ -26,36 +26,25 @@
 #include <iostream>
 #include <vector>
 #include "global.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 class oneInt;
 class twoInt;
 
 using namespace std;
 
+// number of set bits, a single POPCNT when the target has it
 inline int BitCount(long x) {
+#ifdef __GNUC__
+  return __builtin_popcountl(x);
+#else
   x = (x & 0x5555555555555555ULL) + ((x >> 1) & 0x5555555555555555ULL);
   x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
   x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);
   return (x * 0x0101010101010101ULL) >> 56;
-
-  // unsigned int u2=u>>32, u1=u;
-
-  // return __builtin_popcount(u2)+__builtin_popcount(u);
-  /*
-  u1 = u1
-    - ((u1 >> 1) & 033333333333)
-    - ((u1 >> 2) & 011111111111);
-
-
-  u2 = u2
-    - ((u2 >> 1) & 033333333333)
-    - ((u2 >> 2) & 011111111111);
-
-  return (((u1 + (u1 >> 3))
-           & 030707070707) % 63) +
-    (((u2 + (u2 >> 3))
-      & 030707070707) % 63);
-  */
+#endif
 }
 
 // This is used to store just the alpha or the beta sub string of the entire
@@ -520,6 +509,40 @@ class Determinant {
   }
 };
 
+// ndiff[k] = d.ExcitationDistance(dets[k]) for k < n. With DetLen = 4 a
+// determinant is one 256 bit word, its xor with d is popcounted with
+// VPOPCNTQ on AVX-512 or with the nibble table method on AVX2.
+inline void ExcitationDistances(const Determinant& d, const Determinant* dets,
+                                int n, int* ndiff) {
+#ifdef __AVX2__
+  if (DetLen == 4 && sizeof(Determinant) == 4 * sizeof(long)) {
+    const __m256i ref = _mm256_loadu_si256((const __m256i*)d.repr);
+#if !(defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__))
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+#endif
+    for (int k = 0; k < n; k++) {
+      __m256i x = _mm256_xor_si256(ref, _mm256_loadu_si256((const __m256i*)dets[k].repr));
+#if defined(__AVX512VPOPCNTDQ__) && defined(__AVX512VL__)
+      __m256i count = _mm256_popcnt_epi64(x);
+#else
+      __m256i lo = _mm256_and_si256(x, lowMask);
+      __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), lowMask);
+      __m256i count = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                      _mm256_shuffle_epi8(lookup, hi));
+      count = _mm256_sad_epu8(count, _mm256_setzero_si256());
+#endif
+      __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(count),
+                                  _mm256_extracti128_si256(count, 1));
+      ndiff[k] = (_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1)) / 2;
+    }
+    return;
+  }
+#endif
+  for (int k = 0; k < n; k++) ndiff[k] = d.ExcitationDistance(dets[k]);
+}
+
 double EnergyAfterExcitation(vector<int>& closed, int& nclosed, oneInt& I1,
                              twoInt& I2, double& coreE, int i, int A,
                              double Energyd);
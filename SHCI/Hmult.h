@@ -30,6 +30,7 @@
 #include "Determinants.h"
 #include <algorithm>
 #include <chrono>
+#include <future>
 #include "SHCISortMpiUtils.h"
 #include "SHCImake4cHamiltonian.h"
 
@@ -44,111 +45,225 @@ namespace SHCISortMpiUtils{
   int ipow(int base, int exp);
 };
 
+// atomic accumulation used for the transposed half of the symmetric SpMV
+inline void atomicAdd(double& a, const double& b) {
+#pragma omp atomic
+  a += b;
+}
+
+inline void atomicAdd(std::complex<double>& a, const std::complex<double>& b) {
+  double* ab = reinterpret_cast<double*>(&a);
+#pragma omp atomic
+  ab[0] += b.real();
+#pragma omp atomic
+  ab[1] += b.imag();
+}
+
 struct Hmult2 {
   SparseHam &sparseHam;
 
-  Hmult2(SparseHam& p_sparseHam) : sparseHam(p_sparseHam) {}
+  Hmult2(SparseHam& p_sparseHam) : sparseHam(p_sparseHam) {
+    // Hamiltonians filled by hand still need their CSR arrays
+    if (sparseHam.totalRows() != sparseHam.connections.size())
+      sparseHam.compress(true);
+  }
 
   //=============================================================================
-  void operator()(CItype *x, CItype *y) {
+  template <typename T>
+  void multiply(const size_t *rowStart, const int *colIndex, const T* values,
+                int firstRow, int nrows, CItype *x, int ncol, CItype *ytemp,
+                const vector<int>& counts, const vector<int>& displs) {
     //-----------------------------------------------------------------------------
     /*!
-    Calculate y = H.x from the sparse Hamiltonian
-    :Inputs:
-        CItype *x:
-            The vector to multiply by H
-        CItype *y:
-            The vector H.x (output)
+    Accumulate local rows firstRow..firstRow+nrows-1 of H.X into ytemp for the
+    ncol columns of X (column major, numDets rows). ytemp is laid out owner
+    major: column c of determinant I (owned by r = I%nprocs) sits at
+    displs[r]*ncol + c*counts[r] + I/nprocs, so that a single reduce-scatter
+    hands every process its own rows of all columns. Each thread owns whole
+    rows, so the lower triangle is summed in registers and only the scattered
+    transposed contributions need atomics.
     */
     //-----------------------------------------------------------------------------
-
-#ifndef SERIAL
-    boost::mpi::communicator world;
-#endif
     int size = commsize, rank = commrank;
+    size_t numDets = 0;
+    for (int r = 0; r < size; r++) numDets += counts[r];
+
+#pragma omp parallel
+    {
+      vector<CItype> yI(ncol);
+#pragma omp for schedule(dynamic, 256)
+      for (int i = 0; i < nrows; i++) {
+        int I = (firstRow + i) * size + rank;
+        std::fill(yI.begin(), yI.end(), CItype(0.0));
+        for (size_t p = rowStart[i]; p < rowStart[i+1]; p++) {
+          int J = colIndex[p], owner = J % size;
+          CItype hij = CItype(values[p]);
+#ifdef Complex
+          CItype hji = std::conj(hij);
+#else
+          CItype hji = hij;
+#endif
+          CItype *yJ = ytemp + (size_t)displs[owner] * ncol + J / size;
+          for (int c = 0; c < ncol; c++) {
+            yI[c] += hij * x[c * numDets + J];
+            if (J != I) atomicAdd(yJ[(size_t)c * counts[owner]], hji * x[c * numDets + I]);
+          }
+        }
+        CItype *yown = ytemp + (size_t)displs[rank] * ncol + firstRow + i;
+        for (int c = 0; c < ncol; c++)
+          atomicAdd(yown[(size_t)c * counts[rank]], yI[c]);
+      }
+    }
+  }
+
+  //=============================================================================
+  void multiplyBatch(const HamiltonianBatch& hb, CItype *x, int ncol,
+                     CItype *ytemp, const vector<int>& counts,
+                     const vector<int>& displs) {
+    if (hb.valueBytes == sizeof(CItype))
+      multiply(&hb.rowStart[0], &hb.colIndex[0], (const CItype*)hb.values,
+               hb.firstRow, hb.nrows, x, ncol, ytemp, counts, displs);
+    else
+      multiply(&hb.rowStart[0], &hb.colIndex[0],
+               (const SparseHam::CItypeFloat*)hb.values, hb.firstRow,
+               hb.nrows, x, ncol, ytemp, counts, displs);
+  }
 
-    int numDets = sparseHam.connections.size(),
-        localDets = sparseHam.connections.size();
+  //=============================================================================
+  void rowCounts(vector<int>& counts, vector<int>& displs) {
+    //-----------------------------------------------------------------------------
+    /*!
+    Number of determinants owned by each process and their offsets in the
+    owner major layout. Process r owns determinants r, r+nprocs, r+2*nprocs, ...
+    */
+    //-----------------------------------------------------------------------------
+    int size = commsize;
+    int localDets = sparseHam.totalRows(), numDets = localDets;
 #ifndef SERIAL
     MPI_Allreduce(&localDets, &numDets, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
 #endif
+    counts.assign(size, 0);
+    displs.assign(size, 0);
+    for (int r = 0; r < size; r++) {
+      counts[r] = numDets / size + (r < numDets % size ? 1 : 0);
+      if (r > 0) displs[r] = displs[r-1] + counts[r-1];
+    }
+  }
 
-    // TODO
-    auto start = std::chrono::system_clock::now();
-
-    vector<CItype> ytemp(numDets, 0);
-    int i, j;
-#pragma omp declare reduction(vec_CItype_plus : std::vector<CItype> : \
-                              std::transform(omp_out.begin(), omp_out.end(), omp_in.begin(), omp_out.begin(), std::plus<CItype>())) \
-                    initializer(omp_priv = omp_orig)
-
-#pragma omp parallel for private(i, j) reduction(vec_CItype_plus : ytemp)
-    for (i = 0; i < sparseHam.connections.size(); i++) {
-      for (j = 0; j < sparseHam.connections[i].size(); j++) {
-        CItype hij = sparseHam.Helements[i][j];
-        int J = sparseHam.connections[i][j];
-        int I = i * size + rank;
+  //=============================================================================
+  void multiplyLocal(CItype *x, CItype *yLocal, int ncol = 1) {
+    //-----------------------------------------------------------------------------
+    /*!
+    Calculate the rows of Y = H.X owned by this process
 
-	      ytemp[I] += hij * x[J];
-#ifdef Complex
-        if (J != I) ytemp[J] += std::conj(hij) * x[I];
-#else 
-        if (J != I) ytemp[J] += hij * x[I];
-#endif
+    :Inputs:
+        CItype *x:
+            The ncol full length vectors to multiply by H (column major)
+        CItype *yLocal:
+            The owned rows of H.X, local row i is determinant i*nprocs+proc,
+            column major with leading dimension the number of owned rows (output)
+        int ncol:
+            Number of vectors
+    */
+    //-----------------------------------------------------------------------------
+    int size = commsize, rank = commrank;
+    vector<int> counts, displs;
+    rowCounts(counts, displs);
+    int numDets = displs[size-1] + counts[size-1];
+
+    vector<CItype> ytemp((size_t)numDets * ncol, 0);
+
+    // rows on disk: the next batch is mapped and decoded in the background
+    // while the current one is multiplied
+    if (sparseHam.batchesOnDisk > 0) {
+      HamiltonianBatch batch[2];
+      std::future<void> next = std::async(std::launch::async, [&]() {
+        sparseHam.readBatch(0, batch[0]);
+      });
+      for (int b = 0; b < sparseHam.batchesOnDisk; b++) {
+        next.get();
+        if (b + 1 < sparseHam.batchesOnDisk)
+          next = std::async(std::launch::async, [&, b]() {
+            sparseHam.readBatch(b + 1, batch[(b + 1) % 2]);
+          });
+        multiplyBatch(batch[b % 2], x, ncol, &ytemp[0], counts, displs);
+        batch[b % 2].release();
       }
     }
-    if (rank == 0) {
-      auto end = std::chrono::system_clock::now();
-      std::chrono::duration<double> elapsed_seconds = end - start;
-    }
-    /*start = std::chrono::system_clock::now();
-    ytemp = vector<CItype>(numDets, 0);
-    for (int i = 0; i < sparseHam.connections.size(); i++) {
-      for (int j = 0; j < sparseHam.connections[i].size(); j++) {
-        CItype hij = sparseHam.Helements[i][j];
-        int J = sparseHam.connections[i][j];
-        int I = i * size + rank;
-
-	ytemp[I] += hij * x[J];
-
-        if (J != I) {
-          ytemp[J] += hij * x[i * size + rank];
-        }
-      }
+
+    // rows in memory
+    int nrows = sparseHam.nrows();
+    if (nrows > 0) {
+      if (sparseHam.singlePrecision)
+        multiply(&sparseHam.rowStart[0], &sparseHam.colIndex[0],
+                 &sparseHam.valuesFloat[0], sparseHam.rowsOnDisk, nrows, x,
+                 ncol, &ytemp[0], counts, displs);
+      else
+        multiply(&sparseHam.rowStart[0], &sparseHam.colIndex[0],
+                 &sparseHam.values[0], sparseHam.rowsOnDisk, nrows, x, ncol,
+                 &ytemp[0], counts, displs);
     }
-      auto end = std::chrono::system_clock::now();
-      std::chrono::duration<double> elapsed_seconds = end - start;
-      pout << "Time cost of Hmult on single thread " << elapsed_seconds.count() << endl;*/
-// Reduce result vector y (if using distributed memory)
+
 #ifndef SERIAL
 #ifndef Complex
-    if (localrank == 0) {
-      MPI_Reduce(MPI_IN_PLACE, &ytemp[0], numDets, MPI_DOUBLE, MPI_SUM, 0,
-                 localcomm);
-      for (int j = 0; j < numDets; j++) y[j] = ytemp[j];
-    } else {
-      MPI_Reduce(&ytemp[0], &ytemp[0], numDets, MPI_DOUBLE, MPI_SUM, 0,
-                 localcomm);
-    }
+    int ncomp = 1;
 #else
-    if (localrank == 0) {
-      MPI_Reduce(MPI_IN_PLACE, &ytemp[0], 2 * numDets, MPI_DOUBLE, MPI_SUM, 0,
-                 localcomm);
-      for (int j = 0; j < numDets; j++) y[j] = ytemp[j];
-    } else {
-      MPI_Reduce(&ytemp[0], &ytemp[0], 2 * numDets, MPI_DOUBLE, MPI_SUM, 0,
-                 localcomm);
-    }
+    int ncomp = 2;
 #endif
-    MPI_Barrier(MPI_COMM_WORLD);
+    vector<int> dcounts(size);
+    for (int r = 0; r < size; r++) dcounts[r] = ncomp * ncol * counts[r];
+    MPI_Reduce_scatter(&ytemp[0], yLocal, &dcounts[0], MPI_DOUBLE, MPI_SUM,
+                       MPI_COMM_WORLD);
 #else
-    for (int j = 0; j < numDets; j++) y[j] = ytemp[j];
+    for (size_t j = 0; j < ytemp.size(); j++) yLocal[j] = ytemp[j];
 #endif
-    // TODO
+  }
+
+  //=============================================================================
+  void operator()(CItype *x, CItype *y) {
+    //-----------------------------------------------------------------------------
+    /*!
+    Calculate y = H.x from the sparse Hamiltonian
+
+    The owned rows from multiplyLocal are gathered on the root. Only commrank
+    0 gets y, the other processes leave it untouched.
+
+    :Inputs:
+        CItype *x:
+            The vector to multiply by H
+        CItype *y:
+            The vector H.x (output)
+    */
+    //-----------------------------------------------------------------------------
+    int size = commsize, rank = commrank;
+    vector<int> counts, displs;
+    rowCounts(counts, displs);
+    int numDets = displs[size-1] + counts[size-1];
+
+    vector<CItype> ylocal(max(counts[rank], 1), 0);
+    multiplyLocal(x, &ylocal[0]);
+
+#ifndef SERIAL
+#ifndef Complex
+    int ncomp = 1;
+#else
+    int ncomp = 2;
+#endif
+    vector<int> dcounts(size), ddispls(size);
+    for (int r = 0; r < size; r++) {
+      dcounts[r] = ncomp * counts[r];
+      ddispls[r] = ncomp * displs[r];
+    }
+    vector<CItype> yall(rank == 0 ? numDets : 1);
+    MPI_Gatherv(&ylocal[0], dcounts[rank], MPI_DOUBLE, &yall[0], &dcounts[0],
+                &ddispls[0], MPI_DOUBLE, 0, MPI_COMM_WORLD);
     if (rank == 0) {
-      auto end = std::chrono::system_clock::now();
-      std::chrono::duration<double> elapsed_seconds = end - start;
+      for (int j = 0; j < numDets; j++) y[j] = yall[displs[j % size] + j / size];
     }
+    MPI_Barrier(MPI_COMM_WORLD);
+#else
+    for (int j = 0; j < numDets; j++) y[j] = ylocal[j];
+#endif
   }  // operator
 };
 
@@ -355,9 +355,9 @@ void LCC::doLCC(
   int stop =Psi1nDets[0];
   for (int iclass=0; iclass<8; iclass++){
     for (int i=start; i<stop; i++)
-      for (int j=0; j<sparseHab.connections[i].size(); j++){
-        if (sparseHab.connections[i][j]>=start && sparseHab.connections[i][j]<stop)
-          sparseHab.Helements[i][j]=0.0;
+      for (size_t j=sparseHab.rowStart[i]; j<sparseHab.rowStart[i+1]; j++){
+        if (sparseHab.colIndex[j]>=start && sparseHab.colIndex[j]<stop)
+          sparseHab.values[j]=0.0;
     }
     start+=Psi1nDets[iclass];
     stop+=Psi1nDets[iclass+1];
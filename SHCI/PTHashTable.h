@@ -0,0 +1,148 @@
+/*
+  Developed by Sandeep Sharma with contributions from James E. T. Smith and Adam A. Holmes, 2017
+  Copyright (c) 2017, Sandeep Sharma
+
+  This file is part of DICE.
+
+  This program is free software: you can redistribute it and/or modify it under the terms
+  of the GNU General Public License as published by the Free Software Foundation,
+  either version 3 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+
+  See the GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License along with this program.
+  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef PT_HASHTABLE_H
+#define PT_HASHTABLE_H
+#include <vector>
+#include <mutex>
+#include <utility>
+#include "global.h"
+#include "Determinants.h"
+#include "robin_hood.h"
+#include "cdfci.h"
+
+using namespace std;
+
+// Accumulates the PT numerators sum_i H_ai c_i of the external determinants
+// a together with their diagonal energies. The table is split into shards,
+// each with its own lock, so all threads can insert concurrently.
+class PTHashTable {
+ public:
+  typedef robin_hood::unordered_flat_map<Determinant, std::pair<CItype, double>,
+                                         std::hash<Determinant>, std::equal_to<Determinant>> shard_type;
+
+  PTHashTable(int nshards = 257) : shards(nshards), locks(nshards) {}
+
+  int shardOf(const Determinant& d) const { return std::hash<Determinant>()(d) % shards.size(); }
+
+  void add(const Determinant& d, const CItype& num, double energy) {
+    int s = shardOf(d);
+    std::lock_guard<std::mutex> guard(locks[s]);
+    auto it = shards[s].find(d);
+    if (it == shards[s].end())
+      shards[s].emplace(d, std::make_pair(num, energy));
+    else
+      it->second.first += num;
+  }
+
+  size_t size() const {
+    size_t n = 0;
+    for (int s = 0; s < shards.size(); s++) n += shards[s].size();
+    return n;
+  }
+
+  void clear() {
+    for (int s = 0; s < shards.size(); s++) shard_type().swap(shards[s]);
+  }
+
+  //append the contents to the vectors and empty the table
+  void moveTo(vector<Determinant>& dets, vector<CItype>& num, vector<double>& energy) {
+    dets.reserve(dets.size() + size());
+    num.reserve(num.size() + size());
+    energy.reserve(energy.size() + size());
+    for (int s = 0; s < shards.size(); s++) {
+      for (auto& kv : shards[s]) {
+        dets.push_back(kv.first);
+        num.push_back(kv.second.first);
+        energy.push_back(kv.second.second);
+      }
+      shard_type().swap(shards[s]);
+    }
+  }
+
+  //second order energy sum_a |N_a|^2/(E0-E_a) and norm of the first order wavefunction
+  void evaluate(double E0, double& energyPT, double& psi1Norm) {
+    double e = 0.0, n = 0.0;
+#pragma omp parallel for schedule(dynamic) reduction(+:e,n)
+    for (int s = 0; s < shards.size(); s++) {
+      for (auto& kv : shards[s]) {
+        const CItype& num = kv.second.first;
+        double denominator = E0 - kv.second.second;
+        n += pow(abs(num / denominator), 2);
+        e += norm(num) / denominator;
+      }
+    }
+    energyPT += e;
+    psi1Norm += n;
+  }
+
+  vector<shard_type> shards;
+
+ private:
+  vector<std::mutex> locks;
+};
+
+// Sums of the semistochastic PT numerators of one external determinant over
+// all samples (A) and over the samples that are below epsilon2Large (B)
+struct StochasticPTEntry {
+  CItype num1A, num2A, num1B, num2B;
+  double energy;
+};
+
+// Open addressing table of the external determinants owned by this process
+// in a semistochastic PT iteration
+class StochasticPTHashTable {
+ public:
+  typedef robin_hood::unordered_flat_map<Determinant, StochasticPTEntry,
+                                         std::hash<Determinant>, std::equal_to<Determinant>> table_type;
+
+  void add(const Determinant& d, const CItype& num1, const CItype& num2, char present, double energy) {
+    auto it = table.find(d);
+    if (it == table.end()) {
+      StochasticPTEntry entry = {0., 0., 0., 0., energy};
+      it = table.emplace(d, entry).first;
+    }
+    StochasticPTEntry& entry = it->second;
+    entry.num1A += num1;
+    entry.num2A += num2;
+    if (present) {
+      entry.num1B += num1;
+      entry.num2B += num2;
+    }
+  }
+
+  size_t size() const { return table.size(); }
+
+  void clear() { table_type().swap(table); }
+
+  //the Epstein-Nesbet estimates with and without the large epsilon part
+  void evaluate(double E0, size_t Nmc, double& energyEN, double& energyENLargeEps) const {
+    double factor = double(Nmc) / (Nmc - 1);
+    for (auto& kv : table) {
+      const StochasticPTEntry& entry = kv.second;
+      double denominator = entry.energy - E0;
+      energyEN += (pow(abs(entry.num1A), 2) * factor - std::real(entry.num2A)) / denominator;
+      energyENLargeEps += (pow(abs(entry.num1B), 2) * factor - std::real(entry.num2B)) / denominator;
+    }
+  }
+
+ private:
+  table_type table;
+};
+
+#endif
@@ -426,7 +426,10 @@ int main(int argc, char* argv[]) {
   cout << Dets.size() << endl;
 
   if (schd.cdfci_on > 0 && schd.cdfci_on < schd.epsilon1.size()) {
-    cdfci::solve(schd, I1, I2, I2HBSHM, irrep, coreE, E0, ci, Dets);
+    if (schd.cdfciBlock > 0)
+      cdfci::parallel_solve(schd, I1, I2, I2HBSHM, irrep, coreE, E0, ci, Dets);
+    else
+      cdfci::solve(schd, I1, I2, I2HBSHM, irrep, coreE, E0, ci, Dets);
   }
 
 #ifndef SERIAL
@@ -743,8 +746,7 @@ root1, Heff(root1,root1), Heff(root2, root2), Heff(root1, root2), spinRDM);
       sprintf(file, "%s/%d-hamiltonian.bkp", schd.prefix[0].c_str(), commrank);
       std::ifstream ifs(file, std::ios::binary);
       boost::archive::binary_iarchive load(ifs);
-      load >> sparseHam.connections >> sparseHam.Helements >>
-          sparseHam.orbDifference;
+      load >> sparseHam;
     }
 
     vector<CItype*> ciroot(schd.nroots);
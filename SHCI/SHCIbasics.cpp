@@ -32,10 +32,13 @@
 #include <vector>
 #include <chrono>
 #include <thread>
+#include <numeric>
+#include <queue>
 #include "Davidson.h"
 #include "Determinants.h"
 #include "Hmult.h"
 #include "HmultDirect.h"
+#include "PTHashTable.h"
 #include "SHCISortMpiUtils.h"
 #include "SHCIgetdeterminants.h"
 //#include "SHCImakeHamiltonian.h"
@@ -56,6 +59,95 @@ using namespace Eigen;
 using namespace boost;
 using namespace SHCISortMpiUtils;
 
+// Sends the external determinants in uniqueDEH to the process owning their
+// hash and accumulates the ones received in table. Determinants of the
+// variational space are dropped before sending. uniqueDEH is emptied.
+static void exchangeStochasticPT(StitchDEH &uniqueDEH, Determinant *SortedDets,
+                                 int DetsSize, StochasticPTHashTable &table) {
+  vector<Determinant> &Det = *uniqueDEH.Det;
+  vector<CItype> &Num = *uniqueDEH.Num;
+  vector<CItype> &Num2 = *uniqueDEH.Num2;
+  vector<double> &Energy = *uniqueDEH.Energy;
+  vector<char> &present = *uniqueDEH.present;
+  int size = commsize;
+
+  vector<int> owner(Det.size(), -1);
+  vector<int> sendcts(size, 0);
+  for (size_t i = 0; i < Det.size(); i++) {
+    if (std::binary_search(SortedDets, SortedDets + DetsSize, Det[i])) continue;
+    owner[i] = Det[i].getHash() % size;
+    sendcts[owner[i]]++;
+  }
+
+  if (size == 1) {
+    for (size_t i = 0; i < Det.size(); i++)
+      if (owner[i] == 0) table.add(Det[i], Num[i], Num2[i], present[i], Energy[i]);
+    uniqueDEH.clear();
+    return;
+  }
+
+#ifndef SERIAL
+  vector<int> recvcts(size, 0), senddisp(size, 0), recvdisp(size, 0);
+  MPI_Alltoall(&sendcts[0], 1, MPI_INT, &recvcts[0], 1, MPI_INT, MPI_COMM_WORLD);
+  for (int r = 1; r < size; r++) {
+    senddisp[r] = senddisp[r - 1] + sendcts[r - 1];
+    recvdisp[r] = recvdisp[r - 1] + recvcts[r - 1];
+  }
+  int nsend = senddisp[size - 1] + sendcts[size - 1];
+  int nrecv = recvdisp[size - 1] + recvcts[size - 1];
+
+  vector<Determinant> sendDets(max(nsend, 1));
+  vector<CItype> sendNum(2 * max(nsend, 1));
+  vector<double> sendEnergy(max(nsend, 1));
+  vector<char> sendPresent(max(nsend, 1));
+  vector<int> counter = senddisp;
+  for (size_t i = 0; i < Det.size(); i++) {
+    if (owner[i] < 0) continue;
+    int k = counter[owner[i]]++;
+    sendDets[k] = Det[i];
+    sendNum[2 * k] = Num[i];
+    sendNum[2 * k + 1] = Num2[i];
+    sendEnergy[k] = Energy[i];
+    sendPresent[k] = present[i];
+  }
+  uniqueDEH.clear();
+
+  vector<Determinant> recvDets(max(nrecv, 1));
+  vector<CItype> recvNum(2 * max(nrecv, 1));
+  vector<double> recvEnergy(max(nrecv, 1));
+  vector<char> recvPresent(max(nrecv, 1));
+
+  // the determinants and numerators are sent as blocks of doubles
+  auto scaled = [&](const vector<int> &v, int factor) {
+    vector<int> s(v);
+    for (int r = 0; r < size; r++) s[r] *= factor;
+    return s;
+  };
+  int detDoubles = sizeof(Determinant) / sizeof(double);
+  int numDoubles = 2 * sizeof(CItype) / sizeof(double);
+  vector<int> sendctsDets = scaled(sendcts, detDoubles), senddispDets = scaled(senddisp, detDoubles);
+  vector<int> recvctsDets = scaled(recvcts, detDoubles), recvdispDets = scaled(recvdisp, detDoubles);
+  vector<int> sendctsNum = scaled(sendcts, numDoubles), senddispNum = scaled(senddisp, numDoubles);
+  vector<int> recvctsNum = scaled(recvcts, numDoubles), recvdispNum = scaled(recvdisp, numDoubles);
+
+  MPI_Alltoallv(&sendDets[0].repr[0], &sendctsDets[0], &senddispDets[0], MPI_DOUBLE,
+                &recvDets[0].repr[0], &recvctsDets[0], &recvdispDets[0], MPI_DOUBLE,
+                MPI_COMM_WORLD);
+  MPI_Alltoallv(&sendNum[0], &sendctsNum[0], &senddispNum[0], MPI_DOUBLE,
+                &recvNum[0], &recvctsNum[0], &recvdispNum[0], MPI_DOUBLE,
+                MPI_COMM_WORLD);
+  MPI_Alltoallv(&sendEnergy[0], &sendcts[0], &senddisp[0], MPI_DOUBLE,
+                &recvEnergy[0], &recvcts[0], &recvdisp[0], MPI_DOUBLE,
+                MPI_COMM_WORLD);
+  MPI_Alltoallv(&sendPresent[0], &sendcts[0], &senddisp[0], MPI_CHAR,
+                &recvPresent[0], &recvcts[0], &recvdisp[0], MPI_CHAR,
+                MPI_COMM_WORLD);
+
+  for (int k = 0; k < nrecv; k++)
+    table.add(recvDets[k], recvNum[2 * k], recvNum[2 * k + 1], recvPresent[k], recvEnergy[k]);
+#endif
+}
+
 <<<<<<< HEAD:SHCI/SHCIbasics.cpp
 double SHCIbasics::DoPerturbativeStochastic2SingleListDoubleEpsilon2AllTogether(
     Determinant *Dets, CItype *ci, int DetsSize, double &E0, oneInt &I1,
@@ -132,6 +224,7 @@ double SHCIbasics::DoPerturbativeStochastic2SingleListDoubleEpsilon2AllTogether(
                                              prob);
 
   StitchDEH uniqueDEH;
+  StochasticPTHashTable ptTable;
   double totalPT = 0.0;
   double totalPTLargeEps = 0;
   size_t ntries = 0;
@@ -149,7 +242,6 @@ double SHCIbasics::DoPerturbativeStochastic2SingleListDoubleEpsilon2AllTogether(
     std::vector<CItype> wts1(Nsample, 0.0);
     std::vector<int> Sample1(Nsample, -1);
     int ithrd = 0;
-    vector<size_t> all_to_all(size * size, 0);
 
     if (commrank == 0) {
       std::fill(allSample.begin(), allSample.end(), -1);
@@ -176,241 +268,27 @@ double SHCIbasics::DoPerturbativeStochastic2SingleListDoubleEpsilon2AllTogether(
     }
     double norm = 0.0;
 
-    for (int i = 0; i < distinctSample; i++) {
-      int I = Sample1[i];
-      SHCIgetdeterminants::getDeterminantsStochastic2Epsilon(
-          Dets[I], schd.epsilon2 / abs(ci[I]), schd.epsilon2Large / abs(ci[I]),
-          wts1[i], ci[I], I1, I2, I2HB, irrep, coreE, E0, *uniqueDEH.Det,
-          *uniqueDEH.Num, *uniqueDEH.Num2, *uniqueDEH.present,
-          *uniqueDEH.Energy, schd, Nmc, nelec);
-    }
-
-    if (commsize > 1) {
-      std::shared_ptr<vector<Determinant>> &Det = uniqueDEH.Det;
-      std::shared_ptr<vector<CItype>> &Num = uniqueDEH.Num;
-      std::shared_ptr<vector<CItype>> &Num2 = uniqueDEH.Num2;
-      std::shared_ptr<vector<double>> &Energy = uniqueDEH.Energy;
-      std::shared_ptr<vector<char>> &present = uniqueDEH.present;
-
-      std::vector<size_t> hashValues(Det->size());
-
-      std::vector<size_t> all_to_all_cumulative(size, 0);
-      for (int i = 0; i < Det->size(); i++) {
-        hashValues[i] = Det->at(i).getHash();
-        all_to_all[rank * size + hashValues[i] % size]++;
+    // expand the sampled references in batches and accumulate every external
+    // determinant on the process owning its hash, so only one batch of the
+    // raw external space is held at a time
+    int maxSample = (AllDistinctSample + size - 1) / size;
+    int batchSize = schd.ptBatchSize > 0 ? schd.ptBatchSize : max(maxSample, 1);
+    int nbatch = max((maxSample + batchSize - 1) / batchSize, 1);
+    for (int batch = 0; batch < nbatch; batch++) {
+      int end = min(distinctSample, (batch + 1) * batchSize);
+      for (int i = batch * batchSize; i < end; i++) {
+        int I = Sample1[i];
+        SHCIgetdeterminants::getDeterminantsStochastic2Epsilon(
+            Dets[I], schd.epsilon2 / abs(ci[I]), schd.epsilon2Large / abs(ci[I]),
+            wts1[i], ci[I], I1, I2, I2HB, irrep, coreE, E0, *uniqueDEH.Det,
+            *uniqueDEH.Num, *uniqueDEH.Num2, *uniqueDEH.present,
+            *uniqueDEH.Energy, schd, Nmc, nelec);
       }
-      for (int i = 0; i < size; i++)
-        all_to_all_cumulative[i] =
-            i == 0 ? all_to_all[rank * size + i]
-                   : all_to_all_cumulative[i - 1] + all_to_all[rank * size + i];
-
-      size_t dsize = Det->size() == 0 ? 1 : Det->size();
-      vector<Determinant> atoaDets(dsize);
-      vector<CItype> atoaNum(dsize);
-      vector<CItype> atoaNum2(dsize);
-      vector<double> atoaE(dsize);
-      vector<char> atoaPresent(dsize);
-
-#ifndef SERIAL
-      vector<size_t> all_to_allCopy = all_to_all;
-      MPI_Allreduce(&all_to_allCopy[0], &all_to_all[0], 2 * size * size,
-                    MPI_INT, MPI_SUM, MPI_COMM_WORLD);
-#endif
-      vector<size_t> counter(size, 0);
-      for (int i = 0; i < Det->size(); i++) {
-        int toProc = hashValues[i] % size;
-        size_t index =
-            toProc == 0 ? counter[0]
-                        : counter[toProc] + all_to_all_cumulative[toProc - 1];
-
-        atoaDets[index] = Det->at(i);
-        atoaNum[index] = Num->at(i);
-        atoaNum2[index] = Num2->at(i);
-        atoaE[index] = Energy->at(i);
-        atoaPresent[index] = present->at(i);
-
-        counter[toProc]++;
-      }
-
-      vector<int> sendcts(size, 0), senddisp(size, 0), recvcts(size, 0),
-          recvdisp(size, 0);
-      vector<int> sendctsDets(size, 0), senddispDets(size, 0),
-          recvctsDets(size, 0), recvdispDets(size, 0);
-      vector<int> sendctsPresent(size, 0), senddispPresent(size, 0),
-          recvctsPresent(size, 0), recvdispPresent(size, 0);
-
-      size_t recvSize = 0;
-      for (int i = 0; i < size; i++) {
-        sendcts[i] =
-            all_to_all[rank * size + i] * sizeof(CItype) / sizeof(double);
-        senddisp[i] = i == 0 ? 0 : senddisp[i - 1] + sendcts[i - 1];
-        recvcts[i] =
-            all_to_all[i * size + rank] * sizeof(CItype) / sizeof(double);
-        recvdisp[i] = i == 0 ? 0 : recvdisp[i - 1] + recvcts[i - 1];
-
-        sendctsDets[i] =
-            all_to_all[rank * size + i] * sizeof(Determinant) / sizeof(double);
-        senddispDets[i] = i == 0 ? 0 : senddispDets[i - 1] + sendctsDets[i - 1];
-        recvctsDets[i] =
-            all_to_all[i * size + rank] * sizeof(Determinant) / sizeof(double);
-        recvdispDets[i] = i == 0 ? 0 : recvdispDets[i - 1] + recvctsDets[i - 1];
-
-        sendctsPresent[i] = all_to_all[rank * size + i];
-        senddispPresent[i] =
-            i == 0 ? 0 : senddispPresent[i - 1] + sendctsPresent[i - 1];
-        recvctsPresent[i] = all_to_all[i * size + rank];
-        recvdispPresent[i] =
-            i == 0 ? 0 : recvdispPresent[i - 1] + recvctsPresent[i - 1];
-
-        recvSize += all_to_all[i * size + rank];
-      }
-
-      recvSize = recvSize == 0 ? 1 : recvSize;
-      Det->resize(recvSize), Num->resize(recvSize), Energy->resize(recvSize);
-      Num2->resize(recvSize), present->resize(recvSize);
-
-#ifndef SERIAL
-      MPI_Alltoallv(&atoaNum.at(0), &sendcts[0], &senddisp[0], MPI_DOUBLE,
-                    &Num->at(0), &recvcts[0], &recvdisp[0], MPI_DOUBLE,
-                    MPI_COMM_WORLD);
-      MPI_Alltoallv(&atoaNum2.at(0), &sendcts[0], &senddisp[0], MPI_DOUBLE,
-                    &Num2->at(0), &recvcts[0], &recvdisp[0], MPI_DOUBLE,
-                    MPI_COMM_WORLD);
-      MPI_Alltoallv(&atoaE.at(0), &sendctsPresent[0], &senddispPresent[0],
-                    MPI_DOUBLE, &Energy->at(0), &recvctsPresent[0],
-                    &recvdispPresent[0], MPI_DOUBLE, MPI_COMM_WORLD);
-      MPI_Alltoallv(&atoaPresent.at(0), &sendctsPresent[0], &senddispPresent[0],
-                    MPI_CHAR, &present->at(0), &recvctsPresent[0],
-                    &recvdispPresent[0], MPI_CHAR, MPI_COMM_WORLD);
-      MPI_Alltoallv(&atoaDets.at(0).repr[0], &sendctsDets[0], &senddispDets[0],
-                    MPI_DOUBLE, &(Det->at(0).repr[0]), &recvctsDets[0],
-                    &recvdispDets[0], MPI_DOUBLE, MPI_COMM_WORLD);
-#endif
+      exchangeStochasticPT(uniqueDEH, SortedDets, DetsSize, ptTable);
     }
-    uniqueDEH.MergeSort();
 
     double energyEN = 0.0, energyENLargeEps = 0.0;
-
-    vector<Determinant> &Psi1 = *uniqueDEH.Det;
-    vector<CItype> &numerator1A = *uniqueDEH.Num;
-    vector<CItype> &numerator2A = *uniqueDEH.Num2;
-    vector<char> &present = *uniqueDEH.present;
-    vector<double> &det_energy = *uniqueDEH.Energy;
-
-    CItype currentNum1A = 0.;
-    CItype currentNum2A = 0.;
-    CItype currentNum1B = 0.;
-    CItype currentNum2B = 0.;
-    size_t vec_it = 0, i = 0;
-
-    while (i < Psi1.size() && vec_it < DetsSize) {
-      if (Psi1[i] < SortedDets[vec_it]) {
-        currentNum1A += numerator1A[i];
-        currentNum2A += numerator2A[i];
-        if (present[i])
-        {
-          currentNum1B += numerator1A[i];
-          currentNum2B += numerator2A[i];
-        }
-
-        if (i == Psi1.size() - 1) {
-#ifndef Complex
-          energyEN +=
-              (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) - currentNum2A) /
-              (det_energy[i] - E0);
-          energyENLargeEps +=
-              (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) - currentNum2B) /
-              (det_energy[i] - E0);
-#else
-          energyEN += (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) -
-                       currentNum2A.real()) /
-                      (det_energy[i] - E0);
-          energyENLargeEps += (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) -
-                               currentNum2B.real()) /
-                              (det_energy[i] - E0);
-#endif
-        } else if (!(Psi1[i] == Psi1[i + 1])) {
-#ifndef Complex
-          energyEN +=
-              (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) - currentNum2A) /
-              (det_energy[i] - E0);
-          energyENLargeEps +=
-              (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) - currentNum2B) /
-              (det_energy[i] - E0);
-#else
-          energyEN += (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) -
-                       currentNum2A.real()) /
-                      (det_energy[i] - E0);
-          energyENLargeEps += (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) -
-                               currentNum2B.real()) /
-                              (det_energy[i] - E0);
-#endif
-          currentNum1A = 0.;
-          currentNum2A = 0.;
-          currentNum1B = 0.;
-          currentNum2B = 0.;
-        }
-        i++;
-      } else if (SortedDets[vec_it] < Psi1[i] && vec_it != DetsSize) {
-        vec_it++;
-      } else {
-        if (i == Psi1.size() - 1 || Psi1[i] == Psi1[i + 1]) {
-          i++;
-        } else {
-          vec_it++;
-          i++;
-        }
-      }
-    }
-
-    while (i < Psi1.size()) {
-      currentNum1A += numerator1A[i];
-      currentNum2A += numerator2A[i];
-      if (present[i])
-      {
-        currentNum1B += numerator1A[i];
-        currentNum2B += numerator2A[i];
-      }
-
-      if (i == Psi1.size() - 1) {
-#ifndef Complex
-        energyEN +=
-            (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) - currentNum2A) /
-            (det_energy[i] - E0);
-        energyENLargeEps +=
-            (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) - currentNum2B) /
-            (det_energy[i] - E0);
-#else
-        energyEN += (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) -
-                     currentNum2A.real()) /
-                    (det_energy[i] - E0);
-        energyENLargeEps += (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) -
-                             currentNum2B.real()) /
-                            (det_energy[i] - E0);
-#endif
-      } else if (!(Psi1[i] == Psi1[i + 1])) {
-#ifndef Complex
-        energyEN +=
-            (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) - currentNum2A) /
-            (det_energy[i] - E0);
-        energyENLargeEps +=
-            (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) - currentNum2B) /
-            (det_energy[i] - E0);
-#else
-        energyEN += (pow(abs(currentNum1A), 2) * Nmc / (Nmc - 1) -
-                     currentNum2A.real()) /
-                    (det_energy[i] - E0);
-        energyENLargeEps += (pow(abs(currentNum1B), 2) * Nmc / (Nmc - 1) -
-                             currentNum2B.real()) /
-                            (det_energy[i] - E0);
-#endif
-        currentNum1A = 0.;
-        currentNum2A = 0.;
-        currentNum1B = 0.;
-        currentNum2B = 0.;
-      }
-      i++;
-    }
+    ptTable.evaluate(E0, Nmc, energyEN, energyENLargeEps);
 
     totalPT = 0;
     totalPTLargeEps = 0;
@@ -468,7 +346,7 @@ double SHCIbasics::DoPerturbativeStochastic2SingleListDoubleEpsilon2AllTogether(
     MPI_Bcast(&AvgenergyEN, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
 #endif
 
-    uniqueDEH.clear();
+    ptTable.clear();
     if (stddev < schd.targetError)
     {
       AvgenergyEN /= currentIter;
@@ -493,6 +371,28 @@ double SHCIbasics::DoPerturbativeStochastic2SingleListDoubleEpsilon2AllTogether(
   return AvgenergyEN;
 }
 
+// Rough cost of getDeterminantsDeterministicPT for d: the singles plus the
+// heat bath integrals above epsilon for every occupied pair
+static double estimatePTConnections(Determinant &d, double epsilon,
+                                    twoIntHeatBathSHM &I2hb, int nelec) {
+  int norbs = d.norbs;
+  vector<int> closed(nelec, 0), open(norbs - nelec, 0);
+  d.getOpenClosed(open, closed);
+
+  double count = nelec * (norbs - nelec);
+  for (int i = 0; i < nelec; i++)
+    for (int j = 0; j < i; j++) {
+      int X = max(closed[i], closed[j]), Y = min(closed[i], closed[j]);
+      int pairIndex = X * (X + 1) / 2 + Y;
+      std::complex<double> *start = I2hb.integrals + I2hb.startingIndicesIntegrals[pairIndex];
+      std::complex<double> *end = I2hb.integrals + I2hb.startingIndicesIntegrals[pairIndex + 1];
+      // the integrals of a pair are sorted by decreasing magnitude
+      count += std::partition_point(start, end, [&](const std::complex<double> &v) {
+                 return std::abs(v) >= epsilon; }) - start;
+    }
+  return count;
+}
+
 double SHCIbasics::DoPerturbativeDeterministic(
     Determinant *Dets, CItype *ci, int DetsSize, double &E0, oneInt &I1,
     twoInt &I2, twoIntHeatBathSHM &I2HB, vector<int> &irrep, schedule &schd,
@@ -521,6 +421,7 @@ double SHCIbasics::DoPerturbativeDeterministic(
   double Psi1NormProc = 0.0;
 
   StitchDEH uniqueDEH;
+  PTHashTable ptTable;
   double totalPT = 0.0;
   int ntries = 0;
 
@@ -539,16 +440,54 @@ double SHCIbasics::DoPerturbativeDeterministic(
           *uniqueDEH.orbDifference_beforeMerge, schd, nelec);
     }
   } else {
+    // estimate the work of every determinant and hand them out largest first
+    // to the least loaded process
+    vector<double> cost(DetsSize, 0.0);
+#pragma omp parallel for schedule(dynamic, 64)
     for (int i = 0; i < DetsSize; i++) {
-      if ((i % size != rank)) continue;
-
-      SHCIgetdeterminants::getDeterminantsDeterministicPT(
-          Dets[i], schd.epsilon2 / abs(ci[i]), ci[i], 0.0, I1, I2, I2HB, irrep,
-          coreE, E0, *uniqueDEH.Det, *uniqueDEH.Num, *uniqueDEH.Energy, schd, 0,
-          nelec);
-      // if (i%100000 == 0 && omp_get_thread_num()==0 && commrank == 0) pout <<
-      // "# " << i << endl;
+      if (i % size != rank) continue;
+      cost[i] = 1.0 + estimatePTConnections(Dets[i], schd.epsilon2 / abs(ci[i]), I2HB, nelec);
     }
+#ifndef SERIAL
+    MPI_Allreduce(MPI_IN_PLACE, &cost[0], DetsSize, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    vector<int> order(DetsSize);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return cost[a] > cost[b]; });
+
+    vector<int> myDets;
+    std::priority_queue<pair<double, int>, vector<pair<double, int>>, std::greater<pair<double, int>>> load;
+    for (int r = 0; r < size; r++) load.push(make_pair(0.0, r));
+    for (int k = 0; k < DetsSize; k++) {
+      pair<double, int> least = load.top();
+      load.pop();
+      if (least.second == rank) myDets.push_back(order[k]);
+      load.push(make_pair(least.first + cost[order[k]], least.second));
+    }
+
+    // threads pick up determinants dynamically, largest first, and merge
+    // the connected external determinants straight into the shared table
+#pragma omp parallel
+    {
+      schedule schdThread = schd;  // the PT restrictions keep per determinant state
+      vector<Determinant> dets;
+      vector<CItype> num;
+      vector<double> energy;
+#pragma omp for schedule(dynamic, 1)
+      for (int k = 0; k < myDets.size(); k++) {
+        int i = myDets[k];
+        dets.clear(); num.clear(); energy.clear();
+        SHCIgetdeterminants::getDeterminantsDeterministicPT(
+            Dets[i], schd.epsilon2 / abs(ci[i]), ci[i], 0.0, I1, I2, I2HB, irrep,
+            coreE, E0, dets, num, energy, schdThread, 0, nelec);
+        for (size_t j = 0; j < dets.size(); j++) {
+          if (std::binary_search(SortedDets, SortedDets + DetsSize, dets[j])) continue;
+          ptTable.add(dets[j], num[j], energy[j]);
+        }
+      }
+    }
+    if (commsize > 1)
+      ptTable.moveTo(*uniqueDEH.Det, *uniqueDEH.Num, *uniqueDEH.Energy);
   }
 
   if (commsize > 1) {
@@ -668,18 +607,35 @@ double SHCIbasics::DoPerturbativeDeterministic(
 #endif
     uniqueDEH.Num2->clear();
   }
-  uniqueDEH.MergeSortAndRemoveDuplicates();
-  uniqueDEH.RemoveDetsPresentIn(SortedDets, DetsSize);
-
-  vector<Determinant> &hasHEDDets = *uniqueDEH.Det;
-  vector<CItype> &hasHEDNumerator = *uniqueDEH.Num;
-  vector<double> &hasHEDEnergy = *uniqueDEH.Energy;
 
   double PTEnergy = 0.0;
   double psi1normthrd = 0.0;
-  for (size_t i = 0; i < hasHEDDets.size(); i++) {
-    psi1normthrd += pow(abs(hasHEDNumerator[i] / (E0 - hasHEDEnergy[i])), 2);
-    PTEnergy += norm(hasHEDNumerator[i]) / (E0 - hasHEDEnergy[i]);
+  if (schd.DoRDM || schd.doResponse) {
+    uniqueDEH.MergeSortAndRemoveDuplicates();
+    uniqueDEH.RemoveDetsPresentIn(SortedDets, DetsSize);
+
+    vector<Determinant> &hasHEDDets = *uniqueDEH.Det;
+    vector<CItype> &hasHEDNumerator = *uniqueDEH.Num;
+    vector<double> &hasHEDEnergy = *uniqueDEH.Energy;
+
+    for (size_t i = 0; i < hasHEDDets.size(); i++) {
+      psi1normthrd += pow(abs(hasHEDNumerator[i] / (E0 - hasHEDEnergy[i])), 2);
+      PTEnergy += norm(hasHEDNumerator[i]) / (E0 - hasHEDEnergy[i]);
+    }
+  } else {
+    // the determinants received from the other processes all hash to this
+    // one, combine their contributions
+    if (commsize > 1) {
+      vector<Determinant> &Det = *uniqueDEH.Det;
+      vector<CItype> &Num = *uniqueDEH.Num;
+      vector<double> &Energy = *uniqueDEH.Energy;
+      size_t nrecv = 0;
+      for (int i = 0; i < size; i++) nrecv += all_to_all[i * size + rank];
+#pragma omp parallel for schedule(static)
+      for (size_t i = 0; i < nrecv; i++) ptTable.add(Det[i], Num[i], Energy[i]);
+      uniqueDEH.clear();
+    }
+    ptTable.evaluate(E0, PTEnergy, psi1normthrd);
   }
 
   Psi1NormProc += psi1normthrd;
@@ -820,13 +776,11 @@ void unpackTrevState(vector<Determinant> &Dets, int &DetsSize,
 }
 void print_memory_utility(schedule& schd, SparseHam& sparseHam, HamHelper4c & helper2, int DetsSize) {
   if (schd.DavidsonType == MEMORY) {
-    size_t element_count = 0;
-    for (int i=0; i < sparseHam.connections.size(); i++) {
-      element_count += sparseHam.connections[i].size();
-    }
-    size_t memory_count = (sizeof(int) + sizeof(CItype) + sizeof(size_t)) * element_count;
+    size_t element_count = sparseHam.nonZeros();
+    size_t value_size = sparseHam.singlePrecision ? sizeof(SparseHam::CItypeFloat) : sizeof(CItype);
+    size_t memory_count = (sizeof(int) + value_size) * element_count + sizeof(size_t) * (sparseHam.nrows() + 1);
     pout << " number of sparseHam elements " << element_count << endl;
-    pout << " number of determinants " << sparseHam.connections.size() << endl;
+    pout << " number of determinants " << sparseHam.nrows() << endl;
     pout << " estimated memory " << setw(12) << setprecision(1) << std::fixed << double(memory_count)/1024./1024. <<" MB" << endl;
     //pout << " memory by determinants : " << sparseHam.connections.size() * sizeof(Determinant) << endl;
     //pout << " time before davidson : " << getTime() - startofCalc << endl;
@@ -915,6 +869,7 @@ vector<double> SHCIbasics::DoVariational(vector<MatrixXx> &ci,
   // This helper object is kept here just in case
   SHCImake4cHamiltonian::HamHelper4c helper2;
   SHCImake4cHamiltonian::SparseHam sparseHam;
+  sparseHam.singlePrecision = schd.singlePrecisionHam;
   if (schd.DavidsonType == DISK)
   {
     sparseHam.diskio = true;
@@ -1267,6 +1222,9 @@ vector<double> SHCIbasics::DoVariational(vector<MatrixXx> &ci,
     if (schd.DavidsonType == DIRECT) {
       E0 = davidsonDirect(Hdirect, X0, diag, subspace, schd.davidsonTolLoose, numIter, schd.outputlevel>0);
     }
+    else if (schd.distributedDavidson) {
+      E0 = davidsonDistributed(H, X0, diag, subspace, schd.davidsonTolLoose, numIter, schd.outputlevel>0);
+    }
     else {
       E0 = davidson(H, X0, diag, subspace, schd.davidsonTolLoose, numIter, schd.outputlevel>0);
     }
@@ -1309,6 +1267,9 @@ vector<double> SHCIbasics::DoVariational(vector<MatrixXx> &ci,
       if (schd.DavidsonType == DIRECT)
         E0 = davidsonDirect(Hdirect, ci, diag, schd.nroots + 4,
                             schd.davidsonTol, numIter, true);
+      else if (schd.distributedDavidson)
+        E0 = davidsonDistributed(H, ci, diag, schd.nroots + 4,
+                                 schd.davidsonTol, numIter, false);
       else
         E0 = davidson(H, ci, diag, schd.nroots + 4, schd.davidsonTol, numIter,
                       false);
@@ -1321,6 +1282,9 @@ vector<double> SHCIbasics::DoVariational(vector<MatrixXx> &ci,
     if (schd.DavidsonType == DIRECT) {
       E0 = davidsonDirect(Hdirect, ci, diag, schd.nroots+2, schd.davidsonTol, numIter, schd.outputlevel>0);
     }
+    else if (schd.distributedDavidson) {
+      E0 = davidsonDistributed(H, ci, diag, subspace, schd.davidsonTol, numIter, schd.outputlevel>0);
+    }
     else {
       E0 = davidson(H, ci, diag, subspace, schd.davidsonTol, numIter, schd.outputlevel>0);
     }
@@ -1605,8 +1569,7 @@ void SHCIbasics::writeVariationalResult(
     sprintf(file, "%s/%d-hamiltonian.bkp", schd.prefix[0].c_str(), commrank);
     std::ofstream ofs(file, std::ios::binary);
     boost::archive::binary_oarchive save(ofs);
-    save << sparseHam.connections << sparseHam.Helements
-         << sparseHam.orbDifference;
+    save << sparseHam;
   }
 
   //if (commrank == 0)
@@ -1677,8 +1640,7 @@ void SHCIbasics::readVariationalResult(
     sprintf (file, "%s/%d-hamiltonian.bkp", schd.prefix[0].c_str(), commrank );
     std::ifstream ifs(file, std::ios::binary);
     boost::archive::binary_iarchive load(ifs);
-    load >> sparseHam.connections >> sparseHam.Helements
-         >>sparseHam.orbDifference;
+    load >> sparseHam;
   }
   
 
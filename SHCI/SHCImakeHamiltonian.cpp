@@ -26,6 +26,11 @@
 #include <boost/serialization/set.hpp>
 #include <boost/serialization/shared_ptr.hpp>
 #include <boost/serialization/vector.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstring>
 #include <fstream>
 #include <map>
 #include <tuple>
@@ -181,114 +186,88 @@ void SHCImakeHamiltonian::regenerateH(
 }  // end SHCImakeHamiltonian::regenerateH
 
 //=============================================================================
-void updateAlphaBeta(HalfDet& da, HalfDet& db, std::map<HalfDet, int>& BetaN,
-                     std::map<HalfDet, int>& AlphaN,
-                     vector<vector<int>>& AlphaMajorToBeta,
-                     vector<vector<int>>& AlphaMajorToDet,
-                     vector<vector<int>>& BetaMajorToAlpha,
-                     vector<vector<int>>& BetaMajorToDet,
-                     vector<vector<int>>& SinglesFromAlpha,
-                     vector<vector<int>>& SinglesFromBeta, Determinant* Dets,
-                     int DetsSize, int StartIndex, int DetIndex) {
+int indexHalfDet(HalfDet& d, SHCImakeHamiltonian::HalfDetIndex& index,
+                 vector<vector<int>>& MajorToOther,
+                 vector<vector<int>>& MajorToDet) {
   //-----------------------------------------------------------------------------
   /*!
-  BM_description
+  Return the index of the string d, adding it if it is new
 
   :Inputs:
 
-      HalfDet &da:
-          BM_description
-      HalfDet &db:
-          BM_description
-      std::map<HalfDet,int>& BetaN:
-          BM_description
-      std::map<HalfDet,int>& AlphaN:
-          BM_description
-      vector<vector<int>>& AlphaMajorToBeta:
-          BM_description
-      vector<vector<int>>& AlphaMajorToDet:
-          BM_description
-      vector<vector<int>>& BetaMajorToAlpha:
-          BM_description
-      vector<vector<int>>& BetaMajorToDet:
-          BM_description
-      vector<vector<int>>& SinglesFromAlpha:
-          BM_description
-      vector<vector<int>>& SinglesFromBeta:
-          BM_description
-      Determinant *Dets:
-          The determinants of the basis
-      int DetsSize:
-          Number of determinants in the basis
-      int StartIndex:
-          BM_description
-      int DetIndex:
-          BM_description
+      HalfDet &d:
+          Alpha or beta string
+      HalfDetIndex& index:
+          Indices of the strings seen so far
+      vector<vector<int>>& MajorToOther:
+          AlphaMajorToBeta or BetaMajorToAlpha, grown for a new string
+      vector<vector<int>>& MajorToDet:
+          AlphaMajorToDet or BetaMajorToDet, grown for a new string
   */
   //-----------------------------------------------------------------------------
-  auto itb = BetaN.find(db);
-  if (itb == BetaN.end()) {
-    auto ret = BetaN.insert(std::pair<HalfDet, int>(db, BetaMajorToDet.size()));
-    itb = ret.first;
-    BetaMajorToAlpha.resize(itb->second + 1);
-    BetaMajorToDet.resize(itb->second + 1);
-    SinglesFromBeta.resize(itb->second + 1);
-
-    int norbs = 64 * DetLen;
-    std::vector<int> closedb(norbs / 2);  //, closedb(norbs);
-    std::vector<int> openb(norbs / 2, 0);
-    int nclosedb = db.getOpenClosed(openb, closedb);
-
-    for (int j = 0; j < nclosedb; j++)
-      for (int k = 0; k < norbs / 2 - nclosedb; k++) {
-        HalfDet dbcopy = db;
-        dbcopy.setocc(closedb[j], false);
-        dbcopy.setocc(openb[k], true);
-        auto itbcopy = BetaN.find(dbcopy);
-        if (itbcopy != BetaN.end()) {
-          SinglesFromBeta[itb->second].push_back(itbcopy->second);
-          SinglesFromBeta[itbcopy->second].push_back(itb->second);
-        }
-      }
-  }  // itb
-
-  auto ita = AlphaN.find(da);
-  if (ita == AlphaN.end()) {
-    auto ret =
-        AlphaN.insert(std::pair<HalfDet, int>(da, AlphaMajorToDet.size()));
-    ita = ret.first;
-    AlphaMajorToBeta.resize(ita->second + 1);
-    AlphaMajorToDet.resize(ita->second + 1);
-    SinglesFromAlpha.resize(ita->second + 1);
-
-    int norbs = 64 * DetLen;
-    std::vector<int> closeda(norbs / 2);  //, closedb(norbs);
-    std::vector<int> opena(norbs / 2, 0);
-    int ncloseda = da.getOpenClosed(opena, closeda);
-
-    for (int j = 0; j < ncloseda; j++)
-      for (int k = 0; k < norbs / 2 - ncloseda; k++) {
-        HalfDet dacopy = da;
-        dacopy.setocc(closeda[j], false);
-        dacopy.setocc(opena[k], true);
-        auto itacopy = AlphaN.find(dacopy);
-        if (itacopy != AlphaN.end()) {
-          SinglesFromAlpha[ita->second].push_back(itacopy->second);
-          SinglesFromAlpha[itacopy->second].push_back(ita->second);
-        }
-      }
-  }  // ita
+  auto ret = index.emplace(d, int(MajorToDet.size()));
+  if (ret.second) {
+    MajorToOther.resize(MajorToDet.size() + 1);
+    MajorToDet.resize(MajorToDet.size() + 1);
+  }
+  return ret.first->second;
+}  // end indexHalfDet
+
+//=============================================================================
+void updateSingles(SHCImakeHamiltonian::HalfDetIndex& index, int firstNew,
+                   vector<vector<int>>& Singles) {
+  //-----------------------------------------------------------------------------
+  /*!
+  Add the single excitation connections of the strings with index >= firstNew.
+  The strings are looked up in parallel, the read-only index is shared.
 
-  AlphaMajorToBeta[ita->second].push_back(itb->second);
-  AlphaMajorToDet[ita->second].push_back(DetIndex);
+  :Inputs:
+
+      HalfDetIndex& index:
+          Indices of all the strings
+      int firstNew:
+          Index of the first string added in this iteration
+      vector<vector<int>>& Singles:
+          SinglesFromAlpha or SinglesFromBeta
+  */
+  //-----------------------------------------------------------------------------
+  int nstrings = index.size();
+  Singles.resize(nstrings);
+  if (firstNew == nstrings) return;
+
+  vector<HalfDet> newStrings(nstrings - firstNew);
+  for (auto& kv : index)
+    if (kv.second >= firstNew) newStrings[kv.second - firstNew] = kv.first;
+
+  int norbs = 64 * DetLen;
+#pragma omp parallel for schedule(dynamic, 64)
+  for (int n = 0; n < newStrings.size(); n++) {
+    HalfDet& d = newStrings[n];
+    std::vector<int> closed(norbs / 2);
+    std::vector<int> open(norbs / 2, 0);
+    int nclosed = d.getOpenClosed(open, closed);
+
+    vector<int>& singles = Singles[firstNew + n];
+    for (int j = 0; j < nclosed; j++)
+      for (int k = 0; k < norbs / 2 - nclosed; k++) {
+        HalfDet dcopy = d;
+        dcopy.setocc(closed[j], false);
+        dcopy.setocc(open[k], true);
+        auto it = index.find(dcopy);
+        if (it != index.end()) singles.push_back(it->second);
+      }
+  }
 
-  BetaMajorToAlpha[itb->second].push_back(ita->second);
-  BetaMajorToDet[itb->second].push_back(DetIndex);
-}  // end updateAlphaBeta
+  // the strings already present only need the links to the new ones, the
+  // links between new strings were found from both ends above
+  for (int n = firstNew; n < nstrings; n++)
+    for (int m : Singles[n])
+      if (m < firstNew) Singles[m].push_back(n);
+}  // end updateSingles
 
 //=============================================================================
 void SHCImakeHamiltonian::PopulateHelperLists2(
-    std::map<HalfDet, int>& BetaN, std::map<HalfDet, int>& AlphaN,
+    HalfDetIndex& BetaN, HalfDetIndex& AlphaN,
     vector<vector<int>>& AlphaMajorToBeta, vector<vector<int>>& AlphaMajorToDet,
     vector<vector<int>>& BetaMajorToAlpha, vector<vector<int>>& BetaMajorToDet,
     vector<vector<int>>& SinglesFromAlpha, vector<vector<int>>& SinglesFromBeta,
@@ -303,12 +282,15 @@ void SHCImakeHamiltonian::PopulateHelperLists2(
   and the 2j and 2j+1 elements of this ith vector are the indices of
   the beta string and the determinant, respectively
 
+  The string indices are kept across iterations, so only the determinants from
+  StartIndex on are hashed and only the new strings search for singles.
+
   :Inputs:
 
-      std::map<HalfDet,int>& BetaN:
-          BM_description
-      std::map<HalfDet,int>& AlphaN:
-          BM_description
+      HalfDetIndex& BetaN:
+          Indices of the beta strings
+      HalfDetIndex& AlphaN:
+          Indices of the alpha strings
       vector<vector<int>>& AlphaMajorToBeta:
           BM_description
       vector<vector<int>>& AlphaMajorToDet:
@@ -333,25 +315,33 @@ void SHCImakeHamiltonian::PopulateHelperLists2(
   boost::mpi::communicator world;
 #endif
   if (commrank == 0) {
+    int firstNewAlpha = AlphaMajorToDet.size();
+    int firstNewBeta = BetaMajorToDet.size();
+    AlphaN.reserve(AlphaN.size() + DetsSize - StartIndex);
+    BetaN.reserve(BetaN.size() + DetsSize - StartIndex);
+
     for (int i = StartIndex; i < DetsSize; i++) {
       HalfDet da = Dets[i].getAlpha(), db = Dets[i].getBeta();
-      int sgn = 1;
-      updateAlphaBeta(da, db, BetaN, AlphaN, AlphaMajorToBeta, AlphaMajorToDet,
-                      BetaMajorToAlpha, BetaMajorToDet, SinglesFromAlpha,
-                      SinglesFromBeta, Dets, DetsSize, StartIndex,
-                      sgn * (i + 1));
-
-      if (Determinant::Trev != 0 && Dets[i].hasUnpairedElectrons()) {
-        int sgn = -1;
-        updateAlphaBeta(db, da, BetaN, AlphaN, AlphaMajorToBeta,
-                        AlphaMajorToDet, BetaMajorToAlpha, BetaMajorToDet,
-                        SinglesFromAlpha, SinglesFromBeta, Dets, DetsSize,
-                        StartIndex, sgn * (i + 1));
+      for (int sgn = 1; sgn >= -1; sgn -= 2) {
+        int ia = indexHalfDet(da, AlphaN, AlphaMajorToBeta, AlphaMajorToDet);
+        int ib = indexHalfDet(db, BetaN, BetaMajorToAlpha, BetaMajorToDet);
+        AlphaMajorToBeta[ia].push_back(ib);
+        AlphaMajorToDet[ia].push_back(sgn * (i + 1));
+        BetaMajorToAlpha[ib].push_back(ia);
+        BetaMajorToDet[ib].push_back(sgn * (i + 1));
+
+        // time reversal partner
+        if (Determinant::Trev == 0 || !Dets[i].hasUnpairedElectrons()) break;
+        std::swap(da, db);
       }
     }
+
+    updateSingles(AlphaN, firstNewAlpha, SinglesFromAlpha);
+    updateSingles(BetaN, firstNewBeta, SinglesFromBeta);
     // printf("Nalpha: %12d,  Nbeta: %12d\n", AlphaN.size(), BetaN.size());
 
     size_t max = 0, min = 0, avg = 0;
+#pragma omp parallel for schedule(dynamic, 64)
     for (int i = 0; i < AlphaMajorToBeta.size(); i++) {
       vector<int> betacopy = AlphaMajorToBeta[i];
       vector<int> detIndex(betacopy.size(), 0),
@@ -365,6 +355,7 @@ void SHCImakeHamiltonian::PopulateHelperLists2(
       std::sort(SinglesFromAlpha[i].begin(), SinglesFromAlpha[i].end());
     }
 
+#pragma omp parallel for schedule(dynamic, 64)
     for (int i = 0; i < BetaMajorToAlpha.size(); i++) {
       vector<int> betacopy = BetaMajorToAlpha[i];
       vector<int> detIndex(betacopy.size(), 0),
@@ -756,6 +747,9 @@ void SHCImakeHamiltonian::MakeHfromSMHelpers2(
 
     }  // i
   }    // ii
+
+  // the new rows are complete, move them into the CSR arrays used by Hmult2
+  sparseHam.compress(DoRDM);
 }  // end SHCImakeHamiltonian::MakeHfromSMHelpers2
 
 //=============================================================================
@@ -1034,6 +1028,57 @@ void SHCImakeHamiltonian::updateSOCconnections(
   }  // x
 }  // end SHCImakeHamiltonian::updateSOCconnections
 
+//=============================================================================
+void SHCImakeHamiltonian::SparseHam::compress(bool keepRows) {
+  //-----------------------------------------------------------------------------
+  /*!
+  Append the rows of "connections" and "Helements" that are not yet in the CSR
+  arrays. Rows are only ever added for new determinants, and a row is complete
+  once it has been added, so the CSR arrays grow by appending.
+
+  :Inputs:
+
+      bool keepRows:
+          Keep the per-row lists after compression (needed by the RDM code,
+          which walks "connections" together with "orbDifference")
+  */
+  //-----------------------------------------------------------------------------
+  int firstRow = totalRows();
+  if (rowStart.empty()) rowStart.push_back(0);
+
+  size_t nnz = rowStart.back();
+  for (int i = firstRow; i < connections.size(); i++)
+    nnz += connections[i].size();
+
+  rowStart.reserve(connections.size() + 1);
+  colIndex.reserve(nnz);
+  if (singlePrecision)
+    valuesFloat.reserve(nnz);
+  else
+    values.reserve(nnz);
+
+  for (int i = firstRow; i < connections.size(); i++) {
+    for (int j = 0; j < connections[i].size(); j++) {
+      colIndex.push_back(connections[i][j]);
+      if (singlePrecision)
+        valuesFloat.push_back(CItypeFloat(Helements[i][j]));
+      else
+        values.push_back(Helements[i][j]);
+    }
+    rowStart.push_back(colIndex.size());
+    if (!keepRows) {
+      // keep the (empty) row so that connections.size() is still the number
+      // of local determinants
+      std::vector<int>().swap(connections[i]);
+      std::vector<CItype>().swap(Helements[i]);
+    }
+  }
+
+  if (diskio) {
+    while (nrows() >= BatchSize) writeBatch(batchesOnDisk);
+  }
+}  // end SHCImakeHamiltonian::SparseHam::compress
+
 //=============================================================================
 void SHCImakeHamiltonian::SparseHam::setNbatches(int DetSize) {
   //-----------------------------------------------------------------------------
@@ -1055,42 +1100,181 @@ void SHCImakeHamiltonian::SparseHam::setNbatches(int DetSize) {
   if ((DetSize) > Nbatches * BatchSize * nprocs && diskio) Nbatches += 1;
 }  // end SHCImakeHamiltonian::SparseHam::setNbatches
 
+// layout of a batch file: the header, the values, the row lengths and the
+// zigzag/varint encoded differences between consecutive column indices
+struct BatchHeader {
+  int64_t nnz;
+  int64_t colBytes;
+  int32_t firstRow;
+  int32_t nrows;
+  int32_t valueBytes;
+  int32_t pad;  // keeps the values 16 byte aligned
+};
+
 //=============================================================================
 void SHCImakeHamiltonian::SparseHam::writeBatch(int batch) {
   //-----------------------------------------------------------------------------
   /*!
-  BM_description
+  Move the first BatchSize rows of the CSR arrays into a batch file
+
+  Within a row the columns are stored as differences from the previous column
+  (starting from the row's own determinant), zigzag mapped and written as
+  variable length integers. Most connections are to nearby determinants, so
+  this typically takes one or two bytes instead of four.
 
   :Inputs:
 
       int batch:
-          BM_description
+          Index of the batch file
   */
   //-----------------------------------------------------------------------------
+  int nr = min(BatchSize, nrows());
+  size_t nnz = rowStart[nr];
+  size_t valueBytes = singlePrecision ? sizeof(CItypeFloat) : sizeof(CItype);
+
+  std::vector<int32_t> rowLength(nr);
+  std::vector<unsigned char> cols;
+  cols.reserve(2 * nnz);
+  for (int i = 0; i < nr; i++) {
+    rowLength[i] = rowStart[i + 1] - rowStart[i];
+    int64_t prev = (int64_t)(rowsOnDisk + i) * commsize + commrank;
+    for (size_t p = rowStart[i]; p < rowStart[i + 1]; p++) {
+      int64_t d = colIndex[p] - prev;
+      uint64_t z = (uint64_t(d) << 1) ^ uint64_t(d >> 63);
+      while (z >= 0x80) {
+        cols.push_back((unsigned char)(z | 0x80));
+        z >>= 7;
+      }
+      cols.push_back((unsigned char)z);
+      prev = colIndex[p];
+    }
+  }
+
+  BatchHeader header;
+  header.nnz = nnz;
+  header.colBytes = cols.size();
+  header.firstRow = rowsOnDisk;
+  header.nrows = nr;
+  header.valueBytes = valueBytes;
+  header.pad = 0;
+
   char file[5000];
   sprintf(file, "%s/%d-hamiltonian-batch%d.bkp", prefix.c_str(), commrank,
           batch);
   std::ofstream ofs(file, std::ios::binary);
-  boost::archive::binary_oarchive save(ofs);
-  save << connections << Helements << orbDifference;
+  ofs.write((char*)&header, sizeof(header));
+  if (singlePrecision)
+    ofs.write((char*)&valuesFloat[0], nnz * valueBytes);
+  else
+    ofs.write((char*)&values[0], nnz * valueBytes);
+  ofs.write((char*)&rowLength[0], nr * sizeof(int32_t));
+  ofs.write((char*)&cols[0], cols.size());
+  ofs.close();
+  if (!ofs) {
+    pout << "Could not write Hamiltonian batch " << file << endl;
+    exit(0);
+  }
+
+  // drop the rows from memory
+  colIndex.erase(colIndex.begin(), colIndex.begin() + nnz);
+  if (singlePrecision)
+    valuesFloat.erase(valuesFloat.begin(), valuesFloat.begin() + nnz);
+  else
+    values.erase(values.begin(), values.begin() + nnz);
+  rowStart.erase(rowStart.begin(), rowStart.begin() + nr);
+  for (int i = 0; i < rowStart.size(); i++) rowStart[i] -= nnz;
+
+  rowsOnDisk += nr;
+  batchesOnDisk = batch + 1;
 }  // end SHCImakeHamiltonian::SparseHam::writeBatch
 
 //=============================================================================
-void SHCImakeHamiltonian::SparseHam::readBatch(int batch) {
+void SHCImakeHamiltonian::SparseHam::readBatch(int batch,
+                                               HamiltonianBatch& hb) {
   //-----------------------------------------------------------------------------
   /*!
-  BM_description
+  Map a batch file written by writeBatch
 
   :Inputs:
 
       int batch:
-          BM_description
+          Index of the batch file
+      HamiltonianBatch& hb:
+          The mapped batch (output)
   */
   //-----------------------------------------------------------------------------
   char file[5000];
   sprintf(file, "%s/%d-hamiltonian-batch%d.bkp", prefix.c_str(), commrank,
           batch);
-  std::ifstream ifs(file, std::ios::binary);
-  boost::archive::binary_iarchive load(ifs);
-  load >> connections >> Helements >> orbDifference;
+  hb.load(file);
 }  // end SHCImakeHamiltonian::SparseHam::readBatch
+
+//=============================================================================
+void SHCImakeHamiltonian::HamiltonianBatch::load(const char* file) {
+  //-----------------------------------------------------------------------------
+  /*!
+  Map the file and decode the column indices, the values are read in place
+
+  :Inputs:
+
+      const char* file:
+          Name of the batch file
+  */
+  //-----------------------------------------------------------------------------
+  release();
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    pout << "Could not open Hamiltonian batch " << file << endl;
+    exit(0);
+  }
+  mapSize = st.st_size;
+  map = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    map = NULL;
+    pout << "Could not map Hamiltonian batch " << file << endl;
+    exit(0);
+  }
+  madvise(map, mapSize, MADV_SEQUENTIAL);
+
+  const char* data = (const char*)map;
+  BatchHeader header;
+  memcpy(&header, data, sizeof(header));
+  firstRow = header.firstRow;
+  nrows = header.nrows;
+  nnz = header.nnz;
+  valueBytes = header.valueBytes;
+  values = data + sizeof(header);
+  const int32_t* rowLength = (const int32_t*)(values + nnz * valueBytes);
+  const unsigned char* cols = (const unsigned char*)(rowLength + nrows);
+
+  rowStart.resize(nrows + 1);
+  colIndex.resize(nnz);
+  rowStart[0] = 0;
+  size_t p = 0;
+  for (int i = 0; i < nrows; i++) {
+    rowStart[i + 1] = rowStart[i] + rowLength[i];
+    int64_t prev = (int64_t)(firstRow + i) * commsize + commrank;
+    for (; p < rowStart[i + 1]; p++) {
+      uint64_t z = 0;
+      int shift = 0;
+      while (*cols & 0x80) {
+        z |= uint64_t(*cols++ & 0x7f) << shift;
+        shift += 7;
+      }
+      z |= uint64_t(*cols++) << shift;
+      prev += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+      colIndex[p] = prev;
+    }
+  }
+}  // end SHCImakeHamiltonian::HamiltonianBatch::load
+
+//=============================================================================
+void SHCImakeHamiltonian::HamiltonianBatch::release() {
+  if (map != NULL) munmap(map, mapSize);
+  map = NULL;
+  values = NULL;
+  nrows = 0;
+  nnz = 0;
+}  // end SHCImakeHamiltonian::HamiltonianBatch::release
@@ -21,13 +21,17 @@
 #ifndef SHCI_MAKEHAMILTONIAN_H
 #define SHCI_MAKEHAMILTONIAN_H
 #include <Eigen/Dense>
+#include <boost/serialization/complex.hpp>
 #include <boost/serialization/serialization.hpp>
+#include <boost/serialization/vector.hpp>
 #include <list>
 #include <map>
 #include <set>
 #include <tuple>
 #include <vector>
+#include "Determinants.h"
 #include "global.h"
+#include "robin_hood.h"
 
 using namespace std;
 using namespace Eigen;
@@ -41,6 +45,18 @@ class schedule;
 
 namespace SHCImakeHamiltonian {
 
+struct HalfDetHash {
+  std::size_t operator()(const HalfDet& d) const {
+    std::size_t h = 0;
+    for (int i = 0; i < DetLen / 2; i++) h = h * 2038076783 + d.repr[i];
+    return h;
+  }
+};
+
+// index of each distinct alpha (beta) string of the variational space
+typedef robin_hood::unordered_flat_map<HalfDet, int, HalfDetHash,
+                                       std::equal_to<HalfDet>> HalfDetIndex;
+
 struct HamHelpers2 {
   vector<vector<int>> AlphaMajorToBeta;
   vector<vector<int>> AlphaMajorToDet;
@@ -48,8 +64,8 @@ struct HamHelpers2 {
   vector<vector<int>> BetaMajorToDet;
   vector<vector<int>> SinglesFromAlpha;
   vector<vector<int>> SinglesFromBeta;
-  map<HalfDet, int> BetaN;
-  map<HalfDet, int> AlphaN;
+  HalfDetIndex BetaN;
+  HalfDetIndex AlphaN;
 
   // Shared Memory stuff
   int* AlphaMajorToBetaLen;
@@ -81,17 +97,60 @@ struct HamHelpers2 {
   }
 };  // HamHelpers2
 
+// One batch of CSR rows written by SparseHam::writeBatch, memory mapped for
+// reading. The values are used in place, the delta encoded column indices
+// are decoded into colIndex.
+struct HamiltonianBatch {
+  int firstRow;  // local index of the first row in the batch
+  int nrows;
+  size_t nnz;
+  int valueBytes;  // sizeof(CItype) or sizeof(SparseHam::CItypeFloat)
+  std::vector<size_t> rowStart;
+  std::vector<int> colIndex;
+  const char* values;
+  void* map;
+  size_t mapSize;
+
+  HamiltonianBatch() : nrows(0), nnz(0), values(NULL), map(NULL), mapSize(0) {}
+  ~HamiltonianBatch() { release(); }
+
+  void load(const char* file);
+  void release();
+};  // HamiltonianBatch
+
 struct SparseHam {
+#ifdef Complex
+  typedef std::complex<float> CItypeFloat;
+#else
+  typedef float CItypeFloat;
+#endif
+  // per-row build lists, filled by MakeHfromSMHelpers2 and released once the
+  // rows have been compressed (unless they are needed for the RDMs)
   std::vector<std::vector<int>> connections;
   std::vector<std::vector<CItype>> Helements;
   std::vector<std::vector<size_t>> orbDifference;
+
+  // lower triangle in CSR form, local row i is determinant i*nprocs+proc
+  std::vector<size_t> rowStart;
+  std::vector<int> colIndex;
+  std::vector<CItype> values;
+  std::vector<CItypeFloat> valuesFloat;  // replaces values if singlePrecision
+  bool singlePrecision;
+
   int Nbatches;
   int BatchSize;
   bool diskio;
   string prefix;
+  // with diskio, full batches of BatchSize rows are moved out of the CSR
+  // arrays into batch files, the arrays then hold the rows after rowsOnDisk
+  int batchesOnDisk;
+  int rowsOnDisk;
   SparseHam() {
     diskio = false;
     Nbatches = 1;
+    singlePrecision = false;
+    batchesOnDisk = 0;
+    rowsOnDisk = 0;
   }
 
   // routines
@@ -99,12 +158,34 @@ struct SparseHam {
     connections.clear();
     Helements.clear();
     orbDifference.clear();
+    rowStart.clear();
+    colIndex.clear();
+    values.clear();
+    valuesFloat.clear();
+    batchesOnDisk = 0;
+    rowsOnDisk = 0;
   }
 
   void resize(int size) {
     connections.resize(size);
     Helements.resize(size);
     orbDifference.resize(size);
+    if (size == 0) clear();
+  }
+
+  int nrows() const { return rowStart.empty() ? 0 : rowStart.size() - 1; }
+
+  int totalRows() const { return rowsOnDisk + nrows(); }
+
+  size_t nonZeros() const { return rowStart.empty() ? 0 : rowStart.back(); }
+
+  void compress(bool keepRows);
+
+  template <class Archive>
+  void serialize(Archive& ar, const unsigned int version) {
+    ar& connections& Helements& orbDifference;
+    ar& rowStart& colIndex& values& valuesFloat& singlePrecision;
+    ar& batchesOnDisk& rowsOnDisk;
   }
 
   void makeFromHelper(HamHelpers2& helper2, Determinant* SHMDets,
@@ -113,7 +194,7 @@ struct SparseHam {
 
   void writeBatch(int batch);
 
-  void readBatch(int batch);
+  void readBatch(int batch, HamiltonianBatch& hb);
 
   void setNbatches(int DetSize);
 };  // SparseHam
@@ -127,7 +208,7 @@ void regenerateH(std::vector<Determinant>& Dets,
                  twoInt& I2, double& coreE);
 
 void PopulateHelperLists2(
-    std::map<HalfDet, int>& BetaN, std::map<HalfDet, int>& AlphaN,
+    HalfDetIndex& BetaN, HalfDetIndex& AlphaN,
     vector<vector<int>>& AlphaMajorToBeta, vector<vector<int>>& AlphaMajorToDet,
     vector<vector<int>>& BetaMajorToAlpha, vector<vector<int>>& BetaMajorToDet,
     vector<vector<int>>& SinglesFromAlpha, vector<vector<int>>& SinglesFromBeta,
@@ -1416,6 +1416,52 @@ int genIdx(const int &a, const int &b, const int &c, const size_t &norbs) {
   return a * norbs * norbs + b * norbs + c;
 }
 
+// Sums an RDM over the processes onto the root, in pieces so that the MPI
+// counts fit in an int even for the spin 4RDM
+void reduceRDM(MatrixXx &rdm) {
+#ifndef SERIAL
+  double *data = reinterpret_cast<double *>(rdm.data());
+  size_t size = rdm.size() * sizeof(CItype) / sizeof(double);
+  size_t chunk = size_t(1) << 27;
+  for (size_t start = 0; start < size; start += chunk) {
+    int count = min(chunk, size - start);
+    if (commrank == 0)
+      MPI_Reduce(MPI_IN_PLACE, data + start, count, MPI_DOUBLE, MPI_SUM, 0,
+                 MPI_COMM_WORLD);
+    else
+      MPI_Reduce(data + start, NULL, count, MPI_DOUBLE, MPI_SUM, 0,
+                 MPI_COMM_WORLD);
+  }
+#endif
+}
+
+// Adds the contribution of the determinant pairs (k, b) with k > b to an
+// RDM built from the pairs k <= b of a single wavefunction (with the
+// diagonal pairs at half weight). By hermiticity
+//   <c0 .. cn-1 d0 .. dn-1> = conj(<dn-1 .. d0 cn-1 .. c0>)
+// so rdm(C, D) += conj(rdm(rev D, rev C)) where rev reverses the orbital
+// indices of a compound index of rank n over norbs orbitals.
+void mirrorRDM(MatrixXx &rdm, int norbs, int rank) {
+  int dim = rdm.rows();
+  vector<int> rev(dim);
+  for (int i = 0; i < dim; i++) {
+    int r = 0;
+    for (int j = 0, x = i; j < rank; j++, x /= norbs) r = r * norbs + x % norbs;
+    rev[i] = r;
+  }
+
+  // (C, D) and (rev D, rev C) are updated together by the first of the two
+#pragma omp parallel for schedule(dynamic)
+  for (int C = 0; C < dim; C++)
+    for (int D = 0; D < dim; D++) {
+      int C2 = rev[D], D2 = rev[C];
+      if (C2 < C || (C2 == C && D2 < D)) continue;
+      CItype a = rdm(C, D), b = rdm(C2, D2);
+      rdm(C, D) = a + localConj::conj(b);
+      if (C2 != C || D2 != D) rdm(C2, D2) = b + localConj::conj(a);
+    }
+}
+
 void popSpin3RDM(vector<int> &cs, vector<int> &ds, CItype value, size_t &norbs,
                  MatrixXx &threeRDM) {
   // d2->c0    d1->c1    d2->c0
@@ -1435,8 +1481,9 @@ void popSpin3RDM(vector<int> &cs, vector<int> &ds, CItype value, size_t &norbs,
     do {
       par = pars[ctr / 6] * pars[ctr % 6];
       ctr++;
-      threeRDM(genIdx(cs[cI[0]], cs[cI[1]], cs[cI[2]], norbs),
-               genIdx(ds[dI[0]], ds[dI[1]], ds[dI[2]], norbs)) += par * value;
+      atomicAdd(threeRDM(genIdx(cs[cI[0]], cs[cI[1]], cs[cI[2]], norbs),
+                         genIdx(ds[dI[0]], ds[dI[1]], ds[dI[2]], norbs)),
+                par * value);
     } while (next_permutation(dI, dI + 3));
   } while (next_permutation(cI, cI + 3));
   return;
@@ -1463,9 +1510,10 @@ void SHCIrdm::popSpatial3RDM(vector<int> &cs, vector<int> &ds, CItype value,
       ctr++;
       if (cs[cI[0]] % 2 == ds[dI[2]] % 2 && cs[cI[1]] % 2 == ds[dI[1]] % 2 &&
           cs[cI[2]] % 2 == ds[dI[0]] % 2) {
-        s3RDM(genIdx(cs[cI[0]] / 2, cs[cI[1]] / 2, cs[cI[2]] / 2, norbs / 2),
-              genIdx(ds[dI[0]] / 2, ds[dI[1]] / 2, ds[dI[2]] / 2, norbs / 2)) +=
-            par * value;
+        atomicAdd(
+            s3RDM(genIdx(cs[cI[0]] / 2, cs[cI[1]] / 2, cs[cI[2]] / 2, norbs / 2),
+                  genIdx(ds[dI[0]] / 2, ds[dI[1]] / 2, ds[dI[2]] / 2, norbs / 2)),
+            par * value);
       }
     } while (next_permutation(dI, dI + 3));
   } while (next_permutation(cI, cI + 3));
@@ -1479,26 +1527,31 @@ void SHCIrdm::Evaluate3RDM(Determinant *Dets, int DetsSize, CItype *cibra,
     TODO optimize speed and memory
     TODO Add second instance of pop*RDM functions that switches cs as ds
   */
-#ifndef SERIAL
-  boost::mpi::communicator world;
-#endif
-
   size_t norbs = Dets[0].norbs;
   int nSpatOrbs = norbs / 2;
   int nSpatOrbs2 = nSpatOrbs * nSpatOrbs;
 
+  // With a single wavefunction only the pairs k <= b are visited and the
+  // rest is added by mirrorRDM at the end
+  bool hermitian = cibra == ciket;
+
   // Pairs of determinants
-  for (int b = 0; b < DetsSize; b++) {
-    if (b % commsize != commrank) continue;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int b = commrank; b < DetsSize; b += commsize) {
     Determinant DetsB = Dets[b];  // Necessary for MPI
-    for (int k = 0; k < DetsSize; k++) {
-      Determinant DetsK = Dets[k];  // Necessary for MPI
-
+    int nket = hermitian ? b + 1 : DetsSize;
+    vector<int> distances(nket);
+    ExcitationDistances(DetsB, Dets, nket, &distances[0]);
+    for (int k = 0; k < nket; k++) {
       // Distances and unique indexes
-      int dist = DetsB.ExcitationDistance(DetsK);
+      int dist = distances[k];
       if (dist > 3) {
         continue;
       }
+      // the diagonal pairs are their own mirror image
+      double pairWeight = hermitian && k == b ? 0.5 : 1.0;
+      CItype ciProduct = pairWeight * real(conj(cibra[b]) * ciket[k]);
+      Determinant DetsK = Dets[k];  // Necessary for MPI
       vector<int> cs(0), ds(0);
       getUniqueIndices(DetsB, DetsK, cs, ds);
 
@@ -1507,10 +1560,8 @@ void SHCIrdm::Evaluate3RDM(Determinant *Dets, int DetsSize, CItype *cibra,
         double sgn = 1.0;
         DetsK.parity(cs[0], cs[1], cs[2], ds[0], ds[1], ds[2], sgn);
         if (schd.DoSpinRDM)
-          popSpin3RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                      threeRDM);
-        popSpatial3RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                       s3RDM);
+          popSpin3RDM(cs, ds, sgn * ciProduct, norbs, threeRDM);
+        popSpatial3RDM(cs, ds, sgn * ciProduct, norbs, s3RDM);
       }
 
       // D=2
@@ -1538,10 +1589,8 @@ void SHCIrdm::Evaluate3RDM(Determinant *Dets, int DetsSize, CItype *cibra,
           DetsK.parity(ds[2], ds[1], cs[0], cs[1], sgn);  // TOOD
 
           if (schd.DoSpinRDM)
-            popSpin3RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                        threeRDM);
-          popSpatial3RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                         s3RDM);
+            popSpin3RDM(cs, ds, sgn * ciProduct, norbs, threeRDM);
+          popSpatial3RDM(cs, ds, sgn * ciProduct, norbs, s3RDM);
         }  // end x
       }
 
@@ -1574,10 +1623,8 @@ void SHCIrdm::Evaluate3RDM(Determinant *Dets, int DetsSize, CItype *cibra,
                          sgn);  // TODO Update repop order
 
             if (schd.DoSpinRDM)
-              popSpin3RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                          threeRDM);
-            popSpatial3RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                           s3RDM);
+              popSpin3RDM(cs, ds, sgn * ciProduct, norbs, threeRDM);
+            popSpatial3RDM(cs, ds, sgn * ciProduct, norbs, s3RDM);
           }  // end y
         }    // end x
       }
@@ -1606,10 +1653,8 @@ void SHCIrdm::Evaluate3RDM(Determinant *Dets, int DetsSize, CItype *cibra,
               ds[0] = closed[z];
 
               if (schd.DoSpinRDM)
-                popSpin3RDM(cs, ds, real(conj(cibra[b]) * ciket[k]), norbs,
-                            threeRDM);
-              popSpatial3RDM(cs, ds, real(conj(cibra[b]) * ciket[k]), norbs,
-                             s3RDM);
+                popSpin3RDM(cs, ds, ciProduct, norbs, threeRDM);
+              popSpatial3RDM(cs, ds, ciProduct, norbs, s3RDM);
             }  // end z
           }    // end y
         }      // end x
@@ -1618,15 +1663,12 @@ void SHCIrdm::Evaluate3RDM(Determinant *Dets, int DetsSize, CItype *cibra,
     }    // end k
   }      // end b
 
-#ifndef SERIAL
-  world.barrier();
-  if (schd.DoSpinRDM)
-    MPI_Allreduce(MPI_IN_PLACE, &threeRDM(0, 0),
-                  threeRDM.rows() * threeRDM.cols(), MPI_DOUBLE, MPI_SUM,
-                  MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &s3RDM(0, 0), s3RDM.rows() * s3RDM.cols(),
-                MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-#endif
+  if (schd.DoSpinRDM) reduceRDM(threeRDM);
+  reduceRDM(s3RDM);
+  if (hermitian && commrank == 0) {
+    if (schd.DoSpinRDM) mirrorRDM(threeRDM, norbs, 3);
+    mirrorRDM(s3RDM, nSpatOrbs, 3);
+  }
 }
 
 /*
@@ -1649,9 +1691,9 @@ void popSpin4RDM(vector<int> &cs, vector<int> &ds, CItype value, int &norbs,
   do {
     do {
       par = pars[ctr / 24] * pars[ctr % 24];
-      fourRDM(gen4Idx(cs[cI[0]], cs[cI[1]], cs[cI[2]], cs[cI[3]], norbs),
-              gen4Idx(ds[dI[0]], ds[dI[1]], ds[dI[2]], ds[dI[3]], norbs)) +=
-          par * value;
+      atomicAdd(fourRDM(gen4Idx(cs[cI[0]], cs[cI[1]], cs[cI[2]], cs[cI[3]], norbs),
+                        gen4Idx(ds[dI[0]], ds[dI[1]], ds[dI[2]], ds[dI[3]], norbs)),
+                par * value);
       ctr++;
     } while (next_permutation(dI, dI + 4));
   } while (next_permutation(cI, cI + 4));
@@ -1672,10 +1714,11 @@ void SHCIrdm::popSpatial4RDM(vector<int> &cs, vector<int> &ds, CItype value,
       par = pars[ctr / 24] * pars[ctr % 24];
       if (cs[cI[0]] % 2 == ds[dI[3]] % 2 && cs[cI[1]] % 2 == ds[dI[2]] % 2 &&
           cs[cI[2]] % 2 == ds[dI[1]] % 2 && cs[cI[3]] % 2 == ds[dI[0]] % 2) {
-        s4RDM(gen4Idx(cs[cI[0]] / 2, cs[cI[1]] / 2, cs[cI[2]] / 2,
-                      cs[cI[3]] / 2, nSOs),
-              gen4Idx(ds[dI[0]] / 2, ds[dI[1]] / 2, ds[dI[2]] / 2,
-                      ds[dI[3]] / 2, nSOs)) += par * value;
+        atomicAdd(s4RDM(gen4Idx(cs[cI[0]] / 2, cs[cI[1]] / 2, cs[cI[2]] / 2,
+                                cs[cI[3]] / 2, nSOs),
+                        gen4Idx(ds[dI[0]] / 2, ds[dI[1]] / 2, ds[dI[2]] / 2,
+                                ds[dI[3]] / 2, nSOs)),
+                  par * value);
       }
       ctr++;
     } while (next_permutation(dI, dI + 4));
@@ -1689,25 +1732,30 @@ void SHCIrdm::Evaluate4RDM(Determinant *Dets, int DetsSize, CItype *cibra,
   /*
      TODO optimize speed and memory
   */
-#ifndef SERIAL
-  boost::mpi::communicator world;
-#endif
-
   int norbs = Dets[0].norbs;
   int nSOs = norbs / 2;  // Number of spatial orbitals
 
+  // With a single wavefunction only the pairs k <= b are visited and the
+  // rest is added by mirrorRDM at the end
+  bool hermitian = cibra == ciket;
+
   // Pairs of determinants
-  for (int b = 0; b < DetsSize; b++) {
-    if (b % commsize != commrank) continue;
+#pragma omp parallel for schedule(dynamic, 1)
+  for (int b = commrank; b < DetsSize; b += commsize) {
     Determinant DetsB = Dets[b];
-    for (int k = 0; k < DetsSize; k++) {
-      Determinant DetsK = Dets[k];
-
+    int nket = hermitian ? b + 1 : DetsSize;
+    vector<int> distances(nket);
+    ExcitationDistances(DetsB, Dets, nket, &distances[0]);
+    for (int k = 0; k < nket; k++) {
       // Distances and unique indexes
-      int dist = DetsB.ExcitationDistance(DetsK);
+      int dist = distances[k];
       if (dist > 4) {
         continue;
       }
+      // the diagonal pairs are their own mirror image
+      double pairWeight = hermitian && k == b ? 0.5 : 1.0;
+      CItype ciProduct = pairWeight * real(conj(cibra[b]) * ciket[k]);
+      Determinant DetsK = Dets[k];
       vector<int> cs(0), ds(0);
       getUniqueIndices(DetsB, DetsK, cs, ds);
 
@@ -1718,10 +1766,8 @@ void SHCIrdm::Evaluate4RDM(Determinant *Dets, int DetsSize, CItype *cibra,
                      sgn);
         // popSpin4RDM(cs,ds,sgn*conj(cibra(b,0))*ciket(k,0),norbs,fourRDM);
         if (schd.DoSpinRDM)
-          popSpin4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                      fourRDM);
-        popSpatial4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), nSOs,
-                       s4RDM);
+          popSpin4RDM(cs, ds, sgn * ciProduct, norbs, fourRDM);
+        popSpatial4RDM(cs, ds, sgn * ciProduct, nSOs, s4RDM);
       }
 
       // D=3
@@ -1748,10 +1794,8 @@ void SHCIrdm::Evaluate4RDM(Determinant *Dets, int DetsSize, CItype *cibra,
           DetsK.parity(cs[0], cs[1], cs[2], ds[1], ds[2], ds[3], sgn);
 
           if (schd.DoSpinRDM)
-            popSpin4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                        fourRDM);
-          popSpatial4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), nSOs,
-                         s4RDM);
+            popSpin4RDM(cs, ds, sgn * ciProduct, norbs, fourRDM);
+          popSpatial4RDM(cs, ds, sgn * ciProduct, nSOs, s4RDM);
         }  // end w
       }
 
@@ -1783,10 +1827,8 @@ void SHCIrdm::Evaluate4RDM(Determinant *Dets, int DetsSize, CItype *cibra,
             DetsK.parity(ds[3], ds[2], cs[0], cs[1], sgn);  // SS notation
 
             if (schd.DoSpinRDM)
-              popSpin4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), norbs,
-                          fourRDM);
-            popSpatial4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]), nSOs,
-                           s4RDM);
+              popSpin4RDM(cs, ds, sgn * ciProduct, norbs, fourRDM);
+            popSpatial4RDM(cs, ds, sgn * ciProduct, nSOs, s4RDM);
           }  // end x
         }    // end w
       }
@@ -1823,10 +1865,8 @@ void SHCIrdm::Evaluate4RDM(Determinant *Dets, int DetsSize, CItype *cibra,
                            sgn);  // SS notation
 
               if (schd.DoSpinRDM)
-                popSpin4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]),
-                            norbs, fourRDM);
-              popSpatial4RDM(cs, ds, sgn * real(conj(cibra[b]) * ciket[k]),
-                             nSOs, s4RDM);
+                popSpin4RDM(cs, ds, sgn * ciProduct, norbs, fourRDM);
+              popSpatial4RDM(cs, ds, sgn * ciProduct, nSOs, s4RDM);
             }  // end y
           }    // end x
         }      // end w
@@ -1860,10 +1900,8 @@ void SHCIrdm::Evaluate4RDM(Determinant *Dets, int DetsSize, CItype *cibra,
                 ds[0] = closed[z];
 
                 if (schd.DoSpinRDM)
-                  popSpin4RDM(cs, ds, real(conj(cibra[b]) * ciket[k]), norbs,
-                              fourRDM);
-                popSpatial4RDM(cs, ds, real(conj(cibra[b]) * ciket[k]), nSOs,
-                               s4RDM);
+                  popSpin4RDM(cs, ds, ciProduct, norbs, fourRDM);
+                popSpatial4RDM(cs, ds, ciProduct, nSOs, s4RDM);
               }  // end z
             }    // end y
           }      // end x
@@ -1873,12 +1911,10 @@ void SHCIrdm::Evaluate4RDM(Determinant *Dets, int DetsSize, CItype *cibra,
     }    // end k
   }      // end b
 
-#ifndef SERIAL
-  world.barrier();
-  if (schd.DoSpinRDM)
-    MPI_Allreduce(MPI_IN_PLACE, &fourRDM(0, 0), fourRDM.rows() * fourRDM.cols(),
-                  MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &s4RDM(0, 0), s4RDM.rows() * s4RDM.cols(),
-                MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-#endif
+  if (schd.DoSpinRDM) reduceRDM(fourRDM);
+  reduceRDM(s4RDM);
+  if (hermitian && commrank == 0) {
+    if (schd.DoSpinRDM) mirrorRDM(fourRDM, norbs, 4);
+    mirrorRDM(s4RDM, nSOs, 4);
+  }
 }
@@ -9,6 +9,9 @@
 #include <tuple>
 #include <vector>
 #include "omp.h"
+#ifndef SERIAL
+#include "mpi.h"
+#endif
 #include "Determinants.h"
 #include "SHCIgetdeterminants.h"
 #include "SHCISortMpiUtils.h"
@@ -1569,3 +1572,318 @@ void cdfci::sequential_solve(schedule& schd, oneInt& I1, twoInt& I2, twoIntHeatB
   return;
 }
 
+
+// indices of the determinants in det_to_index that are a single or a double
+// excitation away from deti
+static void connectedIndices(Determinant& deti, cdfci::DetToIndex& det_to_index, int nelec, vector<int>& connected) {
+  const int norbs = deti.norbs;
+  const int nclosed = nelec;
+  const int nopen = norbs-nclosed;
+  vector<int> closed(nclosed, 0);
+  vector<int> open(nopen, 0);
+  deti.getOpenClosed(open, closed);
+  connected.clear();
+  for (int ia = 0; ia < nopen*nclosed; ia++) {
+    int i = ia / nopen, a = ia % nopen;
+    if (closed[i]%2 != open[a]%2) continue;
+    auto detj = deti;
+    detj.setocc(open[a], true);
+    detj.setocc(closed[i], false);
+    auto iter = det_to_index.find(detj);
+    if (iter != det_to_index.end()) connected.push_back(iter->second);
+  }
+  for (int ij = 0; ij < nclosed*nclosed; ij++) {
+    int i = ij/nclosed, j = ij%nclosed;
+    if (i <= j) continue;
+    int I = closed[i], J = closed[j];
+    for (int kl = 0; kl < nopen*nopen; kl++) {
+      int k = kl/nopen, l = kl%nopen;
+      if (k <= l) continue;
+      int a = max(open[k], open[l]), b = min(open[k], open[l]);
+      if (a%2+b%2-I%2-J%2 != 0) continue;
+      auto detj = deti;
+      detj.setocc(a, true);
+      detj.setocc(b, true);
+      detj.setocc(I, false);
+      detj.setocc(J, false);
+      auto iter = det_to_index.find(detj);
+      if (iter != det_to_index.end()) connected.push_back(iter->second);
+    }
+  }
+}
+
+static bool largerGradient(const pair<double, int>& a, const pair<double, int>& b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+// keeps the (|gradient|, index) candidates with the keep largest gradients
+static void topCandidates(vector<pair<double, int>>& candidates, int keep) {
+  candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [](const pair<double, int>& c) {
+    return c.second < 0;
+  }), candidates.end());
+  keep = min<size_t>(candidates.size(), keep);
+  std::partial_sort(candidates.begin(), candidates.begin()+keep, candidates.end(), largerGradient);
+  candidates.resize(keep);
+}
+
+// Every process contributes its candidates and then greedily takes them in
+// order of decreasing gradient, skipping those that couple to an already
+// picked determinant. All processes thus agree on a block of columns that
+// can be updated independently, and each keeps the coordinates it owns.
+static void pickBlock(vector<pair<double, int>>& candidates, vector<Determinant>& dets, int block, vector<int>& picked) {
+  topCandidates(candidates, 4*block);
+  picked.clear();
+#ifndef SERIAL
+  if (commsize > 1) {
+    int ncand = candidates.size();
+    vector<int> counts(commsize), displs(commsize, 0);
+    MPI_Allgather(&ncand, 1, MPI_INT, &counts[0], 1, MPI_INT, MPI_COMM_WORLD);
+    for (int proc = 1; proc < commsize; proc++) displs[proc] = displs[proc-1] + counts[proc-1];
+    int ntotal = displs[commsize-1] + counts[commsize-1];
+    vector<double> grad(ncand), allGrad(ntotal);
+    vector<int> index(ncand), allIndex(ntotal);
+    for (int c = 0; c < ncand; c++) {
+      grad[c] = candidates[c].first;
+      index[c] = candidates[c].second;
+    }
+    MPI_Allgatherv(grad.data(), ncand, MPI_DOUBLE, allGrad.data(), &counts[0], &displs[0], MPI_DOUBLE, MPI_COMM_WORLD);
+    MPI_Allgatherv(index.data(), ncand, MPI_INT, allIndex.data(), &counts[0], &displs[0], MPI_INT, MPI_COMM_WORLD);
+    candidates.resize(ntotal);
+    for (int c = 0; c < ntotal; c++) candidates[c] = make_pair(allGrad[c], allIndex[c]);
+  }
+#endif
+  std::sort(candidates.begin(), candidates.end(), largerGradient);
+
+  vector<Determinant> pickedDets;
+  vector<int> ndiff(block);
+  for (int c = 0; c < candidates.size() && pickedDets.size() < block; c++) {
+    const Determinant& d = dets[candidates[c].second];
+    ExcitationDistances(d, pickedDets.data(), pickedDets.size(), ndiff.data());
+    bool conflict = false;
+    for (int p = 0; p < pickedDets.size(); p++) {
+      if (ndiff[p] <= 2) {
+        conflict = true;
+        break;
+      }
+    }
+    if (conflict) continue;
+    pickedDets.push_back(d);
+    if (candidates[c].second % commsize == commrank) picked.push_back(candidates[c].second);
+  }
+}
+
+// the block with the largest gradients over the whole space, used to start
+// each root and to refresh the block at reports
+static void scanBlock(vector<double>& x_vector, vector<double>& z_vector, double xx, int nroots, int iroot, vector<Determinant>& dets, int block, vector<int>& picked) {
+  vector<pair<double, int>> candidates;
+  for (int i = commrank; i < dets.size(); i += commsize)
+    candidates.push_back(make_pair(abs(xx*x_vector[i*nroots+iroot]+z_vector[i*nroots+iroot]), i));
+  pickBlock(candidates, dets, block, picked);
+}
+
+// Block coordinate descent: every step updates up to schd.cdfciBlock
+// coordinates that are not connected by H, one column per thread, with the
+// z vector accumulated atomically. Coordinate i is owned by rank
+// i % commsize, which alone updates x_i; the z contributions to the
+// coordinates of other ranks are shipped to their owners after each step,
+// and the next block is picked from the largest gradients seen by all ranks.
+void cdfci::parallel_solve(schedule& schd, oneInt& I1, twoInt& I2, twoIntHeatBathSHM& I2HB, vector<int>& irrep, double& coreE, vector<double>& E0, vector<MatrixXx>& ci, vector<Determinant>& dets) {
+  DetToIndex det_to_index;
+  int dets_size = dets.size();
+  double coreEbkp = coreE;
+  coreE = 0.0;
+
+  for (int i = 0; i < dets_size; i++) {
+    det_to_index[dets[i]] = i;
+  }
+
+  const double epsilon1 = schd.epsilon1[schd.cdfci_on];
+  const int nelec = dets[0].Noccupied();
+  const double zero = 0.0;
+
+  for (int i = 0; i < dets_size; i++) {
+    auto civec = ci[0](i, 0);
+    cdfci::getDeterminantsVariational(dets[i], epsilon1/abs(civec), civec, zero, I1, I2, I2HB, irrep, coreE, E0[0], det_to_index, schd, 0, nelec);
+  }
+  dets.resize(det_to_index.size());
+  for (auto it : det_to_index) {
+    dets[it.second] = it.first;
+  }
+  dets_size = dets.size();
+  pout << "cdfci space " << dets_size << endl;
+
+  int nroots = schd.nroots;
+  vector<pair<float128, float128>> ene(nroots, make_pair(0.0, 0.0));
+  vector<vector<float128>> xx(nroots, vector<float128>(nroots, 0.0));
+  vector<double> x_vector(dets_size * nroots, zero), z_vector(dets_size * nroots, zero);
+  ene = precondition(x_vector, z_vector, xx, ci, det_to_index, dets, E0, I1, I2, I2HB, coreE, epsilon1);
+
+  const int block = schd.cdfciBlock;
+  const long num_iter = schd.cdfciIter;
+  vector<int> picked;
+  auto start_time = getTime();
+  pout << "start to optimize with blocks of " << block << endl;
+
+  for (int iroot = 0; iroot < nroots; iroot++) {
+    scanBlock(x_vector, z_vector, double(xx[iroot][iroot]), nroots, iroot, dets, block, picked);
+    long nupdates = 0, next_report = schd.report_interval;
+    double prev_energy = ene[iroot].first/ene[iroot].second;
+    bool rescanned = true;
+
+    while (nupdates < num_iter) {
+      const double norm = xx[iroot][iroot];
+      vector<pair<double, int>> candidates(2*picked.size(), make_pair(-1.0, -1));
+      vector<double> dxx(iroot+1, 0.0);
+      vector<vector<int>> sendIndex(commsize);
+      vector<vector<double>> sendDz(commsize);
+
+      #pragma omp parallel
+      {
+        vector<int> connected;
+        vector<double> dxxThread(iroot+1, 0.0);
+        vector<vector<int>> remoteIndex(commsize);
+        vector<vector<double>> remoteDz(commsize);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int p = 0; p < picked.size(); p++) {
+          int i = picked[p];
+          vector<double> x(x_vector.begin()+i*nroots, x_vector.begin()+(i+1)*nroots);
+          vector<double> z(z_vector.begin()+i*nroots, z_vector.begin()+(i+1)*nroots);
+          double dx = CoordinateUpdateIthRoot(dets[i], iroot, x, z, xx, I1, I2, coreE);
+          dxxThread[iroot] += dx*dx + 2.*dx*x[iroot];
+          for (int jroot = 0; jroot < iroot; jroot++)
+            dxxThread[jroot] += x[jroot]*dx;
+          x_vector[i*nroots+iroot] += dx;
+          double hii = dets[i].Energy(I1, I2, coreE);
+          #pragma omp atomic
+          z_vector[i*nroots+iroot] += hii*dx;
+
+          // the two owned neighbours with the largest gradients are the
+          // candidates for the next block
+          pair<double, int> best1(-1.0, -1), best2(-1.0, -1);
+          connectedIndices(dets[i], det_to_index, nelec, connected);
+          for (int c = 0; c < connected.size(); c++) {
+            int j = connected[c];
+            size_t orbDiff;
+            double dz = Hij(dets[i], dets[j], I1, I2, coreE, orbDiff) * dx;
+            if (j % commsize != commrank) {
+              remoteIndex[j % commsize].push_back(j);
+              remoteDz[j % commsize].push_back(dz);
+              continue;
+            }
+            double zj;
+            #pragma omp atomic capture
+            zj = z_vector[j*nroots+iroot] += dz;
+            pair<double, int> grad(abs(norm*x_vector[j*nroots+iroot]+zj), j);
+            if (grad.first > best1.first) {
+              best2 = best1;
+              best1 = grad;
+            }
+            else if (grad.first > best2.first)
+              best2 = grad;
+          }
+          candidates[2*p] = best1;
+          candidates[2*p+1] = best2;
+        }
+
+        #pragma omp critical
+        {
+          for (int jroot = 0; jroot <= iroot; jroot++) dxx[jroot] += dxxThread[jroot];
+          for (int proc = 0; proc < commsize; proc++) {
+            sendIndex[proc].insert(sendIndex[proc].end(), remoteIndex[proc].begin(), remoteIndex[proc].end());
+            sendDz[proc].insert(sendDz[proc].end(), remoteDz[proc].begin(), remoteDz[proc].end());
+          }
+        }
+      }
+      long stepUpdates = picked.size();
+
+#ifndef SERIAL
+      if (commsize > 1) {
+        vector<int> sendcounts(commsize), recvcounts(commsize), senddispls(commsize, 0), recvdispls(commsize, 0);
+        vector<int> sendIndexAll;
+        vector<double> sendDzAll;
+        for (int proc = 0; proc < commsize; proc++) {
+          sendcounts[proc] = sendIndex[proc].size();
+          sendIndexAll.insert(sendIndexAll.end(), sendIndex[proc].begin(), sendIndex[proc].end());
+          sendDzAll.insert(sendDzAll.end(), sendDz[proc].begin(), sendDz[proc].end());
+        }
+        MPI_Alltoall(&sendcounts[0], 1, MPI_INT, &recvcounts[0], 1, MPI_INT, MPI_COMM_WORLD);
+        for (int proc = 1; proc < commsize; proc++) {
+          senddispls[proc] = senddispls[proc-1] + sendcounts[proc-1];
+          recvdispls[proc] = recvdispls[proc-1] + recvcounts[proc-1];
+        }
+        int nrecv = recvdispls[commsize-1] + recvcounts[commsize-1];
+        vector<int> recvIndex(nrecv);
+        vector<double> recvDz(nrecv);
+        MPI_Alltoallv(sendIndexAll.data(), &sendcounts[0], &senddispls[0], MPI_INT,
+                      recvIndex.data(), &recvcounts[0], &recvdispls[0], MPI_INT, MPI_COMM_WORLD);
+        MPI_Alltoallv(sendDzAll.data(), &sendcounts[0], &senddispls[0], MPI_DOUBLE,
+                      recvDz.data(), &recvcounts[0], &recvdispls[0], MPI_DOUBLE, MPI_COMM_WORLD);
+        #pragma omp parallel for
+        for (int r = 0; r < nrecv; r++) {
+          #pragma omp atomic
+          z_vector[recvIndex[r]*nroots+iroot] += recvDz[r];
+        }
+        for (int r = 0; r < nrecv; r++) {
+          int j = recvIndex[r];
+          candidates.push_back(make_pair(abs(norm*x_vector[j*nroots+iroot]+z_vector[j*nroots+iroot]), j));
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &dxx[0], iroot+1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Allreduce(MPI_IN_PLACE, &stepUpdates, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+      }
+#endif
+      xx[iroot][iroot] += dxx[iroot];
+      for (int jroot = 0; jroot < iroot; jroot++) {
+        xx[iroot][jroot] += dxx[jroot];
+        xx[jroot][iroot] += dxx[jroot];
+      }
+      nupdates += stepUpdates;
+      if (stepUpdates == 0 && rescanned) break;
+      rescanned = false;
+
+      if (stepUpdates > 0 && nupdates < next_report && nupdates < num_iter) {
+        pickBlock(candidates, dets, block, picked);
+        continue;
+      }
+
+      // recompute the Rayleigh quotient and the residual from the owned
+      // coordinates, which also removes the drift of the running norm
+      double sums[3];
+      double xz = 0.0, xnorm = 0.0;
+      #pragma omp parallel for reduction(+:xz, xnorm)
+      for (int i = commrank; i < dets_size; i += commsize) {
+        xz += x_vector[i*nroots+iroot]*z_vector[i*nroots+iroot];
+        xnorm += x_vector[i*nroots+iroot]*x_vector[i*nroots+iroot];
+      }
+      sums[0] = xz;
+      sums[1] = xnorm;
+#ifndef SERIAL
+      MPI_Allreduce(MPI_IN_PLACE, sums, 2, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+      ene[iroot] = make_pair(float128(sums[0]), float128(sums[1]));
+      xx[iroot][iroot] = sums[1];
+      double curr_energy = sums[0]/sums[1];
+      double res = 0.0;
+      #pragma omp parallel for reduction(+:res)
+      for (int i = commrank; i < dets_size; i += commsize) {
+        double tmp = z_vector[i*nroots+iroot]-curr_energy*x_vector[i*nroots+iroot];
+        res += tmp*tmp;
+      }
+      sums[2] = res;
+#ifndef SERIAL
+      MPI_Allreduce(MPI_IN_PLACE, &sums[2], 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+      double residual = sums[2]/sums[1];
+      pout << setw(10) << nupdates << setw(20) << std::setprecision(14) << curr_energy+coreEbkp << setw(20) << std::setprecision(14) << prev_energy+coreEbkp;
+      pout << std::setw(12) << std::setprecision(4) << scientific << getTime()-start_time << defaultfloat;
+      pout << std::setw(12) << std::setprecision(4) << scientific << residual << defaultfloat << endl;
+      prev_energy = curr_energy;
+      next_report += schd.report_interval;
+      if (residual < schd.cdfciTol) break;
+      scanBlock(x_vector, z_vector, sums[1], nroots, iroot, dets, block, picked);
+      rescanned = true;
+    }
+  }
+  coreE = coreEbkp;
+  return;
+}
@@ -53,9 +53,12 @@ void readInput(string input, std::vector<std::vector<int> >& occupied,
   schd.davidsonTolLoose = 5.e-5;
   schd.RdmType = RELAXED;
   schd.DavidsonType = MEMORY;
+  schd.singlePrecisionHam = false;
+  schd.distributedDavidson = false;
   schd.epsilon2 = 1.e-8;
   schd.epsilon2Large = 1000.0;
   schd.SampleN = -1;
+  schd.ptBatchSize = 0;
 
   schd.onlyperturbative = false;
   schd.restart = false;
@@ -112,6 +115,7 @@ void readInput(string input, std::vector<std::vector<int> >& occupied,
   
   schd.cdfciIter = 0;
   schd.cdfci_on = 1000;
+  schd.cdfciBlock = 0;
   schd.report_interval = 1000;
   schd.z_threshold = 0.0;
   schd.max_determinants = 10000000;
@@ -194,6 +198,10 @@ void readInput(string input, std::vector<std::vector<int> >& occupied,
       schd.DavidsonType = DIRECT;
     else if (boost::iequals(ArgName, "diskdavidson"))
       schd.DavidsonType = DISK;
+    else if (boost::iequals(ArgName, "singleprecisionham"))
+      schd.singlePrecisionHam = true;
+    else if (boost::iequals(ArgName, "distributeddavidson"))
+      schd.distributedDavidson = true;
     else if (boost::iequals(ArgName, "relaxedRDM"))
       schd.RdmType = UNRELAXED;
     else if (boost::iequals(ArgName, "num_thrds"))
@@ -326,6 +334,8 @@ void readInput(string input, std::vector<std::vector<int> >& occupied,
       schd.excitation = atof(tok[1].c_str());
     else if (boost::iequals(ArgName, "sampleN"))
       schd.SampleN = atoi(tok[1].c_str());
+    else if (boost::iequals(ArgName, "ptBatchSize"))
+      schd.ptBatchSize = atoi(tok[1].c_str());
     else if (boost::iequals(ArgName, "restart"))
       schd.restart = true;
     else if (boost::iequals(ArgName, "nvirt"))
@@ -385,6 +395,8 @@ void readInput(string input, std::vector<std::vector<int> >& occupied,
       schd.cdfciIter = atoi(tok[1].c_str());
     else if (boost::iequals(ArgName, "cdfciOn"))
       schd.cdfci_on = atoi(tok[1].c_str());
+    else if (boost::iequals(ArgName, "cdfciBlock"))
+      schd.cdfciBlock = atoi(tok[1].c_str());
 <<<<<<< HEAD:SHCI/input.cpp
 =======
     else if (boost::iequals(ArgName, "cdfciTol"))
@@ -43,9 +43,13 @@ struct schedule {
     & davidsonTolLoose                        \
     & RdmType                                 \
     & DavidsonType                            \
+    & singlePrecisionHam                      \
+    & distributedDavidson                     \
     & epsilon2                                \
     & epsilon2Large                           \
     & SampleN                                 \
+    & ptBatchSize                             \
+    & cdfciBlock                              \
     & epsilon1                                \
     & onlyperturbative                        \
     & restart                                 \
@@ -121,10 +125,13 @@ struct schedule {
   double davidsonTolLoose;
   rdmType RdmType;
   davidsonType DavidsonType;
+  bool singlePrecisionHam;   // store the sparse Hamiltonian elements as floats
+  bool distributedDavidson;  // partition the Davidson vectors over processes
   double epsilon2;
   double epsilon2Large;
   double thresh_hij;
   int SampleN;
+  int ptBatchSize;           // sampled references expanded per exchange in stochastic PT
   std::vector<double> epsilon1;
   bool onlyperturbative;
   bool restart;
@@ -195,6 +202,7 @@ struct schedule {
   double z_threshold;
   int cdfci_on;
   int cdfciIter;
+  int cdfciBlock;            // coordinates updated together per step in parallel cdfci
   int report_interval;
   int max_determinants;
   bool sampleNewDets;
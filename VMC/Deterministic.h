@@ -14,6 +14,7 @@
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <algorithm>
+#include <memory>
 
 #ifndef SERIAL
 #include "mpi.h"
@@ -23,6 +24,10 @@ using namespace Eigen;
 using namespace std;
 using namespace boost;
 
+//Exact evaluation over the full Hilbert space (or the FOIS of the CAS). The
+//determinants are not stored: each rank owns the contiguous index range
+//[start, end) and builds the determinants on the fly by unranking, so every
+//thread can hold its own copy of this class and work on a part of the range
 template<typename Wfn, typename Walker>
 class Deterministic
 {
@@ -31,7 +36,8 @@ class Deterministic
   Walker walk;
   long numVars;
   int norbs, nalpha, nbeta;
-  vector<Determinant> allDets;
+  std::shared_ptr<vector<Determinant>> foisDets; //only used for the FOIS, shared between copies
+  size_t nDets, start, end;
   workingArray work;
   double ovlp, Eloc, locNorm, avgNorm;
   double Overlap;
@@ -44,13 +50,37 @@ class Deterministic
     nalpha = Determinant::nalpha;
     nbeta = Determinant::nbeta;
     if (schd.nciCore > 0 || schd.nciAct > 0) {
-      generateAllDeterminantsFOIS(allDets, norbs, nalpha, nbeta);
+      foisDets = std::make_shared<vector<Determinant>>();
+      generateAllDeterminantsFOIS(*foisDets, norbs, nalpha, nbeta);
+      nDets = foisDets->size();
     }
     else {
-      generateAllDeterminants(allDets, norbs, nalpha, nbeta);
+      nDets = getNumAllDeterminants(norbs, nalpha, nbeta);
     }
+    getLocalIndexRange(nDets, start, end);
     Overlap = 0.0, avgNorm = 0.0;
   }
+
+  void getDet(size_t i, Determinant &D)
+  {
+    if (foisDets) D = (*foisDets)[i];
+    else getDeterminantFromIndex(i, norbs, nalpha, nbeta, D);
+  }
+
+  //copy for a thread, with the accumulators reset
+  Deterministic ThreadCopy() const
+  {
+    Deterministic D(*this);
+    D.Overlap = 0.0, D.avgNorm = 0.0;
+    return D;
+  }
+
+  //adds the accumulators of a thread copy before the MPI reduction
+  void Combine(const Deterministic &D)
+  {
+    Overlap += D.Overlap;
+    avgNorm += D.avgNorm;
+  }
    
   void LocalEnergy(Determinant &D)
   {
@@ -61,6 +91,13 @@ class Deterministic
     locNorm = work.locNorm * work.locNorm;
     if (schd.debug) cout << "ham  " << Eloc << "  locNorm  " << locNorm << "  ovlp  " << ovlp << endl << endl;
   }
+
+  void LocalEnergy(size_t i)
+  {
+    Determinant D;
+    getDet(i, D);
+    LocalEnergy(D);
+  }
   
   void UpdateEnergy(double &Energy)
   {
@@ -96,7 +133,7 @@ class Deterministic
   {
 #ifndef SERIAL
     MPI_Allreduce(MPI_IN_PLACE, (grad_ratio_bar.data()), grad_ratio_bar.rows(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-    MPI_Allreduce(MPI_IN_PLACE, (grad.data()), grad_ratio.rows(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, (grad.data()), grad.rows(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
 #endif
     grad = (grad - Energy * grad_ratio_bar) / Overlap;
     grad /= avgNorm;
@@ -97,6 +97,8 @@ class Metropolis
   double bestOvlp;
   bool calcEloc;
   double fracAmoves, n, nAMoves;
+  double beta;    //the chain samples |psi|^(2 beta), beta < 1 only for replica exchange
+  double logOvlp; //log |psi| of the walker relative to the starting determinant
 
   // Data for Metropolis in FOIS calculations (SCCI and SCPT)
   workingArray morework, morework_new;
@@ -118,6 +120,7 @@ class Metropolis
     nbeta = Determinant::nbeta;
     bestDet = walk->getDet();
     S1 = 0.0, oldEnergy = 0.0, bestOvlp = 0.0, nAMoves = 0.0, n = 0.0;
+    beta = 1.0, logOvlp = 0.0;
     calcEloc = true;
   }
   
@@ -180,6 +183,7 @@ class Metropolis
     double T_C = 1.0 / C.TotalMoves();
     double T_P = 1.0 / P.TotalMoves();
     double P_pdetOvercdet = pdetOvercdet * pdetOvercdet;
+    if (beta != 1.0) P_pdetOvercdet = pow(P_pdetOvercdet, beta);
     double accept = min(1.0, (T_P * P_pdetOvercdet) / T_C);
     if (random() < accept)
     {
@@ -190,6 +194,7 @@ class Metropolis
       */
       nAMoves += 1.0;
       calcEloc = true;
+      logOvlp += log(abs(pdetOvercdet));
       if (move == Amove)
       {
         walk->update(orb1, orb2, 0, w->getRef(), w->getCorr());
@@ -382,6 +387,22 @@ class Metropolis
 #endif
     grad = (grad - Energy * grad_ratio_bar);
   }
+
+  void UpdateSR(DirectMetric &S)
+  {
+    VectorXd appended(numVars + 1);
+    appended << 1.0, grad_ratio;
+    S.Vectors.push_back(appended);
+    S.T.push_back(1.0);
+  }
+  
+  void FinishSR(const VectorXd &grad, const VectorXd &grad_ratio_bar, VectorXd &H)
+  {
+    H.setZero(grad.rows() + 1);
+    VectorXd appended(grad.rows());
+    appended = grad_ratio_bar - schd.stepsize * grad;
+    H << 1.0, appended;
+  }
 };
   
 #endif
@@ -0,0 +1,112 @@
+#ifndef PT_HEADER_H
+#define PT_HEADER_H
+#include <Eigen/Dense>
+#include <vector>
+#include <cmath>
+#include "Determinants.h"
+#include "statistics.h"
+#include "sr.h"
+#include "global.h"
+#include "input.h"
+#include "Metropolis.h"
+#include <iostream>
+
+#ifndef SERIAL
+#include "mpi.h"
+#endif
+
+using namespace Eigen;
+using namespace std;
+
+/*
+ * Replica exchange Metropolis sampling. Each rank runs a ladder of chains
+ * sampling |psi|^(2 beta_k) with beta_0 = 1 > beta_1 > ... > beta_min, and
+ * after every sweep neighbouring chains attempt to swap configurations.
+ * The hot chains cross between basins easily and feed decorrelated
+ * configurations down to the beta = 1 chain. Because that chain samples
+ * |psi|^2 exactly, its estimators carry unit weights and all energy,
+ * gradient and SR accumulation is delegated to its Metropolis sampler.
+ */
+template<typename Wfn, typename Walker>
+class ParallelTempering
+{
+  public:
+  Wfn *w;
+  vector<Walker> hotWalkers;                  //walkers of the chains with beta < 1
+  vector<Metropolis<Wfn, Walker>> chains;     //chains[0] samples |psi|^2 with the caller's walker
+  vector<double> nSwapAttempts, nSwapAccepted;
+  int parity;                                 //alternates swaps between even and odd neighbour pairs
+
+  double random()
+  {
+    uniform_real_distribution<double> dist(0,1);
+    return dist(generator);
+  }
+
+  ParallelTempering(Wfn &_w, Walker &_walk, int niter) : w(&_w)
+  {
+    int nchains = max(schd.temperingChains, 1);
+    hotWalkers.assign(nchains - 1, _walk);
+    chains.reserve(nchains);
+    chains.push_back(Metropolis<Wfn, Walker>(_w, _walk, niter));
+    for (int k = 1; k < nchains; k++) {
+      chains.push_back(Metropolis<Wfn, Walker>(_w, hotWalkers[k - 1], niter));
+      chains[k].beta = pow(schd.temperingMinBeta, double(k) / (nchains - 1));
+    }
+    nSwapAttempts.assign(nchains, 0.0);
+    nSwapAccepted.assign(nchains, 0.0);
+    parity = 0;
+  }
+
+  void LocalEnergy() { chains[0].LocalEnergy(); }
+
+  void LocalGradient() { chains[0].LocalGradient(); }
+
+  //one Metropolis step on every chain followed by swap attempts between neighbours
+  void MakeMove()
+  {
+    for (int k = 0; k < chains.size(); k++) chains[k].MakeMove();
+
+    for (int k = parity; k + 1 < chains.size(); k += 2) {
+      Metropolis<Wfn, Walker> &cold = chains[k], &hot = chains[k + 1];
+      double logAccept = 2.0 * (cold.beta - hot.beta) * (hot.logOvlp - cold.logOvlp);
+      nSwapAttempts[k] += 1.0;
+      if (logAccept >= 0.0 || random() < exp(logAccept)) {
+        nSwapAccepted[k] += 1.0;
+        std::swap(*cold.walk, *hot.walk);
+        std::swap(cold.logOvlp, hot.logOvlp);
+        cold.calcEloc = true;
+        hot.calcEloc = true;
+      }
+    }
+    parity = 1 - parity;
+  }
+
+  void UpdateEnergy(double &Energy) { chains[0].UpdateEnergy(Energy); }
+
+  void FinishEnergy(double &Energy, double &stddev, double &rk)
+  {
+    chains[0].FinishEnergy(Energy, stddev, rk);
+#ifndef SERIAL
+    MPI_Allreduce(MPI_IN_PLACE, &nSwapAttempts[0], nSwapAttempts.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &nSwapAccepted[0], nSwapAccepted.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+    if (commrank == 0)
+    {
+      cout << "Replica exchange acceptance:";
+      for (int k = 0; k + 1 < chains.size(); k++)
+        cout << "  " << chains[k].beta << "<->" << chains[k + 1].beta << " " << nSwapAccepted[k] / max(nSwapAttempts[k], 1.0);
+      cout << endl;
+    }
+  }
+
+  void UpdateGradient(VectorXd &grad, VectorXd &grad_ratio_bar) { chains[0].UpdateGradient(grad, grad_ratio_bar); }
+
+  void FinishGradient(VectorXd &grad, VectorXd &grad_ratio_bar, const double &Energy) { chains[0].FinishGradient(grad, grad_ratio_bar, Energy); }
+
+  void UpdateSR(DirectMetric &S) { chains[0].UpdateSR(S); }
+
+  void FinishSR(const VectorXd &grad, const VectorXd &grad_ratio_bar, VectorXd &H) { chains[0].FinishSR(grad, grad_ratio_bar, H); }
+};
+
+#endif
@@ -59,6 +59,23 @@ void CPS::generateMapFromOrbitalToCorrelators() {
   for (int i = 0; i < norbs; i++)
     std::sort(mapFromOrbitalToCorrelator[i].begin(),
               mapFromOrbitalToCorrelator[i].end());
+
+  generateMapFromOrbitalToNeighbors();
+}
+
+void CPS::generateMapFromOrbitalToNeighbors() {
+
+  int norbs = mapFromOrbitalToCorrelator.size();
+  mapFromOrbitalToNeighbors.assign(norbs, std::vector<int>());
+
+  for (int i = 0; i < norbs; i++) {
+    std::vector<int>& neighbors = mapFromOrbitalToNeighbors[i];
+    neighbors.push_back(i);
+    for (const auto& c : mapFromOrbitalToCorrelator[i])
+      neighbors.insert(neighbors.end(), cpsArray[c].asites.begin(), cpsArray[c].asites.end());
+    std::sort(neighbors.begin(), neighbors.end());
+    neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+  }
 }
 
 double CPS::Overlap(const Determinant &d) const
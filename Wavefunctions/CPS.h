@@ -42,6 +42,7 @@ class CPS {
     ar & cpsArray
         & mapFromOrbitalToCorrelator
         & commonCorrelators;
+    if (Archive::is_loading::value) generateMapFromOrbitalToNeighbors();
   }
  public:
   bool twoSiteOrSmaller;
@@ -49,6 +50,7 @@ class CPS {
   std::vector<Correlator> cpsArray;  
   
   std::vector<std::vector<int>> mapFromOrbitalToCorrelator;
+  std::vector<std::vector<int>> mapFromOrbitalToNeighbors; //sorted sites sharing a correlator with the orbital, itself included
   std::vector<int> commonCorrelators;
   
   //reads correlator file and makes cpsArray, orbitalToCPS
@@ -56,6 +58,7 @@ class CPS {
   CPS (std::vector<Correlator>& pcpsArray);
   
   void generateMapFromOrbitalToCorrelators();
+  void generateMapFromOrbitalToNeighbors();
   
   double Overlap(const Determinant& d) const ;
   
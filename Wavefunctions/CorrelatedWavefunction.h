@@ -262,14 +262,31 @@ struct CorrelatedWavefunction {
     ham = walk.d.Energy(I1, I2, coreE); 
 
     work.setCounterToZero();
+    if (schd.debug) cout << "eloc excitations\nphi0  d.energy " << ham << endl;
+
+    //the excitations are not needed by the caller, so the overlap ratios
+    //are evaluated as the excitations are generated
+    if (!fillExcitations) {
+      auto addExcitation = [&](size_t ex1, size_t ex2, double tia) {
+        int I, A, J, B;
+        workingArray::decode(ex1, norbs, I, A);
+        workingArray::decode(ex2, norbs, J, B);
+        double ovlpRatio = getOverlapFactor(I, J, A, B, walk, false);
+        ham += tia * ovlpRatio;
+        if (schd.debug) cout << I << "  " << A << "  " << J << "  " << B << "  tia  " << tia << "  ovlpRatio  " << ovlpRatio << endl;
+      };
+      forEachScreenedSingleExcitation(walk.d, epsilon, schd.screen, false, addExcitation);
+      forEachScreenedDoubleExcitation(walk.d, epsilon, addExcitation);
+      if (schd.debug) cout << endl;
+      return;
+    }
+
     generateAllScreenedSingleExcitation(walk.d, epsilon, schd.screen,
                                         work, false);  
     generateAllScreenedDoubleExcitation(walk.d, epsilon, schd.screen,
                                         work, false);  
-  
 
     //loop over all the screened excitations
-    if (schd.debug) cout << "eloc excitations\nphi0  d.energy " << ham << endl;
     for (int i=0; i<work.nExcitations; i++) {
       int ex1 = work.excitation1[i], ex2 = work.excitation2[i];
       double tia = work.HijElement[i];
@@ -730,9 +730,6 @@ class WalkerHelper<Pfaffian>
     WalkerHelper(const Pfaffian &w, const Determinant &d) 
     {
       fillOpenClosedOrbs(d);
-      int nopen = openOrbs[0].size() + openOrbs[1].size();
-      int nclosed = closedOrbs[0].size() + closedOrbs[1].size();
-      fMat = MatrixXcd::Zero(nopen * nclosed, nclosed);
       initInvDetsTables(w);
     }
     
@@ -745,53 +742,43 @@ class WalkerHelper<Pfaffian>
       d.getOpenClosedAlphaBeta(openOrbs[0], closedOrbs[0], openOrbs[1], closedOrbs[1]);
     }
     
-    void makeTables(const Pfaffian &w)
+    //open and closed spin orbitals, alpha followed by beta (offset by norbs), both in ascending order
+    void getOpenClosed(VectorXi &open, VectorXi &closed) const
     {
       int norbs = Determinant::norbs;
-      int nopen = openOrbs[0].size() + openOrbs[1].size();
-      int nclosed = closedOrbs[0].size() + closedOrbs[1].size();
-      Map<VectorXi> openAlpha(&openOrbs[0][0], openOrbs[0].size());
-      Map<VectorXi> openBeta(&openOrbs[1][0], openOrbs[1].size());
-      VectorXi open(nopen);
-      open << openAlpha, (openBeta.array() + norbs).matrix();
-      Map<VectorXi> closedAlpha(&closedOrbs[0][0], closedOrbs[0].size());
-      Map<VectorXi> closedBeta(&closedOrbs[1][0], closedOrbs[1].size());
-      VectorXi closed(nclosed);
-      closed << closedAlpha, (closedBeta.array() + norbs).matrix();
+      open.resize(openOrbs[0].size() + openOrbs[1].size());
+      closed.resize(closedOrbs[0].size() + closedOrbs[1].size());
+      for (int o = 0; o < openOrbs[0].size(); o++) open[o] = openOrbs[0][o];
+      for (int o = 0; o < openOrbs[1].size(); o++) open[openOrbs[0].size() + o] = openOrbs[1][o] + norbs;
+      for (int c = 0; c < closedOrbs[0].size(); c++) closed[c] = closedOrbs[0][c];
+      for (int c = 0; c < closedOrbs[1].size(); c++) closed[closedOrbs[0].size() + c] = closedOrbs[1][c] + norbs;
+    }
+    
+    void makeTables(const Pfaffian &w)
+    {
+      VectorXi open, closed;
+      getOpenClosed(open, closed);
+      int nopen = open.size();
       igl::slice(w.getPairMat(), open, closed, fMat);
       rTable[0] = fMat * thetaInv;
-      rTable[1] = - rTable[0] * fMat.transpose();
-
-      //MatrixXcd fRow;
-      //VectorXi rowSlice(1), colSlice(nclosed);
-      //for (int i = 0; i < closed.size(); i++) {
-      //  for (int a = 0; a < open.size(); a++) {
-      //    colSlice = closed;
-      //    rowSlice[0] = open[a];
-      //    colSlice[i] = open[a];
-      //    igl::slice(w.getPairMat(), rowSlice, colSlice, fRow);
-      //    fMat.block(i * open.size() + a, 0, 1, closed.size()) = fRow;
-      //  }
-      //}
-      
-      //rTable[0] = fMat * thetaInv; 
-      //rTable[1] = - rTable[0] * fMat.transpose(); 
+      //rTable[1] = - fMat * thetaInv * fMat^T is skew, so only the lower triangle is multiplied out
+      rTable[1].resize(nopen, nopen);
+      rTable[1].triangularView<Eigen::Lower>() = rTable[0] * (-fMat.transpose());
+      for (int o = 0; o < nopen; o++) {
+        rTable[1](o, o) = 0.;
+        for (int p = o + 1; p < nopen; p++) rTable[1](o, p) = -rTable[1](p, o);
+      }
     }
     
     void initInvDetsTables(const Pfaffian &w)
     {
-      int norbs = Determinant::norbs;
-      int nclosed = closedOrbs[0].size() + closedOrbs[1].size();
-      Map<VectorXi> closedAlpha(&closedOrbs[0][0], closedOrbs[0].size());
-      Map<VectorXi> closedBeta(&closedOrbs[1][0], closedOrbs[1].size());
-      VectorXi closed(nclosed);
-      closed << closedAlpha, (closedBeta.array() + norbs).matrix();
+      VectorXi open, closed;
+      getOpenClosed(open, closed);
       MatrixXcd theta;
       igl::slice(w.getPairMat(), closed, closed, theta); 
-      Eigen::FullPivLU<MatrixXcd> lua(theta);
-      if (lua.isInvertible()) {
-        thetaInv = lua.inverse();
-        thetaPfaff = calcPfaffian(theta);
+      thetaPfaff = calcPfaffian(theta);
+      if (thetaPfaff != 0.) {
+        thetaInv = theta.partialPivLu().inverse();
       }
       else {
         cout << "pairMat\n" << w.getPairMat() << endl << endl;
@@ -803,47 +790,66 @@ class WalkerHelper<Pfaffian>
       makeTables(w);
     }
     
+    //the excitation i -> a replaces row and column tableIndexi of theta, which is a skew rank-2 change
+    //theta' = theta + e_i d^T - d e_i^T, so thetaInv, fMat and both tables are updated in O(n^2)
+    //and then permuted back to ascending orbital order
     void excitationUpdate(const Pfaffian &w, int i, int a, bool sz, double parity, const Determinant& excitedDet)
     {
       int tableIndexi, tableIndexa;
       getRelIndices(i, tableIndexi, a, tableIndexa, sz); 
       int norbs = Determinant::norbs;
-      int nopen = openOrbs[0].size() + openOrbs[1].size();
-      int nclosed = closedOrbs[0].size() + closedOrbs[1].size();
-      Map<VectorXi> closedAlpha(&closedOrbs[0][0], closedOrbs[0].size());
-      Map<VectorXi> closedBeta(&closedOrbs[1][0], closedOrbs[1].size());
-      VectorXi closed(nclosed);
-      closed << closedAlpha, (closedBeta.array() + norbs).matrix();
+      VectorXi open, closed;
+      getOpenClosed(open, closed);
+      int nopen = open.size();
+      int nclosed = closed.size();
+      const MatrixXcd &pairMat = w.getPairMat();
+      int iSpin = i + sz * norbs, aSpin = a + sz * norbs;
       
-      MatrixXcd cInv(2,2);
-      cInv << 0, -1,
-             1, 0;
-      MatrixXcd bMat = MatrixXcd::Zero(nclosed, 2);
-      bMat(tableIndexi, 1) = 1;
-      VectorXi colSlice(1);
-      colSlice[0] = i + sz * norbs;
-      MatrixXcd thetaSlice;
-      igl::slice(w.getPairMat(), closed, colSlice, thetaSlice);
-      //bMat.block(0, 0, nclosed, 1) = - fMat.transpose().block(0, tableIndexi * nopen + tableIndexa, nclosed, 1) - thetaSlice;
-      bMat.block(0, 0, nclosed, 1) = - fMat.transpose().block(0, tableIndexa, nclosed, 1) - thetaSlice;
-      MatrixXcd invOld = thetaInv;
-      MatrixXcd intermediate = (cInv + bMat.transpose() * invOld * bMat).inverse();
-      MatrixXcd shuffledThetaInv = invOld - invOld * bMat * intermediate * bMat.transpose() * invOld; 
+      //new row of theta is u, the pfaffian ratio is u^T thetaInv e_i
+      VectorXcd u = fMat.row(tableIndexa).transpose();
+      u(tableIndexi) = 0.;
+      VectorXcd g = thetaInv.col(tableIndexi);
+      complex<double> pfaffRatio = fMat.row(tableIndexa) * g;
+      VectorXcd v = thetaInv * u;
+      v(tableIndexi) += 1.;
+      VectorXcd p = rTable[0].col(tableIndexi);
+      VectorXcd h = rTable[0] * u;
+      for (int o = 0; o < nopen; o++) h(o) += pairMat(open(o), aSpin);
+      thetaInv.noalias() += (g * v.transpose() - v * g.transpose()) / pfaffRatio;
+      rTable[0].noalias() += (p * v.transpose() - h * g.transpose()) / pfaffRatio;
+      rTable[1].noalias() -= (p * h.transpose() - h * p.transpose()) / pfaffRatio;
       
-      closed[tableIndexi] = a + sz * norbs; 
-      std::vector<int> order(closed.size());
-      auto rcopy = closed;
-      std::iota(order.begin(), order.end(), 0);
-      std::sort(order.begin(), order.end(), [&rcopy](size_t i1, size_t i2) { return rcopy[i1] < rcopy[i2]; });
-      Eigen::Map<Eigen::VectorXi> orderVec(&order[0], order.size());
-      igl::slice(shuffledThetaInv, orderVec, orderVec, thetaInv);
+      //the row of a in the tables now belongs to i
+      closed(tableIndexi) = aSpin;
+      open(tableIndexa) = iSpin;
+      for (int o = 0; o < nopen; o++) fMat(o, tableIndexi) = pairMat(open(o), aSpin);
+      for (int c = 0; c < nclosed; c++) fMat(tableIndexa, c) = pairMat(iSpin, closed(c));
+      rTable[0].row(tableIndexa) = fMat.row(tableIndexa) * thetaInv;
+      VectorXcd rRow = - fMat * rTable[0].row(tableIndexa).transpose();
+      rTable[1].row(tableIndexa) = rRow.transpose();
+      rTable[1].col(tableIndexa) = - rRow;
+      rTable[1](tableIndexa, tableIndexa) = 0.;
+      
+      std::vector<int> closedOrder(nclosed), openOrder(nopen);
+      std::iota(closedOrder.begin(), closedOrder.end(), 0);
+      std::iota(openOrder.begin(), openOrder.end(), 0);
+      std::sort(closedOrder.begin(), closedOrder.end(), [&closed](int i1, int i2) { return closed[i1] < closed[i2]; });
+      std::sort(openOrder.begin(), openOrder.end(), [&open](int i1, int i2) { return open[i1] < open[i2]; });
+      Eigen::Map<Eigen::VectorXi> closedOrderVec(&closedOrder[0], nclosed);
+      Eigen::Map<Eigen::VectorXi> openOrderVec(&openOrder[0], nopen);
+      MatrixXcd shuffled;
+      shuffled = thetaInv;
+      igl::slice(shuffled, closedOrderVec, closedOrderVec, thetaInv);
+      shuffled = fMat;
+      igl::slice(shuffled, openOrderVec, closedOrderVec, fMat);
+      shuffled = rTable[0];
+      igl::slice(shuffled, openOrderVec, closedOrderVec, rTable[0]);
+      shuffled = rTable[1];
+      igl::slice(shuffled, openOrderVec, openOrderVec, rTable[1]);
       
-      //thetaPfaff = thetaPfaff * rTable[0](tableIndexi * nopen + tableIndexa, tableIndexi);
-      complex<double> pfaffRatio = fMat.row(tableIndexa) * invOld.col(tableIndexi);
       thetaPfaff = thetaPfaff * pfaffRatio;
       thetaPfaff *= parity;
       fillOpenClosedOrbs(excitedDet);
-      makeTables(w);
     }
     
     void getRelIndices(int i, int &relI, int a, int &relA, bool sz) const 
@@ -868,7 +874,7 @@ class WalkerHelper<CPS>
   WalkerHelper(CPS& cps, const Determinant& d) {
     int norbs = Determinant::norbs;
     intermediateForEachSpinOrb.resize(norbs*2);
-    updateHelper(cps, d, 0, 0, 0);
+    initHelper(cps, d);
 
     if (cps.twoSiteOrSmaller) {
       vector<int> initial(norbs, -1);
@@ -887,38 +893,53 @@ class WalkerHelper<CPS>
     }
   }
 
-  //these update functions are really init functions
-  void updateHelper(CPS& cps, const Determinant& d, int l, int a, bool sz) {
+  //ratio of the correlators containing spin orbital i with i occupied and empty
+  void calcIntermediate(CPS& cps, const Determinant& d, int i) {
+    intermediateForEachSpinOrb[i] = 1.0;
+  
+    Determinant dcopy1 = d, dcopy2 = d;
+    dcopy1.setocc(i, true);  //make sure this is occupied
+    dcopy2.setocc(i, false); //make sure this is unoccupied
+  
+    const vector<int>& cpsContainingi = cps.mapFromOrbitalToCorrelator[i/2];
+    for (const auto& j : cpsContainingi) {
+      intermediateForEachSpinOrb[i] *= cps.cpsArray[j].OverlapRatio(dcopy1, dcopy2);
+    }
+  }
+
+  void initHelper(CPS& cps, const Determinant& d) {
     int norbs = Determinant::norbs;
+    for (int i=0; i<2*norbs; i++)
+      calcIntermediate(cps, d, i);
+  }
 
-    for (int i=0; i<2*norbs; i++) {
-      intermediateForEachSpinOrb[i] = 1.0;
-    
-      Determinant dcopy1 = d, dcopy2 = d;
-      dcopy1.setocc(i, true);  //make sure this is occupied
-      dcopy2.setocc(i, false); //make sure this is unoccupied
-    
-      const vector<int>& cpsContainingi = cps.mapFromOrbitalToCorrelator[i/2];
-      for (const auto& j : cpsContainingi) {
-        intermediateForEachSpinOrb[i] *= cps.cpsArray[j].OverlapRatio(dcopy1, dcopy2);
-      }
+  //only orbitals sharing a correlator with the excited ones have their intermediates changed
+  void updateHelper(CPS& cps, const Determinant& d, int l, int a, bool sz) {
+    vector<int>& affected = commonCorrelators;
+    affected.resize(0);
+    set_union(cps.mapFromOrbitalToNeighbors[l].begin(),
+              cps.mapFromOrbitalToNeighbors[l].end(),
+              cps.mapFromOrbitalToNeighbors[a].begin(),
+              cps.mapFromOrbitalToNeighbors[a].end(),
+              back_inserter(affected));
+
+    for (const auto& site : affected) {
+      calcIntermediate(cps, d, 2*site);
+      calcIntermediate(cps, d, 2*site+1);
     }
   }
   
   void updateHelper(CPS& cps, const Determinant& d, int l, int m, int a, int b, bool sz) {
-    int norbs = Determinant::norbs;
-
-    for (int i=0; i<2*norbs; i++) {
-      intermediateForEachSpinOrb[i] = 1.0;
-    
-      Determinant dcopy1 = d, dcopy2 = d;
-      dcopy1.setocc(i, true);  //make sure this is occupied
-      dcopy2.setocc(i, false); //make sure this is unoccupied
-    
-      const vector<int>& cpsContainingi = cps.mapFromOrbitalToCorrelator[i/2];
-      for (const auto& j : cpsContainingi) {
-        intermediateForEachSpinOrb[i] *= cps.cpsArray[j].OverlapRatio(dcopy1, dcopy2);
-      }
+    vector<int>& affected = commonCorrelators;
+    affected.resize(0);
+    for (int site : {l, m, a, b})
+      affected.insert(affected.end(), cps.mapFromOrbitalToNeighbors[site].begin(), cps.mapFromOrbitalToNeighbors[site].end());
+    sort(affected.begin(), affected.end());
+    affected.erase(unique(affected.begin(), affected.end()), affected.end());
+
+    for (const auto& site : affected) {
+      calcIntermediate(cps, d, 2*site);
+      calcIntermediate(cps, d, 2*site+1);
     }
   }
 
@@ -1075,11 +1096,26 @@ class WalkerHelper<Jastrow>
     }
   }
   
+  //multiplies (divides) intermediateForEachSpinOrb[l] by cps(l, a) for all l
+  //only the lower triangle of SpinCorrelator is stored, so cps(l, a) is row a for l < a
+  //and the contiguous column a for l >= a, both are applied as vectorized array operations
+  void scaleByCorrelatorColumn(const Jastrow& cps, int a, bool divide) {
+    int size = intermediateForEachSpinOrb.size();
+    Eigen::Map<Eigen::ArrayXd> intermediate(&intermediateForEachSpinOrb[0], size);
+    if (divide) {
+      intermediate.head(a) /= cps.SpinCorrelator.row(a).head(a).transpose().array();
+      intermediate.tail(size - a) /= cps.SpinCorrelator.col(a).tail(size - a).array();
+    }
+    else {
+      intermediate.head(a) *= cps.SpinCorrelator.row(a).head(a).transpose().array();
+      intermediate.tail(size - a) *= cps.SpinCorrelator.col(a).tail(size - a).array();
+    }
+  }
+
   void updateHelper(Jastrow& cps, const Determinant& d, int i, int a, bool sz) {
     i = 2 * i + sz; a = 2 * a + sz;
-    int norbs = Determinant::norbs;
-    for (int l = 0; l < 2 * norbs; l++) 
-      intermediateForEachSpinOrb[l] *= cps(l, a) / cps(l, i);
+    scaleByCorrelatorColumn(cps, a, false);
+    scaleByCorrelatorColumn(cps, i, true);
     intermediateForEachSpinOrb[i] *= cps(i, i);
     intermediateForEachSpinOrb[a] /= cps(a, a);
     //initHelper(cps, d);
@@ -1088,9 +1124,10 @@ class WalkerHelper<Jastrow>
   void updateHelper(Jastrow& cps, const Determinant& d, int i, int j, int a, int b, bool sz) {
     i = 2 * i + sz; a = 2 * a + sz;
     j = 2 * j + sz; b = 2 * b + sz;
-    int norbs = Determinant::norbs;
-    for (int l = 0; l < 2 * norbs; l++) 
-      intermediateForEachSpinOrb[l] *= cps(l, a) * cps(l, b) / cps(l, i) / cps(l, j);
+    scaleByCorrelatorColumn(cps, a, false);
+    scaleByCorrelatorColumn(cps, b, false);
+    scaleByCorrelatorColumn(cps, i, true);
+    scaleByCorrelatorColumn(cps, j, true);
     intermediateForEachSpinOrb[i] *= cps(i, i);
     intermediateForEachSpinOrb[a] /= cps(a, a);
     intermediateForEachSpinOrb[j] *= cps(j, j);
@@ -1166,10 +1203,18 @@ class WalkerHelper<SJastrow>
     }
   }
   
+  //adds (subtracts) cps(l, a) to intermediateForEachOrb[l] for all l, reading the stored lower
+  //triangle as row a for l < a and the contiguous column a for l >= a
+  void addCorrelatorColumn(const SJastrow& cps, int a, double factor) {
+    int size = intermediateForEachOrb.size();
+    Eigen::Map<Eigen::ArrayXd> intermediate(&intermediateForEachOrb[0], size);
+    intermediate.head(a) += factor * cps.SpinCorrelator.row(a).head(a).transpose().array();
+    intermediate.tail(size - a) += factor * cps.SpinCorrelator.col(a).tail(size - a).array();
+  }
+
   void updateHelper(SJastrow& cps, const Determinant& d, int i, int a, bool sz) {
-    int norbs = Determinant::norbs;
-    for (int l = 0; l < norbs; l++) 
-      intermediateForEachOrb[l] += (cps(l, a) - cps(l, i));
+    addCorrelatorColumn(cps, a, 1.);
+    addCorrelatorColumn(cps, i, -1.);
     intermediateForEachOrb[i] += cps(i, i);
     intermediateForEachOrb[a] -= cps(a, a);
     occ[i] -= 1;
@@ -1177,9 +1222,10 @@ class WalkerHelper<SJastrow>
   }
   
   void updateHelper(SJastrow& cps, const Determinant& d, int i, int j, int a, int b, bool sz) {
-    int norbs = Determinant::norbs;
-    for (int l = 0; l < norbs; l++) 
-      intermediateForEachOrb[l] += (cps(l, a) + cps(l, b) - cps(l, i) - cps(l, j));
+    addCorrelatorColumn(cps, a, 1.);
+    addCorrelatorColumn(cps, b, 1.);
+    addCorrelatorColumn(cps, i, -1.);
+    addCorrelatorColumn(cps, j, -1.);
     intermediateForEachOrb[i] += cps(i, i);
     intermediateForEachOrb[a] -= cps(a, a);
     intermediateForEachOrb[j] += cps(j, j);
@@ -28,6 +28,7 @@
 #include "Deterministic.h"
 #include "ContinuousTime.h"
 #include "Metropolis.h"
+#include "ParallelTempering.h"
 #include <iostream>
 #include <fstream>
 #include <boost/serialization/serialization.hpp>
@@ -48,15 +49,29 @@ class twoInt;
 class twoIntHeatBathSHM;
 
 //############################################################Deterministic Evaluation############################################################################
+//All the deterministic evaluators below loop over the rank-local index range
+//of the Hilbert space, generating each determinant from its index, and are
+//threaded with thread-private wavefunction/walker copies and accumulators
 template<typename Wfn, typename Walker>
 void getEnergyDeterministic(Wfn &w, Walker& walk, double &Energy)
 {
   Deterministic<Wfn, Walker> D(w, walk);
   Energy = 0.0;
-  for (int i = commrank; i < D.allDets.size(); i += commsize)
+#pragma omp parallel
   {
-    D.LocalEnergy(D.allDets[i]);
-    D.UpdateEnergy(Energy);
+    Deterministic<Wfn, Walker> Dthrd = D.ThreadCopy();
+    double EnergyThrd = 0.0;
+#pragma omp for schedule(dynamic, 16)
+    for (long i = D.start; i < D.end; i++)
+    {
+      Dthrd.LocalEnergy((size_t) i);
+      Dthrd.UpdateEnergy(EnergyThrd);
+    }
+#pragma omp critical
+    {
+      D.Combine(Dthrd);
+      Energy += EnergyThrd;
+    }
   }
   D.FinishEnergy(Energy);
 }
@@ -67,28 +82,44 @@ template<typename Wfn, typename Walker> void getOneRdmDeterministic(Wfn &w, Walk
   int nalpha = Determinant::nalpha;
   int nbeta = Determinant::nbeta;
 
-  vector<Determinant> allDets;
-  generateAllDeterminants(allDets, norbs, nalpha, nbeta);
+  size_t start, end;
+  getLocalIndexRange(getNumAllDeterminants(norbs, nalpha, nbeta), start, end);
 
   double Overlap = 0;
   oneRdm = MatrixXd::Constant(norbs, norbs, 0.); 
-  MatrixXd localOneRdm = MatrixXd::Constant(norbs, norbs, 0.); 
 
-  for (int i = commrank; i < allDets.size(); i += commsize) {
-    w.initWalker(walk, allDets[i]);
-    localOneRdm.setZero(norbs, norbs);
+#pragma omp parallel
+  {
+    Wfn wthrd(w);
+    Walker walkthrd(walk);
+    Determinant d;
+    double OverlapThrd = 0.;
+    MatrixXd oneRdmThrd = MatrixXd::Constant(norbs, norbs, 0.);
+    MatrixXd localOneRdm = MatrixXd::Constant(norbs, norbs, 0.); 
     vector<int> open;
     vector<int> closed;
-    allDets[i].getOpenClosed(sz, open, closed);
-    for (int p = 0; p < closed.size(); p++) {
-      localOneRdm(closed[p], closed[p]) = 1.;
-      for (int q = 0; q < open.size() && open[q] < closed[p]; q++) {
-        localOneRdm(closed[p], open[q]) = w.getOverlapFactor(2*closed[p] + sz, 2*open[q] + sz, walk, 0);
+
+#pragma omp for schedule(dynamic, 16)
+    for (long i = start; i < end; i++) {
+      getDeterminantFromIndex(i, norbs, nalpha, nbeta, d);
+      wthrd.initWalker(walkthrd, d);
+      localOneRdm.setZero(norbs, norbs);
+      d.getOpenClosed(sz, open, closed);
+      for (int p = 0; p < closed.size(); p++) {
+        localOneRdm(closed[p], closed[p]) = 1.;
+        for (int q = 0; q < open.size() && open[q] < closed[p]; q++) {
+          localOneRdm(closed[p], open[q]) = wthrd.getOverlapFactor(2*closed[p] + sz, 2*open[q] + sz, walkthrd, 0);
+        }
       }
+      double ovlp = wthrd.Overlap(walkthrd);
+      OverlapThrd += ovlp * ovlp;
+      oneRdmThrd += ovlp * ovlp * localOneRdm;
+    }
+#pragma omp critical
+    {
+      Overlap += OverlapThrd;
+      oneRdm += oneRdmThrd;
     }
-    double ovlp = w.Overlap(walk);
-    Overlap += ovlp * ovlp;
-    oneRdm += ovlp * ovlp * localOneRdm;
   }
 #ifndef SERIAL
   MPI_Allreduce(MPI_IN_PLACE, &(Overlap), 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
@@ -104,29 +135,44 @@ template<typename Wfn, typename Walker> void getDensityCorrelationsDeterministic
   int nalpha = Determinant::nalpha;
   int nbeta = Determinant::nbeta;
 
-  vector<Determinant> allDets;
-  generateAllDeterminants(allDets, norbs, nalpha, nbeta);
+  size_t start, end;
+  getLocalIndexRange(getNumAllDeterminants(norbs, nalpha, nbeta), start, end);
 
   double Overlap = 0;
   corr = MatrixXd::Constant(2*norbs, 2*norbs, 0.);
-  MatrixXd localCorr = MatrixXd::Constant(2*norbs, 2*norbs, 0.); 
 
-  for (int i = commrank; i < allDets.size(); i += commsize) {
-    w.initWalker(walk, allDets[i]);
-    localCorr.setZero(2*norbs, 2*norbs);
+#pragma omp parallel
+  {
+    Wfn wthrd(w);
+    Walker walkthrd(walk);
+    Determinant d;
+    double OverlapThrd = 0.;
+    MatrixXd corrThrd = MatrixXd::Constant(2*norbs, 2*norbs, 0.);
     vector<int> open;
     vector<int> closed;
-    allDets[i].getOpenClosed(open, closed);
-    for (int p = 0; p < closed.size(); p++) {
-      localCorr(closed[p], closed[p]) = 1.;
-      for (int q = 0; q < p; q++) {
-        int P = max(closed[p], closed[q]), Q = min(closed[p], closed[q]);
-        localCorr(P, Q) = 1.;
+
+#pragma omp for schedule(dynamic, 16)
+    for (long i = start; i < end; i++) {
+      getDeterminantFromIndex(i, norbs, nalpha, nbeta, d);
+      wthrd.initWalker(walkthrd, d);
+      double ovlp = wthrd.Overlap(walkthrd);
+      double weight = ovlp * ovlp;
+      OverlapThrd += weight;
+      //the local correlation matrix is 0/1, so add the weight directly
+      d.getOpenClosed(open, closed);
+      for (int p = 0; p < closed.size(); p++) {
+        corrThrd(closed[p], closed[p]) += weight;
+        for (int q = 0; q < p; q++) {
+          int P = max(closed[p], closed[q]), Q = min(closed[p], closed[q]);
+          corrThrd(P, Q) += weight;
+        }
       }
     }
-    double ovlp = w.Overlap(walk);
-    Overlap += ovlp * ovlp;
-    corr += ovlp * ovlp * localCorr;
+#pragma omp critical
+    {
+      Overlap += OverlapThrd;
+      corr += corrThrd;
+    }
   }
 #ifndef SERIAL
   MPI_Allreduce(MPI_IN_PLACE, &(Overlap), 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
@@ -143,13 +189,27 @@ void getGradientDeterministic(Wfn &w, Walker &walk, double &Energy, VectorXd &gr
   Energy = 0.0;
   grad.setZero();
   VectorXd grad_ratio_bar = VectorXd::Zero(grad.rows());
-  for (int i = commrank; i < D.allDets.size(); i += commsize)
+#pragma omp parallel
   {
-    //if (schd.debug) cout << "det   " << D.allDets[i] << endl;
-    D.LocalEnergy(D.allDets[i]);
-    D.LocalGradient();
-    D.UpdateEnergy(Energy);
-    D.UpdateGradient(grad, grad_ratio_bar);
+    Deterministic<Wfn, Walker> Dthrd = D.ThreadCopy();
+    double EnergyThrd = 0.0;
+    VectorXd gradThrd = VectorXd::Zero(grad.rows());
+    VectorXd grad_ratio_barThrd = VectorXd::Zero(grad.rows());
+#pragma omp for schedule(dynamic, 16)
+    for (long i = D.start; i < D.end; i++)
+    {
+      Dthrd.LocalEnergy((size_t) i);
+      Dthrd.LocalGradient();
+      Dthrd.UpdateEnergy(EnergyThrd);
+      Dthrd.UpdateGradient(gradThrd, grad_ratio_barThrd);
+    }
+#pragma omp critical
+    {
+      D.Combine(Dthrd);
+      Energy += EnergyThrd;
+      grad += gradThrd;
+      grad_ratio_bar += grad_ratio_barThrd;
+    }
   }
   D.FinishEnergy(Energy); 
   D.FinishGradient(grad, grad_ratio_bar, Energy);
@@ -162,74 +222,136 @@ void getGradientMetricDeterministic(Wfn &w, Walker &walk, double &Energy, Vector
   Energy = 0.0;
   grad.setZero();
   VectorXd grad_ratio_bar = VectorXd::Zero(grad.rows());
-  for (int i = commrank; i < D.allDets.size(); i += commsize) 
+#pragma omp parallel
   {
-    D.LocalEnergy(D.allDets[i]);
-    D.LocalGradient();
-    D.UpdateEnergy(Energy);
-    D.UpdateGradient(grad, grad_ratio_bar);
-    D.UpdateSR(S);
+    Deterministic<Wfn, Walker> Dthrd = D.ThreadCopy();
+    DirectMetric SThrd(S.diagshift);
+    double EnergyThrd = 0.0;
+    VectorXd gradThrd = VectorXd::Zero(grad.rows());
+    VectorXd grad_ratio_barThrd = VectorXd::Zero(grad.rows());
+#pragma omp for schedule(dynamic, 16)
+    for (long i = D.start; i < D.end; i++)
+    {
+      Dthrd.LocalEnergy((size_t) i);
+      Dthrd.LocalGradient();
+      Dthrd.UpdateEnergy(EnergyThrd);
+      Dthrd.UpdateGradient(gradThrd, grad_ratio_barThrd);
+      Dthrd.UpdateSR(SThrd);
+    }
+#pragma omp critical
+    {
+      D.Combine(Dthrd);
+      Energy += EnergyThrd;
+      grad += gradThrd;
+      grad_ratio_bar += grad_ratio_barThrd;
+      S.Vectors.insert(S.Vectors.end(), SThrd.Vectors.begin(), SThrd.Vectors.end());
+      S.T.insert(S.T.end(), SThrd.T.begin(), SThrd.T.end());
+    }
   }
   D.FinishEnergy(Energy);
   D.FinishGradient(grad, grad_ratio_bar, Energy);
   D.FinishSR(grad, grad_ratio_bar, H);
 }
 
+//Only the independent parts of the linear method matrices are accumulated and
+//reduced: the first row and column of H and S follow from the gradient vectors
+//and S is symmetric, so only its lower triangle is sent over MPI
 template<typename Wfn, typename Walker>
 void getGradientHessianDeterministic(Wfn &w, Walker& walk, double &E0, int &nalpha, int &nbeta, int &norbs, oneInt &I1, twoInt &I2, twoIntHeatBathSHM &I2hb, double &coreE, VectorXd &grad, MatrixXd& Hessian, MatrixXd &Smatrix)
 {
-  vector<Determinant> allDets;
-  generateAllDeterminants(allDets, norbs, nalpha, nbeta);
-
-  vector<double> ovlpRatio;
-  vector<size_t> excitation1, excitation2;
-  vector<double> HijElements;
-  int nExcitations;
+  size_t start, end;
+  getLocalIndexRange(getNumAllDeterminants(norbs, nalpha, nbeta), start, end);
 
+  int nvars = grad.rows();
   double Overlap = 0, Energy = 0;
   grad.setZero();
-  VectorXd diagonalGrad = VectorXd::Zero(grad.rows());
-  VectorXd localdiagonalGrad = VectorXd::Zero(grad.rows());
-  VectorXd localgrad = VectorXd::Zero(grad.rows());
-  double temp = 0.;
+  VectorXd diagonalGrad = VectorXd::Zero(nvars);
+  VectorXd hamGrad = VectorXd::Zero(nvars);
+  MatrixXd HessianBlock = MatrixXd::Zero(nvars, nvars);
+  MatrixXd SmatrixBlock = MatrixXd::Zero(nvars, nvars);
 
-  for (int i = commrank; i < allDets.size(); i += commsize)
+#pragma omp parallel
   {
-    w.initWalker(walk, allDets[i]);
-    double ovlp = 0, ham = 0;
-
+    Wfn wthrd(w);
+    Walker walkthrd(walk);
+    Determinant d;
+    vector<double> ovlpRatio;
+    vector<size_t> excitation1, excitation2;
+    vector<double> HijElements;
+    int nExcitations;
+    double OverlapThrd = 0., EnergyThrd = 0.;
+    VectorXd gradThrd = VectorXd::Zero(nvars);
+    VectorXd diagonalGradThrd = VectorXd::Zero(nvars);
+    VectorXd hamGradThrd = VectorXd::Zero(nvars);
+    MatrixXd HessianThrd = MatrixXd::Zero(nvars, nvars);
+    MatrixXd SmatrixThrd = MatrixXd::Zero(nvars, nvars);
+    VectorXd localdiagonalGrad = VectorXd::Zero(nvars);
+    VectorXd localgrad = VectorXd::Zero(nvars);
+
+#pragma omp for schedule(dynamic, 16)
+    for (long i = start; i < end; i++)
     {
-      E0 = 0.;
-      double scale = 1.0;
+      getDeterminantFromIndex(i, norbs, nalpha, nbeta, d);
+      wthrd.initWalker(walkthrd, d);
+      double ovlp = 0, ham = 0, E0thrd = 0.;
+
       localgrad.setZero();
       localdiagonalGrad.setZero();
-      w.HamAndOvlpGradient(walk, ovlp, ham, localgrad, I1, I2, I2hb, coreE, ovlpRatio,
-                           excitation1, excitation2, HijElements, nExcitations, true, false);
-
-      double tmpovlp = 1.0;
-      w.OverlapWithGradient(walk, ovlp, localdiagonalGrad);
+      wthrd.HamAndOvlpGradient(walkthrd, ovlp, ham, localgrad, I1, I2, I2hb, coreE, ovlpRatio,
+                               excitation1, excitation2, HijElements, nExcitations, true, false);
+      wthrd.OverlapWithGradient(walkthrd, ovlp, localdiagonalGrad);
+
+      double weight = ovlp * ovlp;
+      gradThrd += localdiagonalGrad * ham * weight;
+      diagonalGradThrd += localdiagonalGrad * weight;
+      hamGradThrd += localgrad * weight;
+      OverlapThrd += weight;
+      EnergyThrd += ham * weight;
+
+      HessianThrd.noalias() += (weight * localgrad) * localdiagonalGrad.transpose();
+      SmatrixThrd.selfadjointView<Lower>().rankUpdate(localdiagonalGrad, weight);
+    }
+#pragma omp critical
+    {
+      grad += gradThrd;
+      diagonalGrad += diagonalGradThrd;
+      hamGrad += hamGradThrd;
+      Overlap += OverlapThrd;
+      Energy += EnergyThrd;
+      HessianBlock += HessianThrd;
+      SmatrixBlock += SmatrixThrd;
     }
-    //grad += localgrad * ovlp * ovlp;
-    grad += localdiagonalGrad * ham * ovlp * ovlp;
-    diagonalGrad += localdiagonalGrad * ovlp * ovlp;
-    Overlap += ovlp * ovlp;
-    Energy += ham * ovlp * ovlp;
-
-    Hessian.block(1, 1, grad.rows(), grad.rows()) += localgrad * localdiagonalGrad.transpose() * ovlp * ovlp;
-    Smatrix.block(1, 1, grad.rows(), grad.rows()) += localdiagonalGrad * localdiagonalGrad.transpose() * ovlp * ovlp;
-    Hessian.block(0, 1, 1, grad.rows()) += ovlp * ovlp * localgrad.transpose();
-    Hessian.block(1, 0, grad.rows(), 1) += ovlp * ovlp * localgrad;
-    Smatrix.block(0, 1, 1, grad.rows()) += ovlp * ovlp * localdiagonalGrad.transpose();
-    Smatrix.block(1, 0, grad.rows(), 1) += ovlp * ovlp * localdiagonalGrad;
   }
+
+  //vectors and scalars go in one buffer, S as its packed lower triangle
+  VectorXd scalars(3 * nvars + 2);
+  scalars << grad, diagonalGrad, hamGrad, Overlap, Energy;
+  VectorXd packedS(nvars * (nvars + 1) / 2);
+  for (int j = 0, k = 0; j < nvars; j++)
+    for (int i = j; i < nvars; i++, k++)
+      packedS[k] = SmatrixBlock(i, j);
 #ifndef SERIAL
-  MPI_Allreduce(MPI_IN_PLACE, &(grad[0]), grad.rows(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &(diagonalGrad[0]), grad.rows(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &(Overlap), 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &(Energy), 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &(Hessian(0,0)), Hessian.rows()*Hessian.cols(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-  MPI_Allreduce(MPI_IN_PLACE, &(Smatrix(0,0)), Hessian.rows()*Hessian.cols(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, scalars.data(), scalars.rows(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, packedS.data(), packedS.rows(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, HessianBlock.data(), nvars * nvars, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
 #endif
+  grad = scalars.segment(0, nvars);
+  diagonalGrad = scalars.segment(nvars, nvars);
+  hamGrad = scalars.segment(2 * nvars, nvars);
+  Overlap = scalars[3 * nvars];
+  Energy = scalars[3 * nvars + 1];
+  for (int j = 0, k = 0; j < nvars; j++)
+    for (int i = j; i < nvars; i++, k++)
+      SmatrixBlock(i, j) = SmatrixBlock(j, i) = packedS[k];
+
+  Hessian.setZero(nvars + 1, nvars + 1);
+  Smatrix.setZero(nvars + 1, nvars + 1);
+  Hessian.block(1, 1, nvars, nvars) = HessianBlock;
+  Smatrix.block(1, 1, nvars, nvars) = SmatrixBlock;
+  Hessian.block(0, 1, 1, nvars) = hamGrad.transpose();
+  Hessian.block(1, 0, nvars, 1) = hamGrad;
+  Smatrix.block(0, 1, 1, nvars) = diagonalGrad.transpose();
+  Smatrix.block(1, 0, nvars, 1) = diagonalGrad;
 
   E0 = Energy / Overlap;
   grad = (grad - E0 * diagonalGrad) / Overlap;
@@ -246,31 +368,42 @@ void getLanczosCoeffsDeterministic(Wfn &w, Walker &walk, double &alpha, Eigen::V
   int nalpha = Determinant::nalpha;
   int nbeta = Determinant::nbeta;
 
-  vector<Determinant> allDets;
-  generateAllDeterminants(allDets, norbs, nalpha, nbeta);
-
-  workingArray work, moreWork;
+  size_t start, end;
+  getLocalIndexRange(getNumAllDeterminants(norbs, nalpha, nbeta), start, end);
 
   double overlapTot = 0.; 
   Eigen::VectorXd coeffs = Eigen::VectorXd::Zero(4);
   //w.printVariables();
 
-  for (int i = commrank; i < allDets.size(); i += commsize)
+#pragma omp parallel
   {
-    w.initWalker(walk, allDets[i]);
-    Eigen::VectorXd coeffsSample = Eigen::VectorXd::Zero(4);
-    double overlapSample = 0.;
-    w.HamAndOvlpLanczos(walk, coeffsSample, overlapSample, work, moreWork, alpha);
-    if (schd.debug) {
-      cout << "walker\n" << walk << endl;
-      cout << "coeffsSample\n" << coeffsSample << endl;
+    Wfn wthrd(w);
+    Walker walkthrd(walk);
+    Determinant d;
+    workingArray work, moreWork;
+    double overlapTotThrd = 0.;
+    Eigen::VectorXd coeffsThrd = Eigen::VectorXd::Zero(4);
+
+#pragma omp for schedule(dynamic, 16)
+    for (long i = start; i < end; i++)
+    {
+      getDeterminantFromIndex(i, norbs, nalpha, nbeta, d);
+      wthrd.initWalker(walkthrd, d);
+      Eigen::VectorXd coeffsSample = Eigen::VectorXd::Zero(4);
+      double overlapSample = 0.;
+      wthrd.HamAndOvlpLanczos(walkthrd, coeffsSample, overlapSample, work, moreWork, alpha);
+      if (schd.debug) {
+        cout << "walker\n" << walkthrd << endl;
+        cout << "coeffsSample\n" << coeffsSample << endl;
+      }
+      overlapTotThrd += overlapSample * overlapSample;
+      coeffsThrd += (overlapSample * overlapSample) * coeffsSample;
+    }
+#pragma omp critical
+    {
+      overlapTot += overlapTotThrd;
+      coeffs += coeffsThrd;
     }
-    //cout << "ham  " << ham[0] << "  " << ham[1] << "  " << ham[2] << endl;
-    //cout << "ovlp  " << ovlp[0] << "  " << ovlp[1] << "  " << ovlp[2] << endl << endl;
-    
-    //grad += localgrad * ovlp * ovlp;
-    overlapTot += overlapSample * overlapSample;
-    coeffs += (overlapSample * overlapSample) * coeffsSample;
   }
 
 #ifndef SERIAL
@@ -808,6 +941,51 @@ void getStochasticGradientMetropolis(Wfn &w, Walker &walk, double &Energy, doubl
   M.FinishGradient(grad, grad_ratio_bar, Energy);
 }
 
+//############################################################Replica Exchange Evaluation############################################################################
+template<typename Wfn, typename Walker>
+void getStochasticGradientParallelTempering(Wfn &w, Walker &walk, double &Energy, double &stddev, VectorXd &grad, double &rk, int niter)
+{
+  ParallelTempering<Wfn, Walker> PT(w, walk, niter);
+  Energy = 0.0, stddev = 0.0, rk = 0.0;
+  grad.setZero();
+  VectorXd grad_ratio_bar = VectorXd::Zero(grad.rows());
+  for (int iter = 0; iter < schd.burnIter; iter++)
+    PT.MakeMove();
+  for (int iter = 0; iter < niter; iter++)
+  {
+    PT.LocalEnergy();
+    PT.LocalGradient();
+    PT.MakeMove();
+    PT.UpdateEnergy(Energy);
+    PT.UpdateGradient(grad, grad_ratio_bar);
+  }
+  PT.FinishEnergy(Energy, stddev, rk);
+  PT.FinishGradient(grad, grad_ratio_bar, Energy);
+}
+
+template<typename Wfn, typename Walker>
+void getStochasticGradientMetricParallelTempering(Wfn &w, Walker &walk, double &Energy, double &stddev, VectorXd &grad, VectorXd &H, DirectMetric &S, double &rk, int niter)
+{
+  ParallelTempering<Wfn, Walker> PT(w, walk, niter);
+  Energy = 0.0, stddev = 0.0, rk = 0.0;
+  grad.setZero();
+  VectorXd grad_ratio_bar = VectorXd::Zero(grad.rows());
+  for (int iter = 0; iter < schd.burnIter; iter++)
+    PT.MakeMove();
+  for (int iter = 0; iter < niter; iter++)
+  {
+    PT.LocalEnergy();
+    PT.LocalGradient();
+    PT.MakeMove();
+    PT.UpdateEnergy(Energy);
+    PT.UpdateGradient(grad, grad_ratio_bar);
+    PT.UpdateSR(S);
+  }
+  PT.FinishEnergy(Energy, stddev, rk);
+  PT.FinishGradient(grad, grad_ratio_bar, Energy);
+  PT.FinishSR(grad, grad_ratio_bar, H);
+}
+
 template <typename Wfn, typename Walker>
 class getGradientWrapper
 {
@@ -828,7 +1006,11 @@ class getGradientWrapper
     w.initWalker(walk);
     if (!deterministic)
     {
-      if (ctmc)
+      if (schd.temperingChains > 1)
+      {
+        getStochasticGradientParallelTempering(w, walk, E0, stddev, grad, rt, stochasticIter);
+      }
+      else if (ctmc)
       {
         getStochasticGradientContinuousTime(w, walk, E0, stddev, grad, rt, stochasticIter);
       }
@@ -852,7 +1034,10 @@ class getGradientWrapper
       w.initWalker(walk);
       if (!deterministic)
       {
-        getStochasticGradientMetricContinuousTime(w, walk, E0, stddev, grad, H, S, rt, stochasticIter);
+        if (schd.temperingChains > 1)
+          getStochasticGradientMetricParallelTempering(w, walk, E0, stddev, grad, H, S, rt, stochasticIter);
+        else
+          getStochasticGradientMetricContinuousTime(w, walk, E0, stddev, grad, H, S, rt, stochasticIter);
       }
       else
       {
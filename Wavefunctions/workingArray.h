@@ -19,8 +19,16 @@
 #ifndef workingArray_HEADER_H
 #define workingArray_HEADER_H
 #include <vector>
+#include <cstdint>
+#include <algorithm>
 
 
+//spin orbital indices of a single (J = B = 0) or a double excitation,
+//decoded from the packed excitation1/excitation2 entries (I * 2 * norbs + A)
+struct excitationRecord {
+  uint16_t I, A, J, B;
+};
+
 //this is a simple class that just stores the set of 
 //overlaps and hij matix elements whenever local energy is
 //calculated
@@ -33,7 +41,7 @@ struct workingArray {
   double locNorm;   // adding this for multiSlater sampling, this is bad jailbreaking, needs to be changed 
   int nExcitations;
 
-  workingArray(size_t initialSize = 1000000) {
+  workingArray(size_t initialSize = 100000) {
     nExcitations = 0;
     locNorm = 1.0;
     ovlpRatio.resize(initialSize);
@@ -49,11 +57,19 @@ struct workingArray {
     excitation2.resize(newSize);
     HijElement.resize(newSize);
   }
+
+  //makes room for n more excitations, the excitation generators call this
+  //with the number of heat bath integrals above the screening threshold so
+  //that appendValue never has to grow the arrays
+  void reserve(size_t n) {
+    size_t needed = nExcitations + n;
+    if (ovlpRatio.size() < needed)
+      incrementSize(std::max(needed, 2 * ovlpRatio.size()) - ovlpRatio.size());
+  }
   
   void appendValue(double ovlp, size_t ex1, size_t ex2, double hij) {
-    int ovlpsize = ovlpRatio.size();
-    if (ovlpsize <= nExcitations) 
-      incrementSize(1000000);
+    if (ovlpRatio.size() <= nExcitations) 
+      reserve(std::max<size_t>(ovlpRatio.size(), 1024));
 
     ovlpRatio[nExcitations] = ovlp;
     excitation1[nExcitations] = ex1;
@@ -62,6 +78,18 @@ struct workingArray {
     nExcitations++;
   }
 
+  static void decode(size_t ex, int norbs, int &I, int &A) {
+    I = ex / (2 * norbs);
+    A = ex - 2 * norbs * I;
+  }
+
+  excitationRecord getExcitation(int i, int norbs) const {
+    int I, A, J, B;
+    decode(excitation1[i], norbs, I, A);
+    decode(excitation2[i], norbs, J, B);
+    return excitationRecord{(uint16_t) I, (uint16_t) A, (uint16_t) J, (uint16_t) B};
+  }
+
   void setCounterToZero() {
     nExcitations = 0;
   }
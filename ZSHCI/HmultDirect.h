@@ -90,6 +90,11 @@ struct HmultDirect {
     coreE(pcoreE),
     diag(pDiag) {};
   
+  // H_IJ of the pairs j < k of each N-1 string handled by this process; the
+  // single excitations are evaluated in the first multiplication and reused
+  vector<vector<CItype>> singles;
+  bool singlesCached = false;
+
   void operator() (CItype *x, CItype *y) {
     if (StartIndex >= DetsSize) return;
 
@@ -97,57 +102,95 @@ struct HmultDirect {
     boost::mpi::communicator world;
     #endif
     int nprocs = commsize, proc = commrank;
-    size_t norbs = Norbs;
+    int nstrings1 = Nminus1ToDetSM.size(), nstrings2 = Nminus2ToDetSM.size();
+    if (!singlesCached) singles.resize((nstrings1 + nprocs - 1) / nprocs);
 
-    //diagonal elements
-    for (size_t k=StartIndex; k<DetsSize; k++) {
-      if (k%(nprocs) != proc) continue;
-      CItype hij = Dets[k].Energy(I1, I2, coreE);
-      y[k] += hij*x[k];
-    }
+    vector<CItype> ytemp(DetsSize, 0);
+#pragma omp declare reduction(vec_CItype_plus : std::vector<CItype> : \
+                              std::transform(omp_out.begin(), omp_out.end(), omp_in.begin(), omp_out.begin(), std::plus<CItype>())) \
+                    initializer(omp_priv = omp_orig)
 
-    size_t orbDiff;
-    // single excitations
-    for (int i = 0; i < Nminus1ToDetSM.size(); i++) {
-      for (int j = 0; j<Nminus1ToDetLen[i]; j++) {
-        int DetI = Nminus1ToDetSM[i][j];
-        //if (DetI % nprocs != proc || DetI < 0) continue;
-        for (int k = 0; k<j; k++) {
-          int DetJ = Nminus1ToDetSM[i][k];
-          if (DetI < StartIndex && DetJ < StartIndex) continue;
-          CItype hij = Hij(Dets[DetI], Dets[DetJ], I1, I2, coreE, orbDiff);
-          y[DetI] += hij*x[DetJ];
-        }
-        for (int k = j+1; k<Nminus1ToDetLen[i]; k++) {
-          int DetJ = Nminus1ToDetSM[i][k];
-          if (DetI < StartIndex && DetJ < StartIndex) continue;
-          CItype hij = Hij(Dets[DetI], Dets[DetJ], I1, I2, coreE, orbDiff);
-          y[DetI] += hij*x[DetJ];
-        }
+#pragma omp parallel reduction(vec_CItype_plus : ytemp)
+    {
+      size_t orbDiff;
+
+      //diagonal elements
+#pragma omp for
+      for (int k = StartIndex; k < DetsSize; k++) {
+        if (k % nprocs != proc) continue;
+        ytemp[k] += Dets[k].Energy(I1, I2, coreE) * x[k];
       }
-    }
 
-    for (int i = 0; i < Nminus2ToDetSM.size(); i++) {
-    //if (i % nprocs != proc) continue;
-      for (int j = 0; j<Nminus2ToDetLen[i]; j++) {
-        int DetI = Nminus2ToDetSM[i][j];
-        //if (DetI % nprocs != proc || DetI < 0) continue;
-        for (int k=0; k<j; k++) {
-          int DetJ = Nminus2ToDetSM[i][k];
-          //if (DetI < StartIndex && DetJ < StartIndex) continue;
-          if (Dets[Nminus2ToDetSM[i][j]].ExcitationDistance(Dets[Nminus2ToDetSM[i][k]]) != 2) continue;
-          CItype hij = Hij(Dets[DetI], Dets[DetJ], I1, I2, coreE, orbDiff);
-          y[DetI] += hij*x[DetJ];
+      // single excitations, each pair of a N-1 string once
+#pragma omp for schedule(dynamic) nowait
+      for (int i = proc; i < nstrings1; i += nprocs) {
+        vector<CItype>& hijs = singles[i / nprocs];
+        int* dets = Nminus1ToDetSM[i];
+        int len = Nminus1ToDetLen[i];
+        if (!singlesCached) hijs.reserve(len * (len - 1) / 2);
+        size_t pair = 0;
+        for (int j = 0; j < len; j++) {
+          int DetI = dets[j];
+          for (int k = j + 1; k < len; k++, pair++) {
+            int DetJ = dets[k];
+            if (DetI < StartIndex && DetJ < StartIndex) {
+              if (!singlesCached) hijs.push_back(0.);
+              continue;
+            }
+            if (!singlesCached)
+              hijs.push_back(Hij(Dets[DetI], Dets[DetJ], I1, I2, coreE, orbDiff));
+            CItype hij = hijs[pair];
+            ytemp[DetI] += hij * x[DetJ];
+#ifdef Complex
+            ytemp[DetJ] += std::conj(hij) * x[DetI];
+#else
+            ytemp[DetJ] += hij * x[DetI];
+#endif
+          }
         }
-        for (int k=j+1; k<Nminus2ToDetLen[i]; k++) {
-          int DetJ = Nminus2ToDetSM[i][k];
-          //if (DetI < StartIndex && DetJ < StartIndex) continue;
-          if (Dets[Nminus2ToDetSM[i][j]].ExcitationDistance(Dets[Nminus2ToDetSM[i][k]]) != 2) continue;
-          CItype hij = Hij(Dets[DetI], Dets[DetJ], I1, I2, coreE, orbDiff);
-          y[DetI] += hij*x[DetJ];
+      }
+
+      // double excitations, recomputed in every multiplication
+#pragma omp for schedule(dynamic)
+      for (int i = proc; i < nstrings2; i += nprocs) {
+        int* dets = Nminus2ToDetSM[i];
+        int len = Nminus2ToDetLen[i];
+        for (int j = 0; j < len; j++) {
+          int DetI = dets[j];
+          for (int k = j + 1; k < len; k++) {
+            int DetJ = dets[k];
+            if (DetI < StartIndex && DetJ < StartIndex) continue;
+            if (Dets[DetI].ExcitationDistance(Dets[DetJ]) != 2) continue;
+            CItype hij = Hij(Dets[DetI], Dets[DetJ], I1, I2, coreE, orbDiff);
+            ytemp[DetI] += hij * x[DetJ];
+#ifdef Complex
+            ytemp[DetJ] += std::conj(hij) * x[DetI];
+#else
+            ytemp[DetJ] += hij * x[DetI];
+#endif
+          }
         }
       }
     }
+    singlesCached = true;
+
+    // Reduce result vector y (if using distributed memory)
+#ifndef SERIAL
+#ifndef Complex
+    int count = DetsSize;
+#else
+    int count = 2 * DetsSize;
+#endif
+    if (localrank == 0) {
+      MPI_Reduce(MPI_IN_PLACE, &ytemp[0], count, MPI_DOUBLE, MPI_SUM, 0, localcomm);
+      for (int j = 0; j < DetsSize; j++) y[j] += ytemp[j];
+    } else {
+      MPI_Reduce(&ytemp[0], &ytemp[0], count, MPI_DOUBLE, MPI_SUM, 0, localcomm);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+#else
+    for (int j = 0; j < DetsSize; j++) y[j] += ytemp[j];
+#endif
   }
 };
 #endif
\ No newline at end of file
@@ -266,6 +266,34 @@ void SHCImake4cHamiltonian::MakeHfromSMHelpers(
       }
     }
   }
+  sparseHam.compress(DoRDM);
+}
+
+void SHCImake4cHamiltonian::SparseHam::compress(bool keepRows) {
+  int firstRow = nrows();
+  if (rowStart.empty()) rowStart.push_back(0);
+
+  size_t nnz = rowStart.back();
+  for (int i = firstRow; i < connections.size(); i++)
+    nnz += connections[i].size();
+
+  rowStart.reserve(connections.size() + 1);
+  colIndex.reserve(nnz);
+  if (singlePrecision) valuesFloat.reserve(nnz);
+  else values.reserve(nnz);
+
+  for (int i = firstRow; i < connections.size(); i++) {
+    for (int j = 0; j < connections[i].size(); j++) {
+      colIndex.push_back(connections[i][j]);
+      if (singlePrecision) valuesFloat.push_back(CItypeFloat(Helements[i][j]));
+      else values.push_back(Helements[i][j]);
+    }
+    rowStart.push_back(colIndex.size());
+    if (!keepRows) {
+      std::vector<int>().swap(connections[i]);
+      std::vector<CItype>().swap(Helements[i]);
+    }
+  }
 }
 
 void SHCImake4cHamiltonian::SparseHam::setNbatches(int DetSize) {
@@ -7,6 +7,8 @@
 #include <tuple>
 #include <map>
 #include <boost/serialization/serialization.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/complex.hpp>
 #include "robin_hood.h"
 #include "cdfci.h"
 
@@ -48,9 +50,22 @@ namespace SHCImake4cHamiltonian {
 
 // This should just be the same as SparseHam in SHCImakeHamiltonian.h
 struct SparseHam {
+#ifdef Complex
+    typedef std::complex<float> CItypeFloat;
+#else
+    typedef float CItypeFloat;
+#endif
     std::vector<std::vector<int> > connections;  
     std::vector<std::vector<CItype> > Helements;
     std::vector<std::vector<size_t> > orbDifference;
+
+    // lower triangle in CSR form, local row i is determinant i*nprocs+proc
+    std::vector<size_t> rowStart;
+    std::vector<int> colIndex;
+    std::vector<CItype> values;
+    std::vector<CItypeFloat> valuesFloat;  // replaces values if singlePrecision
+    bool singlePrecision;
+
     int Nbatches;
     int BatchSize;
     bool diskio;
@@ -58,6 +73,7 @@ struct SparseHam {
     SparseHam() {
       diskio = false;
       Nbatches = 1;
+      singlePrecision = false;
     }
 
 
@@ -66,12 +82,30 @@ struct SparseHam {
       connections.clear();
       Helements.clear();
       orbDifference.clear();
+      rowStart.clear();
+      colIndex.clear();
+      values.clear();
+      valuesFloat.clear();
     }
 
     void resize(int size) {
       connections.resize(size);
       Helements.resize(size);
       orbDifference.resize(size);
+      if (size == 0) clear();
+    }
+
+    int nrows() const { return rowStart.empty() ? 0 : rowStart.size() - 1; }
+
+    size_t nonZeros() const { return rowStart.empty() ? 0 : rowStart.back(); }
+
+    // same as SHCImakeHamiltonian::SparseHam::compress
+    void compress(bool keepRows);
+
+    template<class Archive>
+    void serialize(Archive & ar, const unsigned int version) {
+      ar & connections & Helements & orbDifference;
+      ar & rowStart & colIndex & values & valuesFloat & singlePrecision;
     }
 
     // This function is the only one in sparseHam that is modified
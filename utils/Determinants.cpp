@@ -981,35 +981,12 @@ void generateAllScreenedSingleExcitation(const Determinant& d,
                                          const double& TINY,
                                          workingArray& work,
                                          bool doparity) {
-  int norbs = Determinant::norbs;
-  vector<int> closed;
-  vector<int> open;
-  d.getOpenClosed(open, closed);
-
-  //schd.active = number of active spatial orbitals, assumed to be contiguous and at the beginning
-  //auto ub_1 = upper_bound(open.begin(), open.end(), 2*schd.numActive - 1);
-  //int indAct = distance(open.begin(), ub_1);
-
-  //auto ub_2 = upper_bound(closed.begin(), closed.end(), 2*schd.nciCore - 1);
-  //int indCore = distance(closed.begin(), ub_2);
-
-  for (int i = 0; i < closed.size(); i++) {
-    for (int a = 0; a < open.size(); a++) {
-      if (closed[i] % 2 == open[a] % 2 &&
-          abs(I2hb.Singles(closed[i], open[a])) > THRESH)
-      {
-        int I = closed[i] / 2, A = open[a] / 2;
-
-        const double tia = d.Hij_1ExciteScreened(open[a], closed[i], I2hb,
-                                                 TINY, doparity);
-        
-        if (abs(tia) > THRESH) {
-          work.appendValue(0., closed[i]*2*norbs+open[a], 0, tia);
-        }
-      }
-    }
-  }
-
+  int norbs = Determinant::norbs, nalpha = Determinant::nalpha, nbeta = Determinant::nbeta;
+  work.reserve(nalpha * (norbs - nalpha) + nbeta * (norbs - nbeta));
+  forEachScreenedSingleExcitation(d, THRESH, TINY, doparity,
+                                  [&work](size_t ex1, size_t ex2, double tia) {
+                                    work.appendValue(0., ex1, ex2, tia);
+                                  });
 }
 
 void generateAllScreenedDoubleExcitation(const Determinant& d,
@@ -1017,41 +994,10 @@ void generateAllScreenedDoubleExcitation(const Determinant& d,
                                          const double& TINY,
                                          workingArray& work,
                                          bool doparity) {
-  int norbs = Determinant::norbs;
-  vector<int> closed;
-  vector<int> open;
-  d.getOpenClosed(open, closed);
-
-  int nclosed = closed.size();
-  for (int i = 0; i<nclosed; i++) {
-    for (int j = 0; j<i; j++) {
-
-      const float *integrals; const short* orbIndices;
-      size_t numIntegrals;
-      I2hb.getIntegralArray(closed[i], closed[j], integrals, orbIndices, numIntegrals);
-      size_t numLargeIntegrals = std::lower_bound(integrals, integrals + numIntegrals, THRESH, [](const float &x, float val){ return fabs(x) > val; }) - integrals;
-
-      // for all HCI integrals
-      for (size_t index = 0; index < numLargeIntegrals; index++)
-      {
-        // if we are going below the criterion, break
-        //if (fabs(integrals[index]) < THRESH)
-        //  break;
-
-        // otherwise: generate the determinant corresponding to the current excitation
-        int a = 2 * orbIndices[2 * index] + closed[i] % 2,
-            b = 2 * orbIndices[2 * index + 1] + closed[j] % 2;
-
-        //if ((!(d.getocc(a) || d.getocc(b))) && (a < 2*schd.numActive) && (b < 2*schd.numActive)) {//uncomment for VMC active space calculations
-        if (!(d.getocc(a) || d.getocc(b))) {
-          //cout << "a   " << a << "  b  " << b << endl;
-          work.appendValue(0.0, closed[i] * 2 * norbs + a,
-                           closed[j] * 2 * norbs + b, integrals[index]);
-        }
-      }
-    }
-  }
-
+  forEachScreenedDoubleExcitation(d, THRESH,
+                                  [&work](size_t ex1, size_t ex2, double hij) {
+                                    work.appendValue(0.0, ex1, ex2, hij);
+                                  });
 }
 
 void generateAllScreenedDoubleExcitationsFOIS(const Determinant& d,
@@ -2056,3 +2002,58 @@ void generateAllDeterminantsFOIS(vector<Determinant>& allDets, int norbs, int na
   alphaDets.clear();
   betaDets.clear();
 }
+
+size_t nChooseK(int N, int K)
+{
+  if (K < 0 || K > N) return 0;
+  K = min(K, N - K);
+  size_t result = 1;
+  for (int i = 1; i <= K; i++)
+    result = result * (N - K + i) / i;
+  return result;
+}
+
+//comb produces the combinations in lexicographic order of the sorted orbital
+//lists, so the first orbital of the index-th combination is found by skipping
+//over the blocks of combinations that start with the smaller orbitals
+void unrankComb(size_t index, int N, int K, vector<int> &combination)
+{
+  combination.resize(K);
+  int orb = 0;
+  for (int k = 0; k < K; k++) {
+    while (true) {
+      size_t nWithOrb = nChooseK(N - orb - 1, K - k - 1);
+      if (index < nWithOrb) break;
+      index -= nWithOrb;
+      orb++;
+    }
+    combination[k] = orb;
+    orb++;
+  }
+}
+
+size_t getNumAllDeterminants(int norbs, int nalpha, int nbeta)
+{
+  return nChooseK(norbs, nalpha) * nChooseK(norbs, nbeta);
+}
+
+void getDeterminantFromIndex(size_t index, int norbs, int nalpha, int nbeta, Determinant& d)
+{
+  size_t nBetaStrings = nChooseK(norbs, nbeta);
+  vector<int> alphaOrbs, betaOrbs;
+  unrankComb(index / nBetaStrings, norbs, nalpha, alphaOrbs);
+  unrankComb(index % nBetaStrings, norbs, nbeta, betaOrbs);
+
+  d = Determinant();
+  for (int i = 0; i < alphaOrbs.size(); i++)
+    d.setoccA(alphaOrbs[i], true);
+  for (int i = 0; i < betaOrbs.size(); i++)
+    d.setoccB(betaOrbs[i], true);
+}
+
+void getLocalIndexRange(size_t nDets, size_t& start, size_t& end)
+{
+  size_t blockSize = nDets / commsize, remainder = nDets % commsize;
+  start = commrank * blockSize + min((size_t)commrank, remainder);
+  end = start + blockSize + (commrank < remainder ? 1 : 0);
+}
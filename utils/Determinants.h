@@ -20,8 +20,11 @@
 #define Determinants_HEADER_H
 
 #include "global.h"
+#include "integral.h"
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include <boost/serialization/serialization.hpp>
 #include <boost/functional/hash.hpp>
 #include <Eigen/Dense>
@@ -241,6 +244,65 @@ void generateAllScreenedDoubleExcitation(const Determinant& det,
                                          workingArray& work,
                                          bool doparity = false);
 
+//---Streaming versions of the two generators above: f(ex1, ex2, hij) is
+//---called for every excitation as soon as it is generated, with ex1/ex2
+//---packed as in workingArray, so the overlap ratios can be evaluated
+//---without materializing the list of excitations
+
+template<typename F>
+void forEachScreenedSingleExcitation(const Determinant& d,
+                                     const double& THRESH,
+                                     const double& TINY,
+                                     bool doparity, F&& f)
+{
+  int norbs = Determinant::norbs;
+  vector<int> closed;
+  vector<int> open;
+  d.getOpenClosed(open, closed);
+
+  for (int i = 0; i < closed.size(); i++) {
+    for (int a = 0; a < open.size(); a++) {
+      if (closed[i] % 2 == open[a] % 2 &&
+          abs(I2hb.Singles(closed[i], open[a])) > THRESH)
+      {
+        const double tia = d.Hij_1ExciteScreened(open[a], closed[i], I2hb,
+                                                 TINY, doparity);
+        if (abs(tia) > THRESH)
+          f((size_t) closed[i] * 2 * norbs + open[a], (size_t) 0, tia);
+      }
+    }
+  }
+}
+
+template<typename F>
+void forEachScreenedDoubleExcitation(const Determinant& d,
+                                     const double& THRESH, F&& f)
+{
+  int norbs = Determinant::norbs;
+  vector<int> closed;
+  vector<int> open;
+  d.getOpenClosed(open, closed);
+
+  int nclosed = closed.size();
+  for (int i = 0; i<nclosed; i++) {
+    for (int j = 0; j<i; j++) {
+      const float *integrals; const short* orbIndices;
+      size_t numIntegrals;
+      I2hb.getIntegralArray(closed[i], closed[j], integrals, orbIndices, numIntegrals);
+      size_t numLargeIntegrals = std::lower_bound(integrals, integrals + numIntegrals, THRESH, [](const float &x, float val){ return fabs(x) > val; }) - integrals;
+
+      for (size_t index = 0; index < numLargeIntegrals; index++)
+      {
+        int a = 2 * orbIndices[2 * index] + closed[i] % 2,
+            b = 2 * orbIndices[2 * index + 1] + closed[j] % 2;
+
+        if (!(d.getocc(a) || d.getocc(b)))
+          f((size_t) closed[i] * 2 * norbs + a, (size_t) closed[j] * 2 * norbs + b, (double) integrals[index]);
+      }
+    }
+  }
+}
+
 //---Generate all screened excitations in the FOIS---------------
 
 void generateAllScreenedDoubleExcitationsFOIS(const Determinant& det,
@@ -371,6 +433,22 @@ void generateAllDeterminantsActive(vector<Determinant>& allDets, const Determina
                                    const int nact, const int nalpha, const int nbeta);
 void generateAllDeterminantsFOIS(vector<Determinant>& allDets, int norbs, int nalpha, int nbeta);
 
+//number of ways of choosing K out of N orbitals
+size_t nChooseK(int N, int K);
+
+//the index-th combination of K out of N, in the order generated by comb
+void unrankComb(size_t index, int N, int K, vector<int> &combination);
+
+//number of determinants enumerated by generateAllDeterminants
+size_t getNumAllDeterminants(int norbs, int nalpha, int nbeta);
+
+//the determinant allDets[index] of generateAllDeterminants, without
+//generating the rest of the Hilbert space
+void getDeterminantFromIndex(size_t index, int norbs, int nalpha, int nbeta, Determinant& d);
+
+//contiguous range [start, end) of nDets indices owned by this rank
+void getLocalIndexRange(size_t nDets, size_t& start, size_t& end);
+
 template<> struct std::hash<Determinant>
 {
   std::size_t operator()(Determinant const& d) const noexcept
@@ -198,34 +198,38 @@ double calcPfaffianH(const Eigen::MatrixXd &mat)
 
 std::complex<double> calcPfaffian(const Eigen::MatrixXcd &mat)
 {
-  Eigen::MatrixXcd matCopy = mat;
+  //only the strictly lower triangle is stored and updated, the upper one follows from skew symmetry
   int size = mat.rows();
+  if (size % 2 == 1) return 0.;
+  Eigen::MatrixXcd lower = mat.triangularView<Eigen::StrictlyLower>();
   std::complex<double> pfaffian = 1.;
-  int i = 0;
-  while (i < size-1) {
-    int currentSize = size-i;
-    Eigen::VectorXd colNorm = matCopy.col(i).tail(currentSize-1).cwiseAbs();
+  for (int i = 0; i < size - 1; i += 2) {
+    int currentSize = size - i;
     Eigen::VectorXd::Index maxIndex;
-    colNorm.maxCoeff(&maxIndex);
-    int ip = i+1+maxIndex;
-    //pivot if necessary
-    if (ip != i+1) {
-      matCopy.block(i,i,currentSize,currentSize).row(1).swap(matCopy.block(i,i,currentSize, currentSize).row(ip-i));
-      matCopy.block(i,i,currentSize,currentSize).col(1).swap(matCopy.block(i,i,currentSize, currentSize).col(ip-i));
+    lower.col(i).tail(currentSize - 1).cwiseAbs().maxCoeff(&maxIndex);
+    int ip = i + 1 + maxIndex;
+    //pivot if necessary, swapping rows and columns i+1 and ip within the lower triangle
+    if (ip != i + 1) {
+      std::swap(lower(i + 1, i), lower(ip, i));
+      for (int m = i + 2; m < ip; m++) {
+        std::complex<double> temp = lower(m, i + 1);
+        lower(m, i + 1) = -lower(ip, m);
+        lower(ip, m) = -temp;
+      }
+      lower(ip, i + 1) = -lower(ip, i + 1);
+      if (ip + 1 < size) lower.col(i + 1).tail(size - ip - 1).swap(lower.col(ip).tail(size - ip - 1));
       pfaffian *= -1;
     }
-    //gauss elimination
-    if (matCopy(i,i+1) != 0.) {
-      pfaffian *= matCopy(i,i+1);
-      Eigen::VectorXcd tau = matCopy.row(i).tail(currentSize-2);
-      tau /= matCopy(i,i+1);
-      if (i+2 < size) {
-        matCopy.block(i+2,i+2,currentSize-2,currentSize-2) += tau * matCopy.col(i+1).tail(currentSize-2).transpose(); 
-        matCopy.block(i+2,i+2,currentSize-2,currentSize-2) -= matCopy.col(i+1).tail(currentSize-2) * tau.transpose(); 
-      }
+    //gauss elimination, a skew rank-2 update of the trailing lower triangle
+    if (lower(i + 1, i) == 0.) return 0.;
+    pfaffian *= -lower(i + 1, i);
+    int trailSize = currentSize - 2;
+    if (trailSize > 0) {
+      Eigen::VectorXcd tau = lower.col(i).tail(trailSize) / lower(i + 1, i);
+      Eigen::VectorXcd pivotCol = lower.col(i + 1).tail(trailSize);
+      for (int l = 0; l < trailSize - 1; l++)
+        lower.col(i + 2 + l).tail(trailSize - l - 1) += tau.tail(trailSize - l - 1) * pivotCol(l) - pivotCol.tail(trailSize - l - 1) * tau(l);
     }
-    else return 0.;
-    i++; i++;
   }
   return pfaffian;
 }
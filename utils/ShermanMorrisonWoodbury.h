@@ -203,7 +203,7 @@ inline std::complex<double> calcDet(const Eigen::MatrixXcd &detSlice) {
 
 //pfaffian of a real matrix using Hessenberg decomposition
 double calcPfaffianH(const Eigen::MatrixXd &mat); 
-//pfaffian of a complex matrix using Parlett-Reid algorithm
+//pfaffian of a complex skew matrix using Parlett-Reid algorithm on its lower triangle
 std::complex<double> calcPfaffian(const Eigen::MatrixXcd &mat); 
 
 
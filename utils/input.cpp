@@ -125,6 +125,8 @@ void readInput(string inputFile, schedule& schd, bool print) {
     schd.integralSampleSize = input.get("sampling.integralSampleSize", 10);
     schd.useLastDet = input.get("sampling.useLastDet", false);
     schd.useLogTime = input.get("sampling.useLogTime", false);
+    schd.temperingChains = input.get("sampling.temperingChains", 1);
+    schd.temperingMinBeta = input.get("sampling.temperingMinBeta", 0.3);
     schd.numSCSamples = input.get("sampling.numSCSamples", 1e3);
     schd.normSampleThreshold = input.get("sampling.normSampleThreshold", 5.);
     schd.seed = input.get("sampling.seed", getTime());
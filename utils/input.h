@@ -86,6 +86,8 @@ private:
       & useLastDet
       & useLogTime
       & ctmc
+      & temperingChains
+      & temperingMinBeta
       & nwalk
       & tau
       & fn_factor
@@ -247,6 +249,8 @@ public:
   HAM Hamiltonian;
   bool useLastDet;                       //stores last det instead of bestdet
   bool useLogTime;                       //uses log sampled time in CTMC
+  int temperingChains;                   //number of replica exchange chains per rank, 1 means a single chain
+  double temperingMinBeta;               //smallest beta of the geometric |psi|^(2 beta) ladder
 
 // SC-NEVPT2(s) options:
   bool determCCVV;                       // In NEVPT2 calculations, calculate the CCVV energy by the exact formula